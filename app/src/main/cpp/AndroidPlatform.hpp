@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Platform.hpp"
+
+extern "C" {
+    #include <game-activity/native_app_glue/android_native_app_glue.h>
+}
+
+namespace Vulkan_Test
+{
+    // GameActivityのウィンドウに表示し、APKのassetsからファイルを読むプラットフォーム
+    class AndroidPlatform : public Platform
+    {
+    public:
+        explicit AndroidPlatform(android_app* pApp) : _pApp(pApp)
+        {
+        }
+
+        std::vector<const char*> getRequiredInstanceExtensions() const override
+        {
+            return { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_ANDROID_SURFACE_EXTENSION_NAME };
+        }
+
+        bool hasSurface() const override { return true; }
+
+        vk::UniqueSurfaceKHR createSurface(vk::Instance instance) override
+        {
+            vk::AndroidSurfaceCreateInfoKHR surfaceCreateInfo = vk::AndroidSurfaceCreateInfoKHR(vk::AndroidSurfaceCreateFlagsKHR(), _pApp->window);
+            return instance.createAndroidSurfaceKHRUnique(surfaceCreateInfo);
+        }
+
+        std::optional<std::vector<char>> readAsset(const std::string& name) override
+        {
+            AAssetManager* assetManager = _pApp->activity->assetManager;
+            AAsset* asset = AAssetManager_open(assetManager, name.c_str(), AASSET_MODE_BUFFER);
+            if (!asset)
+            {
+                return std::nullopt;
+            }
+
+            std::vector<char> data(AAsset_getLength(asset));
+            AAsset_read(asset, data.data(), data.size());
+            AAsset_close(asset);
+            return data;
+        }
+
+        // アプリ専用の内部ストレージ (アンインストールで消える)
+        std::string getCacheDirectory() const override
+        {
+            const char* internalDataPath = _pApp->activity->internalDataPath;
+            return internalDataPath ? std::string(internalDataPath) : std::string();
+        }
+
+        android_app* getApp() const { return _pApp; }
+
+    private:
+        android_app* _pApp;
+    };
+}
@@ -0,0 +1,165 @@
+#include "CommandPoolBenchmark.hpp"
+#include "FrameCommandPools.hpp"
+#include "TraceRecorder.hpp"
+#include "Utility.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace Vulkan_Test
+{
+    namespace
+    {
+        // 何かしら記録されている状態にするため、リソースを使わない軽いコマンドを1つだけ積む
+        void recordDummy(vk::CommandBuffer commandBuffer)
+        {
+            vk::CommandBufferBeginInfo beginInfo;
+            beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+            commandBuffer.begin(beginInfo);
+            vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, { barrier }, {}, {});
+            commandBuffer.end();
+        }
+
+        // フレームスロットごとのフェンスを持ち、スロットを使う前にそのスロットの前回の実行を待つ
+        class FrameFences
+        {
+        public:
+            FrameFences(vk::Device device, uint32_t frameCount)
+                : _device(device)
+            {
+                for (uint32_t i = 0; i < frameCount; i++)
+                {
+                    _fences.push_back(device.createFenceUnique(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled)));
+                }
+            }
+
+            vk::Fence wait(uint32_t frameIndex)
+            {
+                vk::Fence fence = _fences[frameIndex].get();
+                if (_device.waitForFences({ fence }, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+                {
+                    LOGERR("CommandPoolBenchmark: failed to wait fence");
+                    exit(EXIT_FAILURE);
+                }
+                _device.resetFences({ fence });
+                return fence;
+            }
+
+        private:
+            vk::Device _device;
+            std::vector<vk::UniqueFence> _fences;
+        };
+
+        void submit(vk::Queue queue, const std::vector<vk::CommandBuffer>& commandBuffers, vk::Fence fence)
+        {
+            vk::SubmitInfo submitInfo;
+            submitInfo.commandBufferCount = commandBuffers.size();
+            submitInfo.pCommandBuffers = commandBuffers.data();
+            queue.submit({ submitInfo }, fence);
+        }
+
+        double benchmarkResetPerBuffer(vk::Device device, uint32_t queueFamilyIndex, vk::Queue queue, uint32_t frameCount, uint32_t warmupFrames, uint32_t frames, uint32_t buffersPerFrame)
+        {
+            TRACE_SCOPE("reset per buffer");
+
+            vk::CommandPoolCreateInfo poolCreateInfo;
+            poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+            poolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+            vk::UniqueCommandPool pool = device.createCommandPoolUnique(poolCreateInfo);
+
+            vk::CommandBufferAllocateInfo allocateInfo;
+            allocateInfo.commandPool = pool.get();
+            allocateInfo.commandBufferCount = buffersPerFrame;
+            allocateInfo.level = vk::CommandBufferLevel::ePrimary;
+            std::vector<std::vector<vk::CommandBuffer>> slots;
+            for (uint32_t i = 0; i < frameCount; i++)
+            {
+                slots.push_back(device.allocateCommandBuffers(allocateInfo));
+            }
+
+            FrameFences fences(device, frameCount);
+            std::chrono::steady_clock::duration total{};
+            for (uint32_t frame = 0; frame < warmupFrames + frames; frame++)
+            {
+                uint32_t slot = frame % frameCount;
+                vk::Fence fence = fences.wait(slot);
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (vk::CommandBuffer commandBuffer : slots[slot])
+                {
+                    commandBuffer.reset();
+                    recordDummy(commandBuffer);
+                }
+                // 最初のwarmupFrames回は同じプールとバッファを温めるだけで、時間には含めない
+                if (frame >= warmupFrames)
+                {
+                    total += std::chrono::steady_clock::now() - start;
+                }
+
+                submit(queue, slots[slot], fence);
+            }
+            queue.waitIdle();
+            return std::chrono::duration<double, std::micro>(total).count() / frames;
+        }
+
+        double benchmarkResetPerPool(vk::Device device, uint32_t queueFamilyIndex, vk::Queue queue, uint32_t frameCount, uint32_t warmupFrames, uint32_t frames, uint32_t buffersPerFrame)
+        {
+            TRACE_SCOPE("reset per pool");
+
+            FrameCommandPools pools(device, queueFamilyIndex, frameCount);
+            FrameFences fences(device, frameCount);
+            std::vector<vk::CommandBuffer> commandBuffers(buffersPerFrame);
+            std::chrono::steady_clock::duration total{};
+            for (uint32_t frame = 0; frame < warmupFrames + frames; frame++)
+            {
+                uint32_t slot = frame % frameCount;
+                vk::Fence fence = fences.wait(slot);
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                pools.beginFrame(slot);
+                for (vk::CommandBuffer& commandBuffer : commandBuffers)
+                {
+                    commandBuffer = pools.acquire();
+                    recordDummy(commandBuffer);
+                }
+                // 最初のwarmupFrames回は同じプールとバッファを温めるだけで、時間には含めない
+                if (frame >= warmupFrames)
+                {
+                    total += std::chrono::steady_clock::now() - start;
+                }
+
+                submit(queue, commandBuffers, fence);
+            }
+            queue.waitIdle();
+            return std::chrono::duration<double, std::micro>(total).count() / frames;
+        }
+    }
+
+    void runCommandPoolBenchmark(vk::Device device, uint32_t queueFamilyIndex, vk::Queue queue, uint32_t frameCount, uint32_t frames)
+    {
+        // 計るフレームが無ければフレームあたりの時間を出せない
+        if (frames == 0)
+        {
+            LOG("Command pool benchmark skipped (0 frames)");
+            return;
+        }
+
+        // 他の処理が残っていると計測に混ざるので、空になってから始める
+        queue.waitIdle();
+
+        LOG("----------------------------------------");
+        LOG("Command pool benchmark (" << frames << " frames, " << frameCount << " frames in flight, CPU time of reset + record per frame)");
+        const uint32_t buffersPerFrameCases[] = { 1, 100, 1000 };
+        for (uint32_t buffersPerFrame : buffersPerFrameCases)
+        {
+            // 各スロットを初めて使うフレームはバッファの確保などが入るので、全てのスロットを1回ずつ使ってから計る
+            double perBufferUs = benchmarkResetPerBuffer(device, queueFamilyIndex, queue, frameCount, frameCount, frames, buffersPerFrame);
+            double perPoolUs = benchmarkResetPerPool(device, queueFamilyIndex, queue, frameCount, frameCount, frames, buffersPerFrame);
+
+            LOG_INDENT();
+            LOG(buffersPerFrame << " buffers/frame : reset per buffer " << perBufferUs << " us, reset per pool " << perPoolUs << " us" <<
+                " (x" << (perPoolUs > 0.0 ? perBufferUs / perPoolUs : 0.0) << ")");
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // コマンドバッファの使い回し方を比べるマイクロベンチマーク
+    //
+    // ・reset per buffer : eResetCommandBufferのプールから作ったバッファを、毎フレーム1つずつresetしてから記録する (以前のやり方)
+    // ・reset per pool   : FrameCommandPoolsで、フレームスロットのプールをresetCommandPoolでまとめてリセットしてから記録する
+    //
+    // 1フレームあたり1・100・1000個のコマンドバッファを使い、リセットと記録にかかったCPUの時間だけを比べる
+    // (submitとフェンスを待つ時間は含めない) フレームインフライトと同じく、フレームスロットの数だけ前のフレームを待つ
+    // 結果はログに出す
+    void runCommandPoolBenchmark(vk::Device device, uint32_t queueFamilyIndex, vk::Queue queue, uint32_t frameCount, uint32_t frames);
+}
@@ -28,13 +28,12 @@ namespace Vulkan_Test
         LOG("----------------------------------------");
         LOG("Debug Instance Extensions");
         LOG("enabledExtensionCount: " << instanceRequiredExtensions.size());
-        SET_LOG_INDEX(1);
         for (int i = 0; i < instanceRequiredExtensions.size(); i++)
         {
+            LOG_INDENT();
             LOG("----------------------------------------");
             LOG(instanceRequiredExtensions[i]);
         }
-        SET_LOG_INDEX(0);
     }
 
     // UUIDを16進数で表示する関数
@@ -59,9 +58,9 @@ namespace Vulkan_Test
         LOG("----------------------------------------");
         LOG("Debug Physical Devices");
         LOG("physicalDevicesCount: " << physicalDevices.size());
-        SET_LOG_INDEX(1);
         for (vk::PhysicalDevice physicalDevice : physicalDevices)
         {
+            LOG_INDENT();
             LOG("----------------------------------------");
             vk::PhysicalDeviceProperties2 props;
             vk::PhysicalDeviceVulkan12Properties props12;
@@ -78,7 +77,6 @@ namespace Vulkan_Test
             LOG("driverInfo: " << props12.driverInfo);
             LOG("maxMemoryAllocationSize: " << static_cast<unsigned long long>(props11.maxMemoryAllocationSize));
         }
-        SET_LOG_INDEX(0);
     }
 
     void debugPhysicalDevice(Renderer* pRenderer)
@@ -93,6 +91,16 @@ namespace Vulkan_Test
         LOG("Found device and queue");
         LOG("physicalDevice: " << props.properties.deviceName);
         LOG("queueFamilyIndex: " << queueFamilyIndex);
+        std::optional<uint32_t> transferQueueFamilyIndex = pRenderer->Get_transferQueueFamilyIndex();
+        if (transferQueueFamilyIndex)
+        {
+            LOG("transferQueueFamilyIndex: " << transferQueueFamilyIndex.value());
+        }
+        else
+        {
+            LOG("transferQueueFamilyIndex: none (uploads use the graphics queue)");
+        }
+        LOG("timelineSemaphore: " << pRenderer->Get_timelineSemaphoreSupported());
     }
 
     void debugPhysicalMemory(Renderer* pRenderer)
@@ -104,14 +112,86 @@ namespace Vulkan_Test
         vk::PhysicalDeviceMemoryProperties memProps = physicalDevice.getMemoryProperties();
         LOG("memory type count: " << memProps.memoryTypeCount);
         LOG("memory heap count: " << memProps.memoryHeapCount);
-        SET_LOG_INDEX(1);
         for (size_t i = 0; i < memProps.memoryTypeCount; i++)
         {
+            LOG_INDENT();
             LOG("----------------------------------------");
             LOG("memory index: " << i);
             LOG(to_string(memProps.memoryTypes[i].propertyFlags));
         }
-        SET_LOG_INDEX(0);
+    }
+
+    void debugMemoryAllocator(Renderer* pRenderer)
+    {
+        MemoryAllocatorStats stats = pRenderer->Get_memoryAllocator()->getStats();
+        uint32_t maxMemoryAllocationCount = pRenderer->Get_physicalDevice().getProperties().limits.maxMemoryAllocationCount;
+
+        LOG("----------------------------------------");
+        LOG("Debug Memory Allocator");
+        LOG("device memory count: " << stats.deviceMemoryCount << " / " << maxMemoryAllocationCount);
+        LOG("block count: " << stats.blockCount);
+        LOG("dedicated count: " << stats.dedicatedCount);
+        LOG("allocation count: " << stats.allocationCount);
+        LOG("used bytes: " << stats.usedBytes << " / " << stats.reservedBytes);
+    }
+
+    void debugPipelineCache(Renderer* pRenderer)
+    {
+        const PipelineCache& pipelineCache = *pRenderer->Get_pipelineCache();
+        const PipelineCache::Stats& stats = pipelineCache.getStats();
+
+        LOG("----------------------------------------");
+        LOG("Debug Pipeline Cache");
+        LOG("path: " << (pipelineCache.getPath().empty() ? "(not persisted)" : pipelineCache.getPath()));
+        LOG("pipelineCacheUUID: " << getUUID(pRenderer->Get_physicalDevice().getProperties().pipelineCacheUUID.data(), VK_UUID_SIZE));
+        LOG("loaded bytes: " << stats.loadedBytes);
+        if (!stats.rejectReason.empty())
+        {
+            LOG("not loaded: " << stats.rejectReason);
+        }
+
+        PipelineObjectCache::Stats objectStats = pRenderer->Get_pipelineObjectCache()->getStats();
+        LOG("pipeline objects: " << objectStats.pipelineCount << " (hits: " << objectStats.hits << ", misses: " << objectStats.misses << ")");
+    }
+
+    void debugDescriptors(Renderer* pRenderer)
+    {
+        LOG("----------------------------------------");
+        LOG("Debug Descriptors");
+        LOG("set layout count: " << pRenderer->Get_descriptorLayoutCache()->getLayoutCount());
+        DescriptorAllocator::Stats stats = pRenderer->Get_frameDescriptorAllocator()->getCurrent().getStats();
+        LOG("frame pool count: " << stats.poolCount);
+        LOG("frame set count: " << stats.allocatedSetCount);
+    }
+
+    void debugShaderRegistry(Renderer* pRenderer)
+    {
+        ShaderRegistry& shaderRegistry = *pRenderer->Get_shaderRegistry();
+        std::vector<const Shader*> shaders = shaderRegistry.getShaders();
+
+        LOG("----------------------------------------");
+        LOG("Debug Shader Registry");
+        LOG("shader count: " << shaders.size() << " (modules: " << shaderRegistry.getModuleCount() << ")");
+        for (const Shader* pShader : shaders)
+        {
+            LOG_INDENT();
+            const ShaderReflection& reflection = pShader->reflection;
+            LOG("----------------------------------------");
+            LOG(pShader->assetPath << " (" << to_string(reflection.getStage()) << ")");
+            LOG("content hash: " << std::hex << pShader->contentHash);
+            for (const ShaderReflection::DescriptorBinding& binding : reflection.descriptorBindings)
+            {
+                LOG("set " << binding.set << " binding " << binding.binding << ": " << to_string(binding.type) << " x" << binding.count);
+            }
+            if (reflection.pushConstantSize != 0)
+            {
+                LOG("push constant: " << reflection.pushConstantSize << " bytes");
+            }
+            for (const ShaderReflection::InputVariable& input : reflection.inputs)
+            {
+                LOG("input location " << input.location << ": " << input.componentCount << " components");
+            }
+        }
     }
 
     void debugQueueFamilyProperties(Renderer* pRenderer)
@@ -122,37 +202,49 @@ namespace Vulkan_Test
         LOG("----------------------------------------");
         LOG("Debug Queue Family Properties");
         LOG("queue family count: " << queueFamilyProperties.size());
-        SET_LOG_INDEX(1);
         for (size_t i = 0; i < queueFamilyProperties.size(); i++)
         {
+            LOG_INDENT();
             LOG("----------------------------------------");
             LOG("queue family index: " << i);
             LOG("queue count: " << queueFamilyProperties[i].queueCount);
             LOG(to_string(queueFamilyProperties[i].queueFlags));
         }
-        SET_LOG_INDEX(0);
     }
 
     void debugSwapchainCreateInfo(Renderer* pRenderer)
     {
         std::vector<vk::SurfaceFormatKHR>& surfaceFormats = pRenderer->Get_surfaceFormats();
-//        vk::SwapchainCreateInfoKHR& swapchainCreateInfo;
+        std::vector<vk::PresentModeKHR>& surfacePresentModes = pRenderer->Get_surfacePresentModes();
+        vk::SurfaceCapabilitiesKHR& surfaceCapabilities = pRenderer->Get_surfaceCapabilities();
+        vk::Extent2D& swapchainExtent = pRenderer->Get_swapchainExtent();
 
-//        LOG("----------------------------------------");
-//        LOG("Debug Swapchain Create Info");
-//        LOG("swapchain minImageCount " << swapchainCreateInfo.minImageCount);
-//        LOG("swapchainCreateInfo " << swapchainCreateInfo.imageExtent.width << ", " << swapchainCreateInfo.imageExtent.height);
+        LOG("----------------------------------------");
+        LOG("Debug Swapchain Create Info");
+        LOG("present policy: " << pRenderer->Get_presentPolicy().name);
+        LOG("present mode: " << to_string(pRenderer->Get_presentMode()));
+        LOG("swapchain minImageCount: " << pRenderer->Get_swapchainMinImageCount() <<
+            " (surface min: " << surfaceCapabilities.minImageCount << ", max: " << surfaceCapabilities.maxImageCount << ")");
+        LOG("swapchain image count: " << pRenderer->Get_swapchainImages().size());
+        LOG("swapchain extent: " << swapchainExtent.width << ", " << swapchainExtent.height);
+
+        LOG("----------------------------------------");
+        LOG("Debug Surface Present Modes");
+        for (size_t i = 0; i < surfacePresentModes.size(); i++)
+        {
+            LOG_INDENT();
+            LOG(to_string(surfacePresentModes[i]));
+        }
 
         LOG("----------------------------------------");
         LOG("Debug Surface Formats");
-        SET_LOG_INDEX(1);
         for (size_t i = 0; i < surfaceFormats.size(); i++)
         {
+            LOG_INDENT();
             LOG("----------------------------------------");
             LOG("surface formats index: " << i);
             LOG("format: " << to_string(surfaceFormats[i].format));
             LOG("colorSpace: " << to_string(surfaceFormats[i].colorSpace));
         }
-        SET_LOG_INDEX(0);
     }
 }
@@ -0,0 +1,125 @@
+#include "DescriptorAllocator.hpp"
+#include "Utility.hpp"
+
+namespace Vulkan_Test
+{
+    namespace
+    {
+        // プール1つに入れるデスクリプタの数を、セットの数に対する比率で決める
+        struct PoolRatio
+        {
+            vk::DescriptorType type;
+            float ratio;
+        };
+
+        const PoolRatio kPoolRatios[] = {
+            { vk::DescriptorType::eUniformBuffer, 1.0f },
+            { vk::DescriptorType::eUniformBufferDynamic, 1.0f },
+            { vk::DescriptorType::eCombinedImageSampler, 2.0f },
+            { vk::DescriptorType::eStorageBuffer, 1.0f },
+            { vk::DescriptorType::eStorageBufferDynamic, 0.5f },
+            { vk::DescriptorType::eSampledImage, 1.0f },
+            { vk::DescriptorType::eSampler, 0.5f },
+        };
+
+        // プールを増やすたびに大きくするが、これ以上にはしない
+        constexpr uint32_t kMaxSetsPerPool = 4096;
+    }
+
+    DescriptorAllocator::DescriptorAllocator(vk::Device device, uint32_t initialSetsPerPool)
+        : _device(device), _setsPerPool(initialSetsPerPool)
+    {
+    }
+
+    vk::DescriptorPool DescriptorAllocator::grabPool()
+    {
+        if (!_freePools.empty())
+        {
+            _usedPools.push_back(std::move(_freePools.back()));
+            _freePools.pop_back();
+            return _usedPools.back().get();
+        }
+
+        std::vector<vk::DescriptorPoolSize> poolSizes;
+        for (const PoolRatio& ratio : kPoolRatios)
+        {
+            poolSizes.emplace_back(ratio.type, std::max(static_cast<uint32_t>(ratio.ratio * _setsPerPool), 1u));
+        }
+
+        vk::DescriptorPoolCreateInfo createInfo;
+        createInfo.maxSets = _setsPerPool;
+        createInfo.poolSizeCount = poolSizes.size();
+        createInfo.pPoolSizes = poolSizes.data();
+        _usedPools.push_back(_device.createDescriptorPoolUnique(createInfo));
+
+        LOGDEBUG("DescriptorAllocator: new pool (" << _setsPerPool << " sets)");
+        _setsPerPool = std::min(_setsPerPool * 2, kMaxSetsPerPool);
+        return _usedPools.back().get();
+    }
+
+    vk::DescriptorSet DescriptorAllocator::allocate(vk::DescriptorSetLayout layout)
+    {
+        if (!_currentPool)
+        {
+            _currentPool = grabPool();
+        }
+
+        vk::DescriptorSetAllocateInfo allocateInfo;
+        allocateInfo.descriptorPool = _currentPool;
+        allocateInfo.descriptorSetCount = 1;
+        allocateInfo.pSetLayouts = &layout;
+
+        // 毎回のことなので例外を投げない方の関数で呼び、プールが足りないときだけ次のプールで再挑戦する
+        vk::DescriptorSet set;
+        vk::Result result = _device.allocateDescriptorSets(&allocateInfo, &set);
+        if (result == vk::Result::eErrorOutOfPoolMemory || result == vk::Result::eErrorFragmentedPool)
+        {
+            _currentPool = grabPool();
+            allocateInfo.descriptorPool = _currentPool;
+            result = _device.allocateDescriptorSets(&allocateInfo, &set);
+        }
+        if (result != vk::Result::eSuccess)
+        {
+            LOGERR("DescriptorAllocator: failed to allocate descriptor set : " << vk::to_string(result));
+            exit(EXIT_FAILURE);
+        }
+
+        _allocatedSetCount++;
+        return set;
+    }
+
+    void DescriptorAllocator::reset()
+    {
+        for (vk::UniqueDescriptorPool& pool : _usedPools)
+        {
+            _device.resetDescriptorPool(pool.get());
+            _freePools.push_back(std::move(pool));
+        }
+        _usedPools.clear();
+        _currentPool = vk::DescriptorPool();
+        _allocatedSetCount = 0;
+    }
+
+    DescriptorAllocator::Stats DescriptorAllocator::getStats() const
+    {
+        Stats stats;
+        stats.poolCount = static_cast<uint32_t>(_usedPools.size() + _freePools.size());
+        stats.allocatedSetCount = _allocatedSetCount;
+        return stats;
+    }
+
+    FrameDescriptorAllocator::FrameDescriptorAllocator(vk::Device device, uint32_t frameCount)
+    {
+        _allocators.reserve(frameCount);
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            _allocators.emplace_back(device);
+        }
+    }
+
+    void FrameDescriptorAllocator::beginFrame(uint32_t frameIndex)
+    {
+        _frameIndex = frameIndex;
+        _allocators[_frameIndex].reset();
+    }
+}
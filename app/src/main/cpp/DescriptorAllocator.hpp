@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // デスクリプタプールを必要なだけ増やしながら、デスクリプタセットを切り出す
+    //
+    // セットを1つずつ解放することはせず、reset()で全てのプールをまとめてリセットする
+    // (プールはeFreeDescriptorSetなしで作るので、ドライバは線形に切り出すだけで済む)
+    // 今のプールが足りなくなったら、空いているプールか新しく作ったプールに切り替える 新しいプールは前より大きくする
+    // リセットしたプールは捨てずに取っておき、次に足りなくなったときに使い回す
+    //
+    // スレッドセーフではない スレッドごと、フレームごとに別のアロケータを使う
+    class DescriptorAllocator
+    {
+    public:
+        struct Stats
+        {
+            uint32_t poolCount = 0;
+            uint32_t allocatedSetCount = 0;
+        };
+
+        explicit DescriptorAllocator(vk::Device device, uint32_t initialSetsPerPool = 64);
+
+        DescriptorAllocator(const DescriptorAllocator&) = delete;
+        DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+        DescriptorAllocator(DescriptorAllocator&&) = default;
+        DescriptorAllocator& operator=(DescriptorAllocator&&) = default;
+
+        // プールが足りなければ増やすので失敗しない
+        vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+
+        // 切り出した全てのセットが無効になる GPUがそれらを使い終わってから呼ぶ
+        void reset();
+
+        Stats getStats() const;
+
+    private:
+        vk::DescriptorPool grabPool();
+
+        vk::Device _device;
+        uint32_t _setsPerPool;
+
+        vk::DescriptorPool _currentPool;
+        std::vector<vk::UniqueDescriptorPool> _usedPools;
+        std::vector<vk::UniqueDescriptorPool> _freePools;
+        uint32_t _allocatedSetCount = 0;
+    };
+
+    // フレームスロットごとのDescriptorAllocator
+    //
+    // そのフレームでしか使わないセット(毎フレーム書き換えるユニフォームなど)をここから切り出す
+    // フレームスロットのフェンスを待ったあとにbeginFrameを呼ぶと、そのスロットのセットがまとめて解放される
+    // 描画1回ごとのデスクリプタの処理は、プールから線形に切り出すだけになる
+    class FrameDescriptorAllocator
+    {
+    public:
+        FrameDescriptorAllocator(vk::Device device, uint32_t frameCount);
+
+        FrameDescriptorAllocator(const FrameDescriptorAllocator&) = delete;
+        FrameDescriptorAllocator& operator=(const FrameDescriptorAllocator&) = delete;
+
+        void beginFrame(uint32_t frameIndex);
+
+        vk::DescriptorSet allocate(vk::DescriptorSetLayout layout) { return _allocators[_frameIndex].allocate(layout); }
+
+        DescriptorAllocator& getCurrent() { return _allocators[_frameIndex]; }
+        const DescriptorAllocator& getCurrent() const { return _allocators[_frameIndex]; }
+
+    private:
+        std::vector<DescriptorAllocator> _allocators;
+        uint32_t _frameIndex = 0;
+    };
+}
@@ -0,0 +1,109 @@
+#include "DescriptorLayoutCache.hpp"
+#include "Utility.hpp"
+
+namespace Vulkan_Test
+{
+    bool DescriptorLayoutCache::Key::operator==(const Key& other) const
+    {
+        return std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(),
+                          [](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) {
+                              return a.binding == b.binding && a.descriptorType == b.descriptorType &&
+                                     a.descriptorCount == b.descriptorCount && a.stageFlags == b.stageFlags;
+                          });
+    }
+
+    size_t DescriptorLayoutCache::KeyHasher::operator()(const Key& key) const
+    {
+        // pImmutableSamplersのポインタは含めない
+        uint64_t hash = hashFnv1a(nullptr, 0);
+        for (const vk::DescriptorSetLayoutBinding& binding : key.bindings)
+        {
+            uint32_t values[] = {
+                binding.binding,
+                static_cast<uint32_t>(binding.descriptorType),
+                binding.descriptorCount,
+                static_cast<uint32_t>(binding.stageFlags),
+            };
+            hash = hashFnv1a(values, sizeof(values), hash);
+        }
+        return static_cast<size_t>(hash);
+    }
+
+    DescriptorLayoutCache::DescriptorLayoutCache(vk::Device device)
+        : _device(device)
+    {
+    }
+
+    vk::DescriptorSetLayout DescriptorLayoutCache::get(std::vector<vk::DescriptorSetLayoutBinding> bindings)
+    {
+        std::sort(bindings.begin(), bindings.end(), [](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) {
+            return a.binding < b.binding;
+        });
+        for (vk::DescriptorSetLayoutBinding& binding : bindings)
+        {
+            binding.pImmutableSamplers = nullptr;
+        }
+
+        Key key{ std::move(bindings) };
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _layouts.find(key);
+        if (it != _layouts.end())
+        {
+            return it->second.get();
+        }
+
+        vk::DescriptorSetLayoutCreateInfo createInfo;
+        createInfo.bindingCount = key.bindings.size();
+        createInfo.pBindings = key.bindings.data();
+        vk::UniqueDescriptorSetLayout layout = _device.createDescriptorSetLayoutUnique(createInfo);
+        vk::DescriptorSetLayout result = layout.get();
+        _layouts.emplace(std::move(key), std::move(layout));
+        return result;
+    }
+
+    size_t DescriptorLayoutCache::getLayoutCount() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _layouts.size();
+    }
+
+    std::vector<vk::DescriptorSetLayoutBinding> DescriptorLayoutCache::collectBindings(uint32_t set, const std::vector<const Shader*>& shaders)
+    {
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        for (const Shader* pShader : shaders)
+        {
+            vk::ShaderStageFlagBits stage = pShader->reflection.getStage();
+            for (const ShaderReflection::DescriptorBinding& descriptor : pShader->reflection.descriptorBindings)
+            {
+                if (descriptor.set != set)
+                {
+                    continue;
+                }
+
+                auto it = std::find_if(bindings.begin(), bindings.end(), [&](const vk::DescriptorSetLayoutBinding& binding) {
+                    return binding.binding == descriptor.binding;
+                });
+                if (it != bindings.end())
+                {
+                    if (it->descriptorType != descriptor.type)
+                    {
+                        LOGERR("DescriptorLayoutCache: set " << set << " binding " << descriptor.binding << " has different types in " << pShader->assetPath);
+                        exit(EXIT_FAILURE);
+                    }
+                    it->stageFlags |= stage;
+                    continue;
+                }
+
+                vk::DescriptorSetLayoutBinding binding;
+                binding.binding = descriptor.binding;
+                binding.descriptorType = descriptor.type;
+                // 実行時に大きさが決まる配列はこのレイアウトでは扱わないので1つとして数える
+                binding.descriptorCount = std::max(descriptor.count, 1u);
+                binding.stageFlags = stage;
+                bindings.push_back(binding);
+            }
+        }
+        return bindings;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "ShaderRegistry.hpp"
+
+namespace Vulkan_Test
+{
+    // デスクリプタセットレイアウトを、バインディングの内容をキーにして使い回す
+    //
+    // 同じバインディングの組み合わせなら何回getしても同じレイアウトが返ってくるので、
+    // パイプラインレイアウトやデスクリプタセットの互換性をハンドルの比較だけで判断できる
+    // レイアウトはキャッシュが破棄されるまで生きている
+    //
+    // 複数のスレッドから呼んでよい
+    class DescriptorLayoutCache
+    {
+    public:
+        explicit DescriptorLayoutCache(vk::Device device);
+
+        DescriptorLayoutCache(const DescriptorLayoutCache&) = delete;
+        DescriptorLayoutCache& operator=(const DescriptorLayoutCache&) = delete;
+
+        // bindingsの順番は問わない (binding番号で並べ替えてからキーにする)
+        // イミュータブルサンプラーには対応しない
+        vk::DescriptorSetLayout get(std::vector<vk::DescriptorSetLayoutBinding> bindings);
+
+        size_t getLayoutCount() const;
+
+        // シェーダーのリフレクションから、setに含まれるバインディングを集める
+        // 複数のステージで同じバインディングを使っていれば、stageFlagsをまとめて1つにする
+        static std::vector<vk::DescriptorSetLayoutBinding> collectBindings(uint32_t set, const std::vector<const Shader*>& shaders);
+
+    private:
+        struct Key
+        {
+            std::vector<vk::DescriptorSetLayoutBinding> bindings;
+
+            bool operator==(const Key& other) const;
+        };
+
+        struct KeyHasher
+        {
+            size_t operator()(const Key& key) const;
+        };
+
+        vk::Device _device;
+
+        mutable std::mutex _mutex;
+        std::unordered_map<Key, vk::UniqueDescriptorSetLayout, KeyHasher> _layouts;
+    };
+}
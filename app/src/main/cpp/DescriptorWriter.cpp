@@ -0,0 +1,66 @@
+#include "DescriptorWriter.hpp"
+
+namespace Vulkan_Test
+{
+    DescriptorWriter& DescriptorWriter::writeBuffer(vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+                                                    vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range)
+    {
+        vk::WriteDescriptorSet write;
+        write.dstSet = set;
+        write.dstBinding = binding;
+        write.dstArrayElement = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = type;
+        _writes.push_back(write);
+        _infoIndices.push_back(_bufferInfos.size());
+        _bufferInfos.emplace_back(buffer, offset, range);
+        return *this;
+    }
+
+    DescriptorWriter& DescriptorWriter::writeImage(vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+                                                   vk::ImageView imageView, vk::Sampler sampler, vk::ImageLayout imageLayout)
+    {
+        vk::WriteDescriptorSet write;
+        write.dstSet = set;
+        write.dstBinding = binding;
+        write.dstArrayElement = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = type;
+        _writes.push_back(write);
+        _infoIndices.push_back(_imageInfos.size());
+        _imageInfos.emplace_back(sampler, imageView, imageLayout);
+        return *this;
+    }
+
+    void DescriptorWriter::update(vk::Device device)
+    {
+        if (_writes.empty())
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < _writes.size(); i++)
+        {
+            switch (_writes[i].descriptorType)
+            {
+            case vk::DescriptorType::eSampler:
+            case vk::DescriptorType::eCombinedImageSampler:
+            case vk::DescriptorType::eSampledImage:
+            case vk::DescriptorType::eStorageImage:
+            case vk::DescriptorType::eInputAttachment:
+                _writes[i].pImageInfo = &_imageInfos[_infoIndices[i]];
+                break;
+            default:
+                _writes[i].pBufferInfo = &_bufferInfos[_infoIndices[i]];
+                break;
+            }
+        }
+
+        device.updateDescriptorSets(_writes, {});
+
+        _writes.clear();
+        _infoIndices.clear();
+        _bufferInfos.clear();
+        _imageInfos.clear();
+    }
+}
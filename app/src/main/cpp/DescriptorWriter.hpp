@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // デスクリプタセットへの書き込みを溜めておき、update()で1回のvkUpdateDescriptorSetsにまとめる
+    //
+    // vk::WriteDescriptorSetはバッファやイメージの情報をポインタで指すので、
+    // 情報は中で持っておき、updateの直前にポインタをつなぐ (書き込みを足している途中で配列が伸びても壊れない)
+    class DescriptorWriter
+    {
+    public:
+        DescriptorWriter& writeBuffer(vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+                                      vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range);
+        DescriptorWriter& writeImage(vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+                                     vk::ImageView imageView, vk::Sampler sampler, vk::ImageLayout imageLayout);
+
+        // 溜めた書き込みをまとめて反映し、空にする
+        void update(vk::Device device);
+
+        size_t getPendingCount() const { return _writes.size(); }
+
+    private:
+        std::vector<vk::WriteDescriptorSet> _writes;
+        // _writesと同じ並びで、_bufferInfosか_imageInfosの何番目を指すか
+        std::vector<size_t> _infoIndices;
+        std::vector<vk::DescriptorBufferInfo> _bufferInfos;
+        std::vector<vk::DescriptorImageInfo> _imageInfos;
+    };
+}
@@ -0,0 +1,56 @@
+#include "DrawIndirectCount.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Vulkan_Test
+{
+    DrawIndirectCount::Support DrawIndirectCount::getSupport(vk::PhysicalDevice physicalDevice, uint32_t apiVersion)
+    {
+        std::vector<vk::ExtensionProperties> extensions = physicalDevice.enumerateDeviceExtensionProperties();
+        bool found = std::any_of(extensions.begin(), extensions.end(), [](const vk::ExtensionProperties& extension) {
+            return std::strcmp(extension.extensionName, getExtensionName()) == 0;
+        });
+        if (found)
+        {
+            return Support::Extension;
+        }
+
+        if (apiVersion < VK_API_VERSION_1_2)
+        {
+            return Support::None;
+        }
+        vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features> features =
+                physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+        return features.get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount ? Support::Core : Support::None;
+    }
+
+    void DrawIndirectCount::load(vk::Device device, Support support)
+    {
+        // 拡張機能とコアで関数の名前だけが違う (引数は同じ)
+        switch (support)
+        {
+        case Support::Extension:
+            _cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCount>(device.getProcAddr("vkCmdDrawIndexedIndirectCountKHR"));
+            break;
+        case Support::Core:
+            _cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCount>(device.getProcAddr("vkCmdDrawIndexedIndirectCount"));
+            break;
+        case Support::None:
+            _cmdDrawIndexedIndirectCount = nullptr;
+            return;
+        }
+
+        if (!_cmdDrawIndexedIndirectCount)
+        {
+            LOG("DrawIndirectCount: failed to load commands, falling back to drawIndexedIndirect");
+        }
+    }
+
+    void DrawIndirectCount::drawIndexedIndirectCount(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::DeviceSize offset,
+                                                     vk::Buffer countBuffer, vk::DeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) const
+    {
+        _cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+    }
+}
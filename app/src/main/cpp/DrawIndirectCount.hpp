@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // vkCmdDrawIndexedIndirectCount (Vulkan 1.2 / VK_KHR_draw_indirect_count) をまとめたもの
+    //
+    // 間接描画のコマンドの数もバッファから読むので、GPUのカリングが数を書けばCPUは数を知らなくてよい
+    // 非対応の端末ではload()を呼ばないままにしておけば、isEnabled()がfalseになり普通のdrawIndexedIndirectを使う
+    //
+    // 拡張機能でもコアでも関数ポインタはvkGetDeviceProcAddrで取ってくる (ローダーが公開していない端末があるので)
+    class DrawIndirectCount
+    {
+    public:
+        enum class Support
+        {
+            None,
+            // VK_KHR_draw_indirect_countを有効にする 機能の構造体は要らない
+            Extension,
+            // Vulkan 1.2のコアの機能 PhysicalDeviceVulkan12FeaturesのdrawIndirectCountを有効にする
+            Core,
+        };
+
+        static const char* getExtensionName() { return VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME; }
+
+        // 拡張機能があればそちらを使う (コアの機能を使うにはVulkan12Featuresを有効にしなければならないので)
+        // apiVersionはインスタンスとデバイスのバージョンの低い方 1.2未満ならコアの機能は使わない
+        static Support getSupport(vk::PhysicalDevice physicalDevice, uint32_t apiVersion);
+
+        // getSupportが返した方法で有効にして作った論理デバイスを渡す
+        void load(vk::Device device, Support support);
+
+        bool isEnabled() const { return _cmdDrawIndexedIndirectCount != nullptr; }
+
+        void drawIndexedIndirectCount(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::DeviceSize offset,
+                                      vk::Buffer countBuffer, vk::DeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride) const;
+
+    private:
+        PFN_vkCmdDrawIndexedIndirectCount _cmdDrawIndexedIndirectCount = nullptr;
+    };
+}
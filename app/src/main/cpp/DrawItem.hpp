@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstring>
+#include <vulkan/vulkan.hpp>
+#include "ObjectData.hpp"
+#include "PipelineDesc.hpp"
+
+namespace Vulkan_Test
+{
+    // 1回のドローに必要なものをまとめたもの
+    //
+    // レンダースレッドでユニフォームリングへの書き込みなどを済ませてから作るので、
+    // コマンドを記録するときはこれを読むだけでよい (ワーカースレッドから同時に読んでよい)
+    struct DrawItem
+    {
+        vk::Pipeline pipeline;
+        // 拡張動的ステートが使えるときにコマンドで設定する値
+        const PipelineDesc* pPipelineDesc = nullptr;
+        vk::DescriptorSet descriptorSet;
+        // descriptorSetのユニフォームバッファに渡すダイナミックオフセット
+        uint32_t uniformOffset = 0;
+        vk::Buffer vertexBuffer;
+        uint32_t vertexCount = 0;
+        // インデックスバッファがあるときは、インデックスに足す値(vertexOffset)になる
+        uint32_t firstVertex = 0;
+        // インデックスバッファがあればdrawIndexedで描く (vertexCountは使わない)
+        vk::Buffer indexBuffer;
+        vk::IndexType indexType = vk::IndexType::eUint16;
+        uint32_t indexCount = 0;
+        uint32_t firstIndex = 0;
+        // インスタンスごとのデータ(InstanceData)の配列の中の位置 DrawListが決める
+        uint32_t firstInstance = 0;
+        // 間接描画のときはバッチ全体のインスタンスの数 (統計にだけ使う)
+        uint32_t instanceCount = 1;
+        // 0でなければ、DrawList::buildIndirectCommands()で同じ状態のドローをまとめた間接描画
+        // コマンドはgetIndirectCommands()のfirstIndirectCommandから並び、数はgetIndirectCounts()[indirectBatch]にも入っている
+        uint32_t indirectCommandCount = 0;
+        uint32_t firstIndirectCommand = 0;
+        uint32_t indirectBatch = 0;
+        ObjectData objectData{};
+
+        // バインドするものとプッシュ定数が全て同じなら、1つの間接描画のコマンドとして並べられる
+        // プッシュ定数はドローごとにしか変えられないので、objectDataも同じでなければならない
+        bool hasSameStateAs(const DrawItem& other) const
+        {
+            return pipeline == other.pipeline && pPipelineDesc == other.pPipelineDesc &&
+                   descriptorSet == other.descriptorSet && uniformOffset == other.uniformOffset &&
+                   vertexBuffer == other.vertexBuffer && indexBuffer == other.indexBuffer && indexType == other.indexType &&
+                   std::memcmp(&objectData, &other.objectData, sizeof(ObjectData)) == 0;
+        }
+
+        // さらに描く範囲も同じなら、1つのインスタンス描画にまとめられる
+        bool canInstanceWith(const DrawItem& other) const
+        {
+            return hasSameStateAs(other) && vertexCount == other.vertexCount && firstVertex == other.firstVertex &&
+                   indexCount == other.indexCount && firstIndex == other.firstIndex;
+        }
+    };
+}
@@ -0,0 +1,238 @@
+#include "DrawList.hpp"
+#include "TraceRecorder.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace Vulkan_Test
+{
+    void DrawStats::report() const
+    {
+        LOG("----------------------------------------");
+        LOG("Draw stats (" << frames << " frames)");
+        if (frames == 0)
+        {
+            return;
+        }
+        double perFrame = 1.0 / static_cast<double>(frames);
+        LOG_INDENT();
+        LOG("draws/frame: " << draws * perFrame);
+        LOG("instances/frame: " << instances * perFrame);
+        LOG("pipeline binds/frame: " << pipelineBinds * perFrame);
+        LOG("descriptor set binds/frame: " << descriptorSetBinds * perFrame);
+        LOG("vertex buffer binds/frame: " << vertexBufferBinds * perFrame);
+        LOG("index buffer binds/frame: " << indexBufferBinds * perFrame);
+        LOG("indirect commands/frame: " << indirectCommands * perFrame);
+    }
+
+    uint64_t DrawList::makeSortKey(uint32_t pipelineId, uint32_t descriptorSetId, uint32_t materialId, float depth)
+    {
+        constexpr uint32_t kMaxPipelineId = (1u << kPipelineBits) - 1;
+        constexpr uint32_t kMaxDescriptorSetId = (1u << kDescriptorSetBits) - 1;
+        constexpr uint32_t kMaxMaterialId = (1u << kMaterialBits) - 1;
+        constexpr uint32_t kMaxDepth = (1u << kDepthBits) - 1;
+
+        // NaNも0に寄せる
+        float clampedDepth = depth > 0.0f ? std::min(depth, 1.0f) : 0.0f;
+        uint64_t quantizedDepth = static_cast<uint64_t>(clampedDepth * kMaxDepth);
+
+        uint64_t key = std::min(pipelineId, kMaxPipelineId);
+        key = key << kDescriptorSetBits | std::min(descriptorSetId, kMaxDescriptorSetId);
+        key = key << kMaterialBits | std::min(materialId, kMaxMaterialId);
+        return key << kDepthBits | quantizedDepth;
+    }
+
+    uint32_t DrawList::getPipelineId(vk::Pipeline pipeline)
+    {
+        return _pipelineIds.try_emplace(pipeline, static_cast<uint32_t>(_pipelineIds.size())).first->second;
+    }
+
+    uint32_t DrawList::getDescriptorSetId(vk::DescriptorSet descriptorSet)
+    {
+        return _descriptorSetIds.try_emplace(descriptorSet, static_cast<uint32_t>(_descriptorSetIds.size())).first->second;
+    }
+
+    void DrawList::push(uint64_t sortKey, const DrawItem& item, const InstanceData& instance)
+    {
+        _keys.push_back(sortKey);
+        DrawItem& pushed = _items.emplace_back(item);
+        pushed.firstInstance = static_cast<uint32_t>(_instances.size());
+        pushed.instanceCount = 1;
+        _instances.push_back(instance);
+    }
+
+    void DrawList::sort()
+    {
+        TRACE_SCOPE("sort draws");
+
+        size_t count = _items.size();
+        if (count < 2)
+        {
+            return;
+        }
+
+        // 8ビットずつの桁の出現数を、1回なめるだけで全ての桁について数えておく
+        constexpr uint32_t kRadixBits = 8;
+        constexpr uint32_t kPassCount = 64 / kRadixBits;
+        constexpr uint32_t kBucketCount = 1u << kRadixBits;
+        std::array<std::array<uint32_t, kBucketCount>, kPassCount> histograms = {};
+        for (uint64_t key : _keys)
+        {
+            for (uint32_t pass = 0; pass < kPassCount; pass++)
+            {
+                histograms[pass][(key >> (pass * kRadixBits)) & (kBucketCount - 1)]++;
+            }
+        }
+
+        _sortKeys = _keys;
+        _sortOrder.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            _sortOrder[i] = i;
+        }
+        _tempKeys.resize(count);
+        _tempOrder.resize(count);
+
+        // 下の桁から安定に並べていく (同じキーは積んだ順のまま残る)
+        for (uint32_t pass = 0; pass < kPassCount; pass++)
+        {
+            std::array<uint32_t, kBucketCount>& histogram = histograms[pass];
+            uint32_t shift = pass * kRadixBits;
+
+            // 全てのキーがこの桁で同じなら、並べ替えても順番は変わらない
+            // 使っていない番号の上位ビットなど、ほとんどの桁はこれで飛ばせる
+            if (histogram[(_sortKeys[0] >> shift) & (kBucketCount - 1)] == count)
+            {
+                continue;
+            }
+
+            uint32_t offset = 0;
+            for (uint32_t& bucket : histogram)
+            {
+                uint32_t bucketCount = bucket;
+                bucket = offset;
+                offset += bucketCount;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t destination = histogram[(_sortKeys[i] >> shift) & (kBucketCount - 1)]++;
+                _tempKeys[destination] = _sortKeys[i];
+                _tempOrder[destination] = _sortOrder[i];
+            }
+            _sortKeys.swap(_tempKeys);
+            _sortOrder.swap(_tempOrder);
+        }
+
+        // ドロー本体とインスタンスのデータは最後に1度だけ並べ替える
+        _sortedItems.clear();
+        _sortedItems.reserve(count);
+        _sortedInstances.clear();
+        _sortedInstances.reserve(count);
+        for (uint32_t index : _sortOrder)
+        {
+            DrawItem& item = _sortedItems.emplace_back(_items[index]);
+            item.firstInstance = static_cast<uint32_t>(_sortedInstances.size());
+            _sortedInstances.push_back(_instances[index]);
+        }
+        _items.swap(_sortedItems);
+        _instances.swap(_sortedInstances);
+        _keys.swap(_sortKeys);
+    }
+
+    void DrawList::mergeInstances()
+    {
+        TRACE_SCOPE("merge instances");
+
+        if (_items.size() < 2)
+        {
+            return;
+        }
+
+        // 各ドローのインスタンスはfirstInstanceから順に並んでいるので、まとめるときはinstanceCountを伸ばすだけでよい
+        // インスタンスのデータは動かさない
+        size_t mergedCount = 1;
+        for (size_t i = 1; i < _items.size(); i++)
+        {
+            DrawItem& merged = _items[mergedCount - 1];
+            const DrawItem& item = _items[i];
+            if (merged.canInstanceWith(item) && merged.firstInstance + merged.instanceCount == item.firstInstance)
+            {
+                merged.instanceCount += item.instanceCount;
+                continue;
+            }
+            _keys[mergedCount] = _keys[i];
+            _items[mergedCount] = item;
+            mergedCount++;
+        }
+        _keys.resize(mergedCount);
+        _items.resize(mergedCount);
+    }
+
+    void DrawList::buildIndirectCommands()
+    {
+        TRACE_SCOPE("build indirect commands");
+
+        _indirectCommands.clear();
+        _indirectCounts.clear();
+
+        // バッチは先頭のドローをそのまま使い、バインドするものはそこから読む
+        // インデックスのないドローは間接描画にできないので、直接描くドローとしてそのまま残す
+        size_t batchCount = 0;
+        for (size_t i = 0; i < _items.size(); i++)
+        {
+            DrawItem item = _items[i];
+            uint64_t key = _keys[i];
+            if (!item.indexBuffer)
+            {
+                _keys[batchCount] = key;
+                _items[batchCount] = item;
+                batchCount++;
+                continue;
+            }
+
+            vk::DrawIndexedIndirectCommand command;
+            command.indexCount = item.indexCount;
+            command.instanceCount = item.instanceCount;
+            command.firstIndex = item.firstIndex;
+            command.vertexOffset = static_cast<int32_t>(item.firstVertex);
+            command.firstInstance = item.firstInstance;
+
+            if (batchCount > 0)
+            {
+                DrawItem& batch = _items[batchCount - 1];
+                if (batch.indirectCommandCount > 0 && batch.hasSameStateAs(item))
+                {
+                    _indirectCommands.push_back(command);
+                    _indirectCounts[batch.indirectBatch]++;
+                    batch.indirectCommandCount++;
+                    batch.instanceCount += item.instanceCount;
+                    continue;
+                }
+            }
+
+            item.indirectBatch = static_cast<uint32_t>(_indirectCounts.size());
+            item.firstIndirectCommand = static_cast<uint32_t>(_indirectCommands.size());
+            item.indirectCommandCount = 1;
+            _indirectCommands.push_back(command);
+            _indirectCounts.push_back(1);
+
+            _keys[batchCount] = key;
+            _items[batchCount] = item;
+            batchCount++;
+        }
+        _keys.resize(batchCount);
+        _items.resize(batchCount);
+    }
+
+    void DrawList::clear()
+    {
+        _keys.clear();
+        _items.clear();
+        _instances.clear();
+        _indirectCommands.clear();
+        _indirectCounts.clear();
+        _pipelineIds.clear();
+        _descriptorSetIds.clear();
+    }
+}
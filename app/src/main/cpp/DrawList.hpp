@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "DrawItem.hpp"
+#include "InstanceData.hpp"
+
+namespace Vulkan_Test
+{
+    // 記録したときに実際に積んだコマンドの数 (ドローの並べ方でどれだけ状態の切り替えが減ったかを見る)
+    // ベンチマークの単位はパイプラインのバインド数
+    struct DrawStats
+    {
+        uint64_t frames = 0;
+        uint64_t draws = 0;
+        uint64_t instances = 0;
+        uint64_t pipelineBinds = 0;
+        uint64_t descriptorSetBinds = 0;
+        uint64_t vertexBufferBinds = 0;
+        uint64_t indexBufferBinds = 0;
+        // 間接描画のコマンドの数 (1回のドローで複数のコマンドを描くので、drawsより多くなる)
+        uint64_t indirectCommands = 0;
+
+        DrawStats& operator+=(const DrawStats& other)
+        {
+            frames += other.frames;
+            draws += other.draws;
+            instances += other.instances;
+            pipelineBinds += other.pipelineBinds;
+            descriptorSetBinds += other.descriptorSetBinds;
+            vertexBufferBinds += other.vertexBufferBinds;
+            indexBufferBinds += other.indexBufferBinds;
+            indirectCommands += other.indirectCommands;
+            return *this;
+        }
+
+        // 1フレームあたりの平均をログに出す
+        void report() const;
+    };
+
+    // 1フレーム分のドローを集めて、ソートキーの順に並べ替える
+    //
+    // ソートキーは64ビットで、上の桁から パイプライン(16) | デスクリプタセット(12) | マテリアル(12) | 深度(24)
+    // 上の桁ほど切り替えが重いものにしてあるので、キーの順に記録すると同じパイプラインのドローが続き、
+    // 同じパイプラインの中では同じデスクリプタセットのドローが続く 深度は最後に手前から奥の順に並べる (早期深度テストが効くように)
+    //
+    // 並べ替えはキーの基数ソート (8ビットずつ8回、全てのキーで同じ桁は飛ばす) 同じキーのドローは積んだ順のまま
+    //
+    // ドローはそれぞれインスタンスのデータを1つ持ち、getInstances()の配列にドローと同じ順で並ぶ
+    // mergeInstances()は、隣り合っていてインスタンスのデータ以外が同じドローを1つのインスタンス描画にまとめる
+    // 並べ替えで同じパイプライン・デスクリプタセット・マテリアルのドローが隣り合うので、同じものを何度も描くシーンでもドローは数個になる
+    // (メッシュはキーに入っていないので、マテリアルの番号はメッシュとマテリアルの組み合わせごとに分けておくと、まとまりやすい)
+    //
+    // buildIndirectCommands()は、インデックス付きのドローをvk::DrawIndexedIndirectCommandにして、
+    // 隣り合っていて状態が同じドローを1つの間接描画(バッチ)にまとめる オブジェクトがいくつあってもCPUが積むドローはバッチの数で済む
+    // レンダースレッドからだけ使う想定 (並べ替えた後のgetItems()はワーカースレッドから同時に読んでよい)
+    class DrawList
+    {
+    public:
+        static constexpr uint32_t kPipelineBits = 16;
+        static constexpr uint32_t kDescriptorSetBits = 12;
+        static constexpr uint32_t kMaterialBits = 12;
+        static constexpr uint32_t kDepthBits = 24;
+
+        // 番号が桁に入りきらないときは最大値に丸める (並べ替えの効きが悪くなるだけで、描画は正しい)
+        // depthは0～1 (範囲外は丸める)
+        static uint64_t makeSortKey(uint32_t pipelineId, uint32_t descriptorSetId, uint32_t materialId, float depth);
+
+        // ハンドルをソートキーに入る小さな番号にする フレームの中で最初に出てきた順に番号を振る
+        uint32_t getPipelineId(vk::Pipeline pipeline);
+        uint32_t getDescriptorSetId(vk::DescriptorSet descriptorSet);
+
+        // itemのfirstInstanceとinstanceCountは無視する
+        void push(uint64_t sortKey, const DrawItem& item, const InstanceData& instance);
+        void sort();
+        // sort()の後に呼ぶ (呼ばなくてもよい)
+        void mergeInstances();
+        // sort()とmergeInstances()の後に呼ぶ (呼ばなくてもよい) 呼ぶとgetItems()はバッチの並びになる
+        void buildIndirectCommands();
+        // 番号の割り当ても含めて全て忘れる 毎フレームの最初に呼ぶ
+        void clear();
+
+        // sort()の後はソートキーの順、呼ばなければ積んだ順
+        const std::vector<DrawItem>& getItems() const { return _items; }
+        // DrawItem::firstInstanceから並ぶインスタンスのデータ 頂点入力のバインディング1にそのまま置く
+        const std::vector<InstanceData>& getInstances() const { return _instances; }
+        // buildIndirectCommands()で作った、間接描画のコマンドとバッチごとのコマンドの数
+        const std::vector<vk::DrawIndexedIndirectCommand>& getIndirectCommands() const { return _indirectCommands; }
+        const std::vector<uint32_t>& getIndirectCounts() const { return _indirectCounts; }
+        size_t size() const { return _items.size(); }
+        bool empty() const { return _items.empty(); }
+
+    private:
+        std::vector<uint64_t> _keys;
+        std::vector<DrawItem> _items;
+        std::vector<InstanceData> _instances;
+        std::vector<vk::DrawIndexedIndirectCommand> _indirectCommands;
+        std::vector<uint32_t> _indirectCounts;
+
+        // 並べ替えの作業領域 毎フレーム確保し直さないようメンバで持つ
+        std::vector<uint64_t> _sortKeys;
+        std::vector<uint32_t> _sortOrder;
+        std::vector<uint64_t> _tempKeys;
+        std::vector<uint32_t> _tempOrder;
+        std::vector<DrawItem> _sortedItems;
+        std::vector<InstanceData> _sortedInstances;
+
+        std::unordered_map<VkPipeline, uint32_t> _pipelineIds;
+        std::unordered_map<VkDescriptorSet, uint32_t> _descriptorSetIds;
+    };
+}
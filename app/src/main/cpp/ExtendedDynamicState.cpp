@@ -0,0 +1,63 @@
+#include "ExtendedDynamicState.hpp"
+#include "Utility.hpp"
+
+#include <cstring>
+
+namespace Vulkan_Test
+{
+    bool ExtendedDynamicState::isSupported(vk::PhysicalDevice physicalDevice, uint32_t apiVersion)
+    {
+        // 機能の問い合わせにvkGetPhysicalDeviceFeatures2を使うので、インスタンスもデバイスもVulkan 1.1以上に限る
+        if (apiVersion < VK_API_VERSION_1_1)
+        {
+            return false;
+        }
+
+        std::vector<vk::ExtensionProperties> extensions = physicalDevice.enumerateDeviceExtensionProperties();
+        bool found = std::any_of(extensions.begin(), extensions.end(), [](const vk::ExtensionProperties& extension) {
+            return std::strcmp(extension.extensionName, getExtensionName()) == 0;
+        });
+        if (!found)
+        {
+            return false;
+        }
+
+        vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT> features =
+                physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>();
+        return features.get<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>().extendedDynamicState;
+    }
+
+    void ExtendedDynamicState::load(vk::Device device)
+    {
+        _cmdSetCullMode = reinterpret_cast<PFN_vkCmdSetCullModeEXT>(device.getProcAddr("vkCmdSetCullModeEXT"));
+        _cmdSetFrontFace = reinterpret_cast<PFN_vkCmdSetFrontFaceEXT>(device.getProcAddr("vkCmdSetFrontFaceEXT"));
+        _cmdSetPrimitiveTopology = reinterpret_cast<PFN_vkCmdSetPrimitiveTopologyEXT>(device.getProcAddr("vkCmdSetPrimitiveTopologyEXT"));
+        _cmdSetDepthTestEnable = reinterpret_cast<PFN_vkCmdSetDepthTestEnableEXT>(device.getProcAddr("vkCmdSetDepthTestEnableEXT"));
+        _cmdSetDepthWriteEnable = reinterpret_cast<PFN_vkCmdSetDepthWriteEnableEXT>(device.getProcAddr("vkCmdSetDepthWriteEnableEXT"));
+        _cmdSetDepthCompareOp = reinterpret_cast<PFN_vkCmdSetDepthCompareOpEXT>(device.getProcAddr("vkCmdSetDepthCompareOpEXT"));
+
+        // 1つでも取れなければ使わない
+        if (!_cmdSetCullMode || !_cmdSetFrontFace || !_cmdSetPrimitiveTopology ||
+            !_cmdSetDepthTestEnable || !_cmdSetDepthWriteEnable || !_cmdSetDepthCompareOp)
+        {
+            LOG("ExtendedDynamicState: failed to load commands, falling back to static state");
+            *this = ExtendedDynamicState();
+        }
+    }
+
+    void ExtendedDynamicState::apply(vk::CommandBuffer commandBuffer, const PipelineDesc& desc) const
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+
+        VkCommandBuffer cmd = commandBuffer;
+        _cmdSetCullMode(cmd, static_cast<VkCullModeFlags>(desc.cullMode));
+        _cmdSetFrontFace(cmd, static_cast<VkFrontFace>(desc.frontFace));
+        _cmdSetPrimitiveTopology(cmd, static_cast<VkPrimitiveTopology>(desc.topology));
+        _cmdSetDepthTestEnable(cmd, desc.depthTestEnable);
+        _cmdSetDepthWriteEnable(cmd, desc.depthWriteEnable);
+        _cmdSetDepthCompareOp(cmd, VK_COMPARE_OP_LESS);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include "PipelineDesc.hpp"
+
+namespace Vulkan_Test
+{
+    // VK_EXT_extended_dynamic_stateのコマンドをまとめたもの
+    //
+    // カリング・表裏・トポロジー・深度テストを動的ステートにできれば、
+    // それらの組み合わせごとにパイプラインをコンパイルしなくてよくなる
+    // 非対応の端末ではload()を呼ばないままにしておけば、isEnabled()がfalseになり今まで通りパイプラインに焼き込む
+    //
+    // 拡張機能の関数はローダーが公開していない端末があるので、関数ポインタはvkGetDeviceProcAddrで取ってくる
+    class ExtendedDynamicState
+    {
+    public:
+        static const char* getExtensionName() { return VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME; }
+
+        // 拡張機能があり、さらにextendedDynamicStateの機能が使えるときだけtrue
+        // apiVersionはインスタンスとデバイスのバージョンの低い方 1.1未満なら機能を問い合わせられないのでfalse
+        static bool isSupported(vk::PhysicalDevice physicalDevice, uint32_t apiVersion);
+
+        // 拡張機能を有効にして作った論理デバイスを渡す
+        void load(vk::Device device);
+
+        bool isEnabled() const { return _cmdSetCullMode != nullptr; }
+
+        // descのうち動的ステートにした部分をコマンドで設定する パイプラインをバインドしたあとに呼ぶ
+        // 有効でなければ何もしない
+        void apply(vk::CommandBuffer commandBuffer, const PipelineDesc& desc) const;
+
+    private:
+        PFN_vkCmdSetCullModeEXT _cmdSetCullMode = nullptr;
+        PFN_vkCmdSetFrontFaceEXT _cmdSetFrontFace = nullptr;
+        PFN_vkCmdSetPrimitiveTopologyEXT _cmdSetPrimitiveTopology = nullptr;
+        PFN_vkCmdSetDepthTestEnableEXT _cmdSetDepthTestEnable = nullptr;
+        PFN_vkCmdSetDepthWriteEnableEXT _cmdSetDepthWriteEnable = nullptr;
+        PFN_vkCmdSetDepthCompareOpEXT _cmdSetDepthCompareOp = nullptr;
+    };
+}
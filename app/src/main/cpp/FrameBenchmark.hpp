@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+#include "Utility.hpp"
+
+namespace Vulkan_Test
+{
+    // フレーム時間を計測して一定フレームごとに平均・最小・最大をログに出す
+    // CPUとGPUがどれだけ重なって動けているかは、render()を呼ぶ間隔(=スループット)を見ればわかる
+    // 同じ端末・同じICD(lavapipeなど)で、直列化したパスとフレームインフライトのパスを比較するために使う
+    class FrameBenchmark
+    {
+    public:
+        FrameBenchmark(std::string label, uint32_t reportInterval = 300)
+            : _label(std::move(label)), _reportInterval(reportInterval)
+        {
+        }
+
+        // 1フレームにつき1回呼ぶ
+        // 前回呼ばれたときからの経過時間を1フレームの時間として集計する
+        void frame()
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (_hasLastFrame)
+            {
+                double frameMs = std::chrono::duration<double, std::milli>(now - _lastFrame).count();
+                _totalMs += frameMs;
+                _minMs = std::min(_minMs, frameMs);
+                _maxMs = std::max(_maxMs, frameMs);
+                _frameCount++;
+            }
+            _lastFrame = now;
+            _hasLastFrame = true;
+
+            if (_reportInterval != 0 && _frameCount >= _reportInterval)
+            {
+                report();
+                reset();
+            }
+        }
+
+        void report() const
+        {
+            if (_frameCount == 0)
+            {
+                return;
+            }
+
+            double averageMs = _totalMs / _frameCount;
+            LOG("FrameBenchmark [" << _label << "] frames: " << _frameCount <<
+                " avg: " << std::fixed << std::setprecision(3) << averageMs << "ms" <<
+                " min: " << _minMs << "ms" <<
+                " max: " << _maxMs << "ms" <<
+                " fps: " << std::setprecision(1) << (1000.0 / averageMs));
+        }
+
+        void reset()
+        {
+            _frameCount = 0;
+            _totalMs = 0.0;
+            _minMs = std::numeric_limits<double>::max();
+            _maxMs = 0.0;
+        }
+
+        uint32_t getFrameCount() const { return _frameCount; }
+        double getAverageMs() const { return _frameCount == 0 ? 0.0 : _totalMs / _frameCount; }
+
+    private:
+        std::string _label;
+        uint32_t _reportInterval;
+
+        std::chrono::steady_clock::time_point _lastFrame;
+        bool _hasLastFrame = false;
+
+        uint32_t _frameCount = 0;
+        double _totalMs = 0.0;
+        double _minMs = std::numeric_limits<double>::max();
+        double _maxMs = 0.0;
+    };
+}
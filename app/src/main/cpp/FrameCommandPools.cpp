@@ -0,0 +1,72 @@
+#include "FrameCommandPools.hpp"
+
+namespace Vulkan_Test
+{
+    FrameCommandPools::FrameCommandPools(vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount)
+        : _device(device)
+    {
+        vk::CommandPoolCreateInfo poolCreateInfo;
+        poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+        // 記録したコマンドはそのフレームでしか使わないのでeTransient
+        // バッファを個別にリセットしないのでeResetCommandBufferは付けない
+        poolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+        _frames.resize(frameCount);
+        for (Frame& frame : _frames)
+        {
+            frame.pool = _device.createCommandPoolUnique(poolCreateInfo);
+        }
+    }
+
+    void FrameCommandPools::beginFrame(uint32_t frameIndex)
+    {
+        _frameIndex = frameIndex;
+        Frame& frame = _frames[_frameIndex];
+        if (frame.usedPrimary.empty() && frame.usedSecondary.empty())
+        {
+            return;
+        }
+
+        // プールを丸ごとリセットすると、そこから作った全てのバッファが初期状態に戻る
+        _device.resetCommandPool(frame.pool.get());
+        frame.freePrimary.insert(frame.freePrimary.end(), frame.usedPrimary.begin(), frame.usedPrimary.end());
+        frame.freeSecondary.insert(frame.freeSecondary.end(), frame.usedSecondary.begin(), frame.usedSecondary.end());
+        frame.usedPrimary.clear();
+        frame.usedSecondary.clear();
+    }
+
+    vk::CommandBuffer FrameCommandPools::acquire(vk::CommandBufferLevel level)
+    {
+        Frame& frame = _frames[_frameIndex];
+        bool primary = level == vk::CommandBufferLevel::ePrimary;
+        std::vector<vk::CommandBuffer>& freeList = primary ? frame.freePrimary : frame.freeSecondary;
+        std::vector<vk::CommandBuffer>& usedList = primary ? frame.usedPrimary : frame.usedSecondary;
+
+        vk::CommandBuffer commandBuffer;
+        if (!freeList.empty())
+        {
+            commandBuffer = freeList.back();
+            freeList.pop_back();
+        }
+        else
+        {
+            vk::CommandBufferAllocateInfo allocateInfo;
+            allocateInfo.commandPool = frame.pool.get();
+            allocateInfo.commandBufferCount = 1;
+            allocateInfo.level = level;
+            commandBuffer = _device.allocateCommandBuffers(allocateInfo)[0];
+            _allocatedCount++;
+        }
+        usedList.push_back(commandBuffer);
+        return commandBuffer;
+    }
+
+    FrameCommandPools::Stats FrameCommandPools::getStats() const
+    {
+        const Frame& frame = _frames[_frameIndex];
+        Stats stats;
+        stats.allocatedCount = _allocatedCount;
+        stats.acquiredCount = static_cast<uint32_t>(frame.usedPrimary.size() + frame.usedSecondary.size());
+        return stats;
+    }
+}
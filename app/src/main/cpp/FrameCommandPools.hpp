@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // フレームスロットごとのコマンドプールと、そこから作ったコマンドバッファの使い回し
+    //
+    // コマンドバッファを1つずつresetするのは、多くのドライバで遅い方の道になる
+    // (プールをeResetCommandBufferで作ると、ドライバはバッファごとにメモリを管理しなければならない)
+    // そこでフレームスロットごとにeTransientのプールを作り、スロットのフェンスを待ったあとにresetCommandPoolで丸ごとリセットする
+    // リセットしたプールのバッファは捨てずに空きリストに戻し、次にacquireされたときにそのまま使う
+    //
+    // レンダースレッドだけで使う (スレッドセーフではない)
+    class FrameCommandPools
+    {
+    public:
+        struct Stats
+        {
+            // プールから作ったコマンドバッファの数 (全てのスロットの合計)
+            uint32_t allocatedCount = 0;
+            // 今のフレームでacquireされた数
+            uint32_t acquiredCount = 0;
+        };
+
+        FrameCommandPools(vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount);
+
+        FrameCommandPools(const FrameCommandPools&) = delete;
+        FrameCommandPools& operator=(const FrameCommandPools&) = delete;
+
+        // スロットのフェンスを待ったあとに呼ぶ そのスロットから渡した全てのコマンドバッファが記録前の状態に戻る
+        void beginFrame(uint32_t frameIndex);
+
+        // 今のスロットのコマンドバッファを1つ渡す beginから記録してよい
+        vk::CommandBuffer acquire(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+
+        Stats getStats() const;
+
+    private:
+        struct Frame
+        {
+            vk::UniqueCommandPool pool;
+            // プールが破棄されると中のバッファも解放されるので、ハンドルだけを持つ
+            std::vector<vk::CommandBuffer> freePrimary;
+            std::vector<vk::CommandBuffer> freeSecondary;
+            std::vector<vk::CommandBuffer> usedPrimary;
+            std::vector<vk::CommandBuffer> usedSecondary;
+        };
+
+        vk::Device _device;
+        std::vector<Frame> _frames;
+        uint32_t _frameIndex = 0;
+        uint32_t _allocatedCount = 0;
+    };
+}
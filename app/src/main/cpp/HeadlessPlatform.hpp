@@ -0,0 +1,53 @@
+#pragma once
+
+#include <fstream>
+#include <iterator>
+#include "Platform.hpp"
+
+namespace Vulkan_Test
+{
+    // ウィンドウを持たないプラットフォーム
+    //
+    // サーフェスを作らないので、lavapipeやSwiftShaderのようなソフトウェアのICDでもCIのマシンでも動く
+    // アセットはassetDirectory以下のファイルを直接読む (app/src/main/assets を指定すればAndroidと同じものが使える)
+    // cacheDirectoryが空ならパイプラインキャッシュなどを保存しない (毎回最初の起動と同じ条件で計れる)
+    class HeadlessPlatform : public Platform
+    {
+    public:
+        HeadlessPlatform(std::string assetDirectory, vk::Extent2D extent, std::string cacheDirectory = std::string())
+            : _assetDirectory(std::move(assetDirectory)), _extent(extent), _cacheDirectory(std::move(cacheDirectory))
+        {
+        }
+
+        std::vector<const char*> getRequiredInstanceExtensions() const override
+        {
+            return {};
+        }
+
+        bool hasSurface() const override { return false; }
+
+        vk::UniqueSurfaceKHR createSurface(vk::Instance) override
+        {
+            return vk::UniqueSurfaceKHR();
+        }
+
+        vk::Extent2D getOffscreenExtent() const override { return _extent; }
+
+        std::optional<std::vector<char>> readAsset(const std::string& name) override
+        {
+            std::ifstream file(_assetDirectory + "/" + name, std::ios::binary);
+            if (!file)
+            {
+                return std::nullopt;
+            }
+            return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        std::string getCacheDirectory() const override { return _cacheDirectory; }
+
+    private:
+        std::string _assetDirectory;
+        vk::Extent2D _extent;
+        std::string _cacheDirectory;
+    };
+}
@@ -0,0 +1,72 @@
+#include "IndirectDrawBuffer.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+
+namespace Vulkan_Test
+{
+    IndirectDrawBuffer::IndirectDrawBuffer(vk::Device device, MemoryAllocator& memoryAllocator, uint32_t frameCount)
+        : _device(device), _memoryAllocator(memoryAllocator), _frames(frameCount)
+    {
+    }
+
+    IndirectDrawBuffer::~IndirectDrawBuffer()
+    {
+        for (Frame& frame : _frames)
+        {
+            if (frame.buffer)
+            {
+                _memoryAllocator.free(frame.memory);
+            }
+        }
+    }
+
+    void IndirectDrawBuffer::beginFrame(uint32_t frameIndex)
+    {
+        _currentFrame = frameIndex;
+    }
+
+    bool IndirectDrawBuffer::upload(StagingRing& stagingRing, const std::vector<vk::DrawIndexedIndirectCommand>& commands, const std::vector<uint32_t>& counts)
+    {
+        if (commands.empty())
+        {
+            return true;
+        }
+
+        // コマンドの位置は4の倍数でなければならない コマンド数の後ろを揃えておく
+        vk::DeviceSize countsSize = sizeof(uint32_t) * counts.size();
+        vk::DeviceSize commandsOffset = (countsSize + 15) / 16 * 16;
+        vk::DeviceSize commandsSize = sizeof(vk::DrawIndexedIndirectCommand) * commands.size();
+        vk::DeviceSize requiredSize = commandsOffset + commandsSize;
+
+        // このスロットのフェンスは待った後なので、古いバッファはすぐに捨ててよい
+        Frame& frame = _frames[_currentFrame];
+        if (frame.size < requiredSize)
+        {
+            if (frame.buffer)
+            {
+                _memoryAllocator.free(frame.memory);
+                frame.buffer.reset();
+            }
+            frame.size = std::max<vk::DeviceSize>(requiredSize, frame.size * 2);
+
+            vk::BufferCreateInfo bufferCreateInfo;
+            bufferCreateInfo.size = frame.size;
+            bufferCreateInfo.usage = vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst;
+            bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+            frame.buffer = _device.createBufferUnique(bufferCreateInfo);
+            frame.memory = _memoryAllocator.allocateForBuffer(frame.buffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+        }
+        _commandsOffset = commandsOffset;
+
+        // 転送先はdrawIndexedIndirect(Count)がeDrawIndirectステージで読む
+        // 同じバッファへの2つのコピーは、ステージングリングが1回のcopyBufferにまとめる
+        if (!stagingRing.uploadBuffer(frame.buffer.get(), 0, counts.data(), countsSize,
+                                      vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead))
+        {
+            return false;
+        }
+        return stagingRing.uploadBuffer(frame.buffer.get(), commandsOffset, commands.data(), commandsSize,
+                                        vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead);
+    }
+}
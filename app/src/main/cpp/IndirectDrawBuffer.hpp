@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+
+namespace Vulkan_Test
+{
+    // 間接描画のコマンド(vk::DrawIndexedIndirectCommand)とコマンドの数を置く、デバイスローカルのバッファ
+    //
+    // フレームスロットごとにバッファを1つ持ち、毎フレームCPUで作った内容をステージングリングで転送する
+    // GPUは前のフレームのコマンドをまだ読んでいるかもしれないので、スロットのフェンスを待ってから書き換える
+    // 足りなくなったらそのスロットのバッファだけを大きく作り直す
+    //
+    // バッファの中身は [バッチごとのコマンド数 (uint32_t)] [コマンド] の順
+    // コマンドの数はdrawIndexedIndirectCountが読む (コンピュートでカリングするときはここをGPUが書き換える)
+    //
+    // レンダースレッドだけで使う (スレッドセーフではない)
+    class IndirectDrawBuffer
+    {
+    public:
+        IndirectDrawBuffer(vk::Device device, MemoryAllocator& memoryAllocator, uint32_t frameCount);
+        ~IndirectDrawBuffer();
+
+        IndirectDrawBuffer(const IndirectDrawBuffer&) = delete;
+        IndirectDrawBuffer& operator=(const IndirectDrawBuffer&) = delete;
+
+        void beginFrame(uint32_t frameIndex);
+
+        // 今のスロットのバッファへの転送をステージングリングに予約する リングに空きがなければfalse
+        // 1フレームに1回だけ呼ぶ
+        bool upload(StagingRing& stagingRing, const std::vector<vk::DrawIndexedIndirectCommand>& commands, const std::vector<uint32_t>& counts);
+
+        vk::Buffer getBuffer() const { return _frames[_currentFrame].buffer.get(); }
+        vk::DeviceSize getCountOffset(uint32_t batch) const { return sizeof(uint32_t) * batch; }
+        vk::DeviceSize getCommandOffset(uint32_t command) const { return _commandsOffset + sizeof(vk::DrawIndexedIndirectCommand) * command; }
+
+    private:
+        struct Frame
+        {
+            vk::UniqueBuffer buffer;
+            MemoryAllocation memory;
+            vk::DeviceSize size = 0;
+        };
+
+        vk::Device _device;
+        MemoryAllocator& _memoryAllocator;
+        std::vector<Frame> _frames;
+        uint32_t _currentFrame = 0;
+        vk::DeviceSize _commandsOffset = 0;
+    };
+}
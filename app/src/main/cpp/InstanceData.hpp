@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+// 頂点入力のバインディング1 (inputRate = eInstance) に並べる、インスタンスごとのデータ
+//
+// layout(location = 3) in vec4 instanceTransform0;  // 変換行列の1～3行目 (4行目は(0, 0, 0, 1)で固定)
+// layout(location = 4) in vec4 instanceTransform1;
+// layout(location = 5) in vec4 instanceTransform2;
+// layout(location = 6) in vec4 instanceColor;       // R8G8B8A8のunormで、シェーダーにはvec4で届く
+//
+// 1つにまとめたドローの中では、gl_InstanceIndexが進むごとに次の要素が読まれる
+//
+// これを使う頂点シェーダーはshader_instanced.vert.spv (shader.vert.spvに次の2か所を足したもの)
+//   vec4 localPos = vec4(inPos, 1.0);
+//   gl_Position = sceneData.mvpMatrix[objectData.id] * vec4(dot(instanceTransform0, localPos),
+//                                                          dot(instanceTransform1, localPos),
+//                                                          dot(instanceTransform2, localPos), 1.0);
+//   fragmentColor = inColor * instanceColor.rgb;
+struct InstanceData {
+    float transform[3][4];
+    uint32_t color;
+
+    static InstanceData identity()
+    {
+        InstanceData data{};
+        for (int i = 0; i < 3; i++)
+        {
+            data.transform[i][i] = 1.0f;
+        }
+        data.color = 0xffffffff;
+        return data;
+    }
+
+    // xとyだけ平行移動し、xとyをscale倍する colorはR8G8B8A8 (最下位のバイトが赤)
+    static InstanceData translateScale(float x, float y, float scale, uint32_t color)
+    {
+        InstanceData data = identity();
+        data.transform[0][0] = scale;
+        data.transform[1][1] = scale;
+        data.transform[0][3] = x;
+        data.transform[1][3] = y;
+        data.color = color;
+        return data;
+    }
+};
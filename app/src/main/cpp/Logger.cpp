@@ -0,0 +1,266 @@
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#if defined(__ANDROID__)
+#include <android/log.h>
+#endif
+
+namespace Vulkan_Test
+{
+    namespace
+    {
+        // logcatのタグ (AndroidOutと同じにしておく)
+        constexpr const char* kLogTag = "AO";
+        // 書き出しのスレッドが起きる間隔
+        constexpr std::chrono::milliseconds kDrainInterval(10);
+
+        int64_t steadyNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void flushAtExit()
+        {
+            Logger::get().flush();
+        }
+    }
+
+    Logger::Writer::Writer(LogLevel level, const char* file, uint32_t line)
+        : _buffer(Logger::get().getThreadBuffer()),
+          _record(_buffer.records[_buffer.writeCount.load(std::memory_order_relaxed) % _buffer.records.size()])
+    {
+        // 書き出しが追いついていなければ、起こして空くのを待つ
+        uint64_t writeCount = _buffer.writeCount.load(std::memory_order_relaxed);
+        while (writeCount - _buffer.readCount.load(std::memory_order_acquire) >= _buffer.records.size())
+        {
+            Logger::get().wake();
+            std::this_thread::yield();
+        }
+
+        _record.ticks = steadyNs();
+        _record.file = file;
+        _record.line = line;
+        _record.level = level;
+        _record.indent = static_cast<uint8_t>(std::min<uint32_t>(_buffer.indent, UINT8_MAX));
+
+        // 前のメッセージで変えた書式を戻しておく
+        _buffer.streamBuf.reset(_record.text, sizeof(_record.text));
+        _buffer.stream.clear();
+        _buffer.stream.flags(std::ios::boolalpha | std::ios::dec | std::ios::skipws);
+        _buffer.stream.fill(' ');
+        _buffer.stream.width(0);
+        _buffer.stream.precision(6);
+    }
+
+    Logger::Writer::~Writer()
+    {
+        _record.length = static_cast<uint16_t>(_buffer.streamBuf.length());
+        _buffer.writeCount.store(_buffer.writeCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+        if (_record.level == LogLevel::Error)
+        {
+            Logger::get().flush();
+        }
+    }
+
+    Logger& Logger::get()
+    {
+        // どこからでもログを出せるようにプロセスに1つだけ持つ 終了まで破棄しない
+        static Logger* pInstance = new Logger();
+        return *pInstance;
+    }
+
+    Logger::Logger()
+    {
+        _baseSteadyNs = steadyNs();
+        _baseSystemNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        _pendingRecords.reserve(kRecordsPerThread * 4);
+        _drainThread = std::thread(&Logger::drainThreadMain, this);
+        _drainThread.detach();
+        std::atexit(flushAtExit);
+    }
+
+    Logger::ThreadBuffer& Logger::getThreadBuffer()
+    {
+        // スレッドが終わったらバッファを手放す
+        struct ThreadBufferHandle
+        {
+            ThreadBuffer* pBuffer = nullptr;
+            ~ThreadBufferHandle()
+            {
+                if (pBuffer)
+                {
+                    pBuffer->released.store(true, std::memory_order_release);
+                }
+            }
+        };
+
+        // 初めてログを出すスレッドだけバッファを用意する それ以降はthread_localのポインタを使うだけ
+        thread_local ThreadBufferHandle handle;
+        if (!handle.pBuffer)
+        {
+            std::lock_guard<std::mutex> lock(_buffersMutex);
+            for (const std::unique_ptr<ThreadBuffer>& buffer : _threadBuffers)
+            {
+                if (buffer->released.load(std::memory_order_acquire) &&
+                    buffer->readCount.load(std::memory_order_acquire) == buffer->writeCount.load(std::memory_order_relaxed))
+                {
+                    buffer->released.store(false, std::memory_order_relaxed);
+                    handle.pBuffer = buffer.get();
+                    break;
+                }
+            }
+            if (!handle.pBuffer)
+            {
+                _threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+                handle.pBuffer = _threadBuffers.back().get();
+            }
+            // バッファを使い回しても番号はスレッドごとに新しくする
+            handle.pBuffer->threadId = _nextThreadId++;
+            handle.pBuffer->threadNameLength.store(0, std::memory_order_relaxed);
+            handle.pBuffer->indent = 0;
+        }
+        return *handle.pBuffer;
+    }
+
+    void Logger::setThreadName(const char* name)
+    {
+        ThreadBuffer& buffer = getThreadBuffer();
+        buffer.threadNameLength.store(0, std::memory_order_release);
+        size_t length = name ? std::min(std::strlen(name), kMaxThreadNameLength) : 0;
+        if (length > 0)
+        {
+            std::memcpy(buffer.threadName, name, length);
+        }
+        buffer.threadNameLength.store(static_cast<uint32_t>(length), std::memory_order_release);
+    }
+
+    void Logger::setLogFile(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(_drainMutex);
+        _logFile.close();
+        if (path.empty())
+        {
+            return;
+        }
+        _logFile.open(path, std::ios::app);
+        if (!_logFile)
+        {
+            writeLine(LogLevel::Error, "Logger: failed to open " + path);
+        }
+    }
+
+    void Logger::drainThreadMain()
+    {
+        std::mutex waitMutex;
+        std::unique_lock<std::mutex> waitLock(waitMutex);
+        while (true)
+        {
+            _drainCondition.wait_for(waitLock, kDrainInterval);
+            flush();
+        }
+    }
+
+    void Logger::flush()
+    {
+        std::lock_guard<std::mutex> lock(_drainMutex);
+
+        std::vector<ThreadBuffer*> buffers;
+        {
+            std::lock_guard<std::mutex> buffersLock(_buffersMutex);
+            buffers.reserve(_threadBuffers.size());
+            for (const std::unique_ptr<ThreadBuffer>& buffer : _threadBuffers)
+            {
+                buffers.push_back(buffer.get());
+            }
+        }
+
+        // 各スレッドの書き終わった分を集め、スレッドをまたいで時刻順に並べる
+        // readCountを進めるまでは書き込むスレッドがその要素を上書きすることはない
+        std::vector<uint64_t> endCounts(buffers.size());
+        _pendingRecords.clear();
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            ThreadBuffer& buffer = *buffers[i];
+            endCounts[i] = buffer.writeCount.load(std::memory_order_acquire);
+            for (uint64_t count = buffer.readCount.load(std::memory_order_relaxed); count < endCounts[i]; count++)
+            {
+                _pendingRecords.push_back(PendingRecord{ &buffer.records[count % buffer.records.size()], &buffer });
+            }
+        }
+        if (_pendingRecords.empty())
+        {
+            return;
+        }
+        std::stable_sort(_pendingRecords.begin(), _pendingRecords.end(),
+                         [](const PendingRecord& a, const PendingRecord& b) { return a.pRecord->ticks < b.pRecord->ticks; });
+
+        for (const PendingRecord& pendingRecord : _pendingRecords)
+        {
+            // 時刻 [スレッド] ファイル名:行番号 インデント メッセージ
+            const Record* pRecord = pendingRecord.pRecord;
+            int64_t systemNs = _baseSystemNs + (static_cast<int64_t>(pRecord->ticks) - _baseSteadyNs);
+            std::time_t seconds = static_cast<std::time_t>(systemNs / 1'000'000'000);
+            std::tm localTime = {};
+            localtime_r(&seconds, &localTime);
+
+            char prefix[64];
+            std::snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d ", localTime.tm_hour, localTime.tm_min, localTime.tm_sec,
+                          static_cast<int>(systemNs / 1'000'000 % 1000));
+            _lineBuffer = prefix;
+            uint32_t threadNameLength = pendingRecord.pBuffer->threadNameLength.load(std::memory_order_acquire);
+            std::snprintf(prefix, sizeof(prefix), "[T%u%s%.*s] ", pendingRecord.pBuffer->threadId, threadNameLength ? " " : "",
+                          static_cast<int>(threadNameLength), pendingRecord.pBuffer->threadName);
+            _lineBuffer += prefix;
+            _lineBuffer += pRecord->file;
+            std::snprintf(prefix, sizeof(prefix), ":%03u ", pRecord->line);
+            _lineBuffer += prefix;
+            for (uint32_t i = 0; i < pRecord->indent; i++)
+            {
+                _lineBuffer += "    ";
+            }
+            _lineBuffer.append(pRecord->text, pRecord->length);
+            if (pRecord->length == kMaxMessageLength)
+            {
+                _lineBuffer += "...";
+            }
+            writeLine(pRecord->level, _lineBuffer);
+        }
+
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            buffers[i]->readCount.store(endCounts[i], std::memory_order_release);
+        }
+
+#if !defined(__ANDROID__)
+        std::fflush(stdout);
+        std::fflush(stderr);
+#endif
+        if (_logFile.is_open())
+        {
+            _logFile.flush();
+        }
+    }
+
+    void Logger::writeLine(LogLevel level, const std::string& line)
+    {
+#if defined(__ANDROID__)
+        int priority = level == LogLevel::Error ? ANDROID_LOG_ERROR : level == LogLevel::Debug ? ANDROID_LOG_DEBUG : ANDROID_LOG_INFO;
+        __android_log_write(priority, kLogTag, line.c_str());
+#else
+        std::fprintf(level == LogLevel::Error ? stderr : stdout, "%s\n", line.c_str());
+#endif
+        if (_logFile.is_open())
+        {
+            _logFile << line << '\n';
+        }
+    }
+}
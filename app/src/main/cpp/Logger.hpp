@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ログの重要度 VULKAN_TEST_LOG_LEVELより低いものはマクロごとコンパイル時に消える
+#define VULKAN_TEST_LOG_LEVEL_DEBUG 0
+#define VULKAN_TEST_LOG_LEVEL_INFO 1
+#define VULKAN_TEST_LOG_LEVEL_ERROR 2
+#define VULKAN_TEST_LOG_LEVEL_NONE 3
+
+#ifndef VULKAN_TEST_LOG_LEVEL
+#define VULKAN_TEST_LOG_LEVEL VULKAN_TEST_LOG_LEVEL_INFO
+#endif
+
+namespace Vulkan_Test
+{
+    enum class LogLevel : uint8_t
+    {
+        Debug = VULKAN_TEST_LOG_LEVEL_DEBUG,
+        Info = VULKAN_TEST_LOG_LEVEL_INFO,
+        Error = VULKAN_TEST_LOG_LEVEL_ERROR,
+    };
+
+    // LOG/LOGERRの書き出し先
+    //
+    // ・ログを出すスレッドは、自分のスレッド用のリングバッファの1要素にメッセージを書くだけ (ロックもメモリ確保もしない)
+    //   時刻はsteady_clockの値のまま、ファイル名と行番号はポインタと数値のまま持ち、文字列にするのは書き出すとき
+    // ・バックグラウンドのスレッドが定期的に全スレッドのバッファを時刻順に書き出す
+    //   書き出し先はAndroidならlogcat、それ以外なら標準出力(エラーは標準エラー)、setLogFileでファイルにも書ける
+    // ・エラーはその場でflushする (LOGERRの直後にexitしても消えないように)
+    // ・1行は1回の書き込みで出すので、複数のスレッドのログが行の途中で混ざることはない
+    //   行の先頭にはスレッドの番号(とsetThreadNameでつけた名前)をつける
+    // ・インデントはスレッドごと IndentScope(LOG_INDENT)で入れ子にする
+    // ・バッファが一杯になったら、空くまで書き出しのスレッドを起こして待つ (ログは捨てない)
+    class Logger
+    {
+    public:
+        // これより長いメッセージは切り詰める
+        static constexpr size_t kMaxMessageLength = 480;
+        static constexpr size_t kRecordsPerThread = 256;
+        // これより長いスレッドの名前は切り詰める
+        static constexpr size_t kMaxThreadNameLength = 32;
+
+        struct Record
+        {
+            // steady_clockの値
+            uint64_t ticks;
+            const char* file;
+            uint32_t line;
+            LogLevel level;
+            uint8_t indent;
+            uint16_t length;
+            char text[kMaxMessageLength];
+        };
+
+    private:
+        // リングバッファの要素の中に直接書き込むstreambuf 一杯になったらそれ以降は捨てる
+        class RecordStreamBuf : public std::streambuf
+        {
+        public:
+            void reset(char* pBegin, size_t size) { setp(pBegin, pBegin + size); }
+            size_t length() const { return pptr() - pbase(); }
+        };
+
+        // 1つのスレッドだけが書き、書き出しのスレッドが読む
+        struct ThreadBuffer
+        {
+            std::vector<Record> records = std::vector<Record>(kRecordsPerThread);
+            // これまでに書いた数と書き出した数 (位置は数 % records.size())
+            std::atomic<uint64_t> writeCount{ 0 };
+            std::atomic<uint64_t> readCount{ 0 };
+            RecordStreamBuf streamBuf;
+            std::ostream stream{ &streamBuf };
+            // スレッドが終了したらtrue 書き出し終わったバッファは次に作られたスレッドが使い回す
+            std::atomic<bool> released{ false };
+
+            // 以下はバッファを使っているスレッドの情報
+            // threadIdとthreadNameは書き出しのスレッドも読む (バッファを使い回すのは全て書き出し終わってからなので、読む間に変わることはない)
+            // 名前はコピーして持つ (名前をつけた側が先に破棄されても、溜まっているログを書き出せるように)
+            // 長さを0にしてから書き換え、書き終わってから長さを入れるので、読む側は長さの分だけ読めばよい
+            uint32_t threadId = 0;
+            char threadName[kMaxThreadNameLength] = {};
+            std::atomic<uint32_t> threadNameLength{ 0 };
+            uint32_t indent = 0;
+        };
+
+        struct PendingRecord
+        {
+            const Record* pRecord;
+            const ThreadBuffer* pBuffer;
+        };
+
+    public:
+        // 1行分のメッセージを、呼び出したスレッドのリングバッファに直接書く LOGマクロが使う
+        // stream()に書き終わり、破棄したときに書き出しの対象になる
+        class Writer
+        {
+        public:
+            Writer(LogLevel level, const char* file, uint32_t line);
+            ~Writer();
+
+            std::ostream& stream() { return _buffer.stream; }
+
+            Writer(const Writer&) = delete;
+            Writer& operator=(const Writer&) = delete;
+
+        private:
+            ThreadBuffer& _buffer;
+            Record& _record;
+        };
+
+        // 生きている間、呼び出したスレッドのログのインデントを1段深くする
+        class IndentScope
+        {
+        public:
+            IndentScope() : _buffer(Logger::get().getThreadBuffer()) { _buffer.indent++; }
+            ~IndentScope() { _buffer.indent--; }
+
+            IndentScope(const IndentScope&) = delete;
+            IndentScope& operator=(const IndentScope&) = delete;
+
+        private:
+            ThreadBuffer& _buffer;
+        };
+
+        static Logger& get();
+
+        // 呼び出したスレッドのログに名前をつける 名前はコピーする (スレッドが始まったときに1度だけ呼ぶ想定)
+        void setThreadName(const char* name);
+
+        // 以後のログをこのファイルにも書く 空なら書かない
+        void setLogFile(const std::string& path);
+        // 溜まっているログを呼び出したスレッドで書き出す
+        void flush();
+
+    private:
+        Logger();
+
+        ThreadBuffer& getThreadBuffer();
+        void wake() { _drainCondition.notify_one(); }
+        void drainThreadMain();
+        void writeLine(LogLevel level, const std::string& line);
+
+        // スレッドのバッファの登録のときだけロックする (ログを書くときは使わない)
+        std::mutex _buffersMutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> _threadBuffers;
+        uint32_t _nextThreadId = 1;
+
+        // 書き出すスレッドは同時に1つだけ (バックグラウンドのスレッドか、flushを呼んだスレッド)
+        std::mutex _drainMutex;
+        std::condition_variable _drainCondition;
+        std::ofstream _logFile;
+        std::vector<PendingRecord> _pendingRecords;
+        std::string _lineBuffer;
+
+        // steady_clockの値を壁時計の時刻に直すための基準
+        int64_t _baseSteadyNs;
+        int64_t _baseSystemNs;
+
+        std::thread _drainThread;
+    };
+}
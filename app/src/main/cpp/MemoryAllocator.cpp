@@ -0,0 +1,384 @@
+#include "MemoryAllocator.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+namespace Vulkan_Test
+{
+    // バディアロケーションの最小単位
+    // これより小さい要求もこの大きさに切り上げる
+    constexpr vk::DeviceSize kMinAllocationSize = 256;
+
+    struct MemoryBlock
+    {
+        vk::UniqueDeviceMemory memory;
+        uint32_t memoryTypeIndex = 0;
+        vk::DeviceSize size = 0;
+        bool linear = true;
+        bool dedicated = false;
+        void* pMapped = nullptr;
+
+        // freeLists[order] は大きさ kMinAllocationSize << order の空き領域のオフセット
+        uint32_t maxOrder = 0;
+        std::vector<std::set<vk::DeviceSize>> freeLists;
+        uint32_t allocationCount = 0;
+    };
+
+    static vk::DeviceSize floorPowerOfTwo(vk::DeviceSize value)
+    {
+        vk::DeviceSize result = 1;
+        while (result * 2 <= value)
+        {
+            result *= 2;
+        }
+        return result;
+    }
+
+    static uint32_t getOrder(vk::DeviceSize size)
+    {
+        uint32_t order = 0;
+        while ((kMinAllocationSize << order) < size)
+        {
+            order++;
+        }
+        return order;
+    }
+
+    MemoryAllocator::MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize preferredBlockSize)
+    {
+        _device = device;
+        _memoryProperties = physicalDevice.getMemoryProperties();
+
+        vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+        _nonCoherentAtomSize = limits.nonCoherentAtomSize;
+        _maxMemoryAllocationCount = limits.maxMemoryAllocationCount;
+
+        // ヒープが小さい端末で1ブロックがヒープの大半を占めないよう、ヒープの1/8を上限にする
+        // バディアロケーションのためにブロックの大きさは2のべき乗にそろえる
+        preferredBlockSize = floorPowerOfTwo(preferredBlockSize);
+        _blockSizes.resize(_memoryProperties.memoryHeapCount);
+        for (uint32_t i = 0; i < _memoryProperties.memoryHeapCount; i++)
+        {
+            vk::DeviceSize heapLimit = floorPowerOfTwo(std::max<vk::DeviceSize>(_memoryProperties.memoryHeaps[i].size / 8, kMinAllocationSize));
+            _blockSizes[i] = std::min(preferredBlockSize, heapLimit);
+        }
+    }
+
+    MemoryAllocator::~MemoryAllocator()
+    {
+        // UniqueDeviceMemoryの破棄でfreeMemoryが呼ばれる マップも同時に解除される
+        _blocks.clear();
+    }
+
+    std::optional<uint32_t> MemoryAllocator::findMemoryType(uint32_t memoryTypeBits, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred) const
+    {
+        // 物理デバイスのメモリタイプは何種類かあり、それぞれ性質(フラグ)が違う
+        // memoryTypeBitsはバッファやイメージが使えるメモリタイプのビットマスク
+        // i番目のビットが立っていればi番目のメモリタイプが使える
+        std::optional<uint32_t> result;
+        uint32_t bestScore = 0;
+        for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; i++)
+        {
+            vk::MemoryPropertyFlags flags = _memoryProperties.memoryTypes[i].propertyFlags;
+            if (!(memoryTypeBits & (1u << i)) || (flags & required) != required)
+            {
+                continue;
+            }
+
+            uint32_t score = 0;
+            for (uint32_t bit = 0; bit < 32; bit++)
+            {
+                vk::MemoryPropertyFlags flag = vk::MemoryPropertyFlags(1u << bit);
+                if ((preferred & flag) && (flags & flag))
+                {
+                    score++;
+                }
+            }
+            if (!result || score > bestScore)
+            {
+                result = i;
+                bestScore = score;
+            }
+        }
+        return result;
+    }
+
+    MemoryBlock* MemoryAllocator::createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, bool linear, bool dedicated)
+    {
+        TRACE_SCOPE("allocate device memory");
+
+        if (_blocks.size() >= _maxMemoryAllocationCount)
+        {
+            LOGERR("MemoryAllocator: maxMemoryAllocationCount (" << _maxMemoryAllocationCount << ") exceeded");
+        }
+
+        vk::MemoryAllocateInfo memoryAllocateInfo;
+        memoryAllocateInfo.allocationSize = size;
+        memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+        std::unique_ptr<MemoryBlock> block = std::make_unique<MemoryBlock>();
+        block->memory = _device.allocateMemoryUnique(memoryAllocateInfo);
+        block->memoryTypeIndex = memoryTypeIndex;
+        block->size = size;
+        block->linear = linear;
+        block->dedicated = dedicated;
+
+        // ホスト可視メモリはブロックごとに一度だけマップし、破棄するまでマップしたままにする
+        // マップは遅い上に、同じデバイスメモリを二重にマップすることはできないため
+        if (_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        {
+            block->pMapped = _device.mapMemory(block->memory.get(), 0, VK_WHOLE_SIZE);
+        }
+
+        if (!dedicated)
+        {
+            block->maxOrder = getOrder(size);
+            block->freeLists.resize(block->maxOrder + 1);
+            block->freeLists[block->maxOrder].insert(0);
+        }
+
+        _blocks.push_back(std::move(block));
+        return _blocks.back().get();
+    }
+
+    void MemoryAllocator::destroyBlock(MemoryBlock* pBlock)
+    {
+        for (size_t i = 0; i < _blocks.size(); i++)
+        {
+            if (_blocks[i].get() == pBlock)
+            {
+                _blocks.erase(_blocks.begin() + i);
+                return;
+            }
+        }
+    }
+
+    MemoryAllocation MemoryAllocator::allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred, bool linear)
+    {
+        std::optional<uint32_t> memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, required, preferred);
+        if (!memoryTypeIndex)
+        {
+            LOGERR("Suitable memory type not found. ");
+            exit(EXIT_FAILURE);
+        }
+
+        uint32_t heapIndex = _memoryProperties.memoryTypes[memoryTypeIndex.value()].heapIndex;
+        vk::DeviceSize blockSize = _blockSizes[heapIndex];
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        MemoryAllocation allocation;
+        allocation.memoryTypeIndex = memoryTypeIndex.value();
+        allocation.size = requirements.size;
+
+        // ブロックの半分より大きいものはブロックに入れると無駄が大きいので、専用のデバイスメモリを確保する
+        vk::DeviceSize allocationSize = std::max({ requirements.size, requirements.alignment, kMinAllocationSize });
+        if (allocationSize > blockSize / 2)
+        {
+            MemoryBlock* pBlock = createBlock(allocation.memoryTypeIndex, requirements.size, linear, true);
+            pBlock->allocationCount = 1;
+            allocation.memory = pBlock->memory.get();
+            allocation.offset = 0;
+            allocation.pMapped = pBlock->pMapped;
+            allocation.pBlock = pBlock;
+            _allocationCount++;
+            _usedBytes += requirements.size;
+            return allocation;
+        }
+
+        // バディアロケーション
+        // 要求を2のべき乗に切り上げ、それ以上の大きさの空き領域のうち一番小さいものを半分ずつに割っていく
+        uint32_t order = getOrder(allocationSize);
+        MemoryBlock* pBlock = nullptr;
+        uint32_t foundOrder = 0;
+        for (std::unique_ptr<MemoryBlock>& block : _blocks)
+        {
+            if (block->dedicated || block->memoryTypeIndex != allocation.memoryTypeIndex || block->linear != linear || block->maxOrder < order)
+            {
+                continue;
+            }
+            for (uint32_t i = order; i <= block->maxOrder; i++)
+            {
+                if (!block->freeLists[i].empty())
+                {
+                    pBlock = block.get();
+                    foundOrder = i;
+                    break;
+                }
+            }
+            if (pBlock)
+            {
+                break;
+            }
+        }
+        if (!pBlock)
+        {
+            pBlock = createBlock(allocation.memoryTypeIndex, blockSize, linear, false);
+            foundOrder = pBlock->maxOrder;
+        }
+
+        vk::DeviceSize offset = *pBlock->freeLists[foundOrder].begin();
+        pBlock->freeLists[foundOrder].erase(pBlock->freeLists[foundOrder].begin());
+        while (foundOrder > order)
+        {
+            foundOrder--;
+            pBlock->freeLists[foundOrder].insert(offset + (kMinAllocationSize << foundOrder));
+        }
+        pBlock->allocationCount++;
+
+        allocation.memory = pBlock->memory.get();
+        allocation.offset = offset;
+        allocation.pMapped = pBlock->pMapped ? static_cast<char*>(pBlock->pMapped) + offset : nullptr;
+        allocation.pBlock = pBlock;
+        allocation.order = order;
+        _allocationCount++;
+        _usedBytes += kMinAllocationSize << order;
+        return allocation;
+    }
+
+    MemoryAllocation MemoryAllocator::allocateForBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred)
+    {
+        vk::MemoryRequirements requirements = _device.getBufferMemoryRequirements(buffer);
+        MemoryAllocation allocation = allocate(requirements, required, preferred, true);
+        // bindBufferMemoryの第3引数は、デバイスメモリのどこを(先頭から何バイト目以降を)使用するか
+        // サブアロケーションではブロックの中のオフセットを指定する
+        _device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+        return allocation;
+    }
+
+    MemoryAllocation MemoryAllocator::allocateForImage(vk::Image image, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred)
+    {
+        vk::MemoryRequirements requirements = _device.getImageMemoryRequirements(image);
+        MemoryAllocation allocation = allocate(requirements, required, preferred, false);
+        _device.bindImageMemory(image, allocation.memory, allocation.offset);
+        return allocation;
+    }
+
+    void MemoryAllocator::free(MemoryAllocation& allocation)
+    {
+        if (!allocation)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        MemoryBlock* pBlock = allocation.pBlock;
+        _allocationCount--;
+        pBlock->allocationCount--;
+
+        if (pBlock->dedicated)
+        {
+            _usedBytes -= allocation.size;
+            destroyBlock(pBlock);
+            allocation = MemoryAllocation();
+            return;
+        }
+
+        _usedBytes -= kMinAllocationSize << allocation.order;
+
+        // 隣の領域(バディ)も空いていれば1つにまとめる、を繰り返す
+        // バディのオフセットは自分のオフセットの、大きさのビットを反転したもの
+        vk::DeviceSize offset = allocation.offset;
+        uint32_t order = allocation.order;
+        while (order < pBlock->maxOrder)
+        {
+            vk::DeviceSize buddyOffset = offset ^ (kMinAllocationSize << order);
+            std::set<vk::DeviceSize>::iterator buddy = pBlock->freeLists[order].find(buddyOffset);
+            if (buddy == pBlock->freeLists[order].end())
+            {
+                break;
+            }
+            pBlock->freeLists[order].erase(buddy);
+            offset = std::min(offset, buddyOffset);
+            order++;
+        }
+        pBlock->freeLists[order].insert(offset);
+
+        // 空になったブロックは、同じ種類のブロックが他にもあれば返却する
+        // 最後の1つは残しておき、確保と解放を繰り返すときにallocateMemoryが何度も呼ばれないようにする
+        if (pBlock->allocationCount == 0)
+        {
+            size_t sameKindCount = 0;
+            for (std::unique_ptr<MemoryBlock>& block : _blocks)
+            {
+                if (!block->dedicated && block->memoryTypeIndex == pBlock->memoryTypeIndex && block->linear == pBlock->linear)
+                {
+                    sameKindCount++;
+                }
+            }
+            if (sameKindCount > 1)
+            {
+                destroyBlock(pBlock);
+            }
+        }
+
+        allocation = MemoryAllocation();
+    }
+
+    void* MemoryAllocator::map(const MemoryAllocation& allocation) const
+    {
+        return allocation.pMapped;
+    }
+
+    // HOST_COHERENTでないメモリのflush/invalidateの範囲はnonCoherentAtomSizeの倍数でなければならない
+    vk::MappedMemoryRange MemoryAllocator::getAlignedRange(const MemoryAllocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+    {
+        if (size == VK_WHOLE_SIZE)
+        {
+            size = allocation.size - offset;
+        }
+
+        vk::DeviceSize begin = allocation.offset + offset;
+        vk::DeviceSize end = begin + size;
+        begin = begin / _nonCoherentAtomSize * _nonCoherentAtomSize;
+        end = (end + _nonCoherentAtomSize - 1) / _nonCoherentAtomSize * _nonCoherentAtomSize;
+        end = std::min(end, allocation.pBlock->size);
+
+        vk::MappedMemoryRange range;
+        range.memory = allocation.memory;
+        range.offset = begin;
+        range.size = end == allocation.pBlock->size ? VK_WHOLE_SIZE : end - begin;
+        return range;
+    }
+
+    void MemoryAllocator::flush(const MemoryAllocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+    {
+        if (!allocation || (_memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent))
+        {
+            return;
+        }
+        _device.flushMappedMemoryRanges({ getAlignedRange(allocation, offset, size) });
+    }
+
+    void MemoryAllocator::invalidate(const MemoryAllocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const
+    {
+        if (!allocation || (_memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent))
+        {
+            return;
+        }
+        _device.invalidateMappedMemoryRanges({ getAlignedRange(allocation, offset, size) });
+    }
+
+    MemoryAllocatorStats MemoryAllocator::getStats() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        MemoryAllocatorStats stats;
+        stats.deviceMemoryCount = _blocks.size();
+        stats.allocationCount = _allocationCount;
+        stats.usedBytes = _usedBytes;
+        for (const std::unique_ptr<MemoryBlock>& block : _blocks)
+        {
+            if (block->dedicated)
+            {
+                stats.dedicatedCount++;
+            }
+            else
+            {
+                stats.blockCount++;
+            }
+            stats.reservedBytes += block->size;
+        }
+        return stats;
+    }
+}
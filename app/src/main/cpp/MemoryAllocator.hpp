@@ -0,0 +1,101 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    struct MemoryBlock;
+
+    // MemoryAllocatorから割り当てられたデバイスメモリの範囲
+    // memoryのoffsetからsizeバイトがこの割り当ての領域
+    struct MemoryAllocation
+    {
+        vk::DeviceMemory memory;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        uint32_t memoryTypeIndex = 0;
+        // ホスト可視メモリなら永続的にマップされた、この割り当ての先頭のアドレス
+        void* pMapped = nullptr;
+
+        // 解放のときに使う内部情報
+        MemoryBlock* pBlock = nullptr;
+        uint32_t order = 0;
+
+        explicit operator bool() const { return pBlock != nullptr; }
+    };
+
+    struct MemoryAllocatorStats
+    {
+        // allocateMemoryを呼んだ回数 (maxMemoryAllocationCountと比べる値)
+        uint32_t deviceMemoryCount = 0;
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        uint32_t allocationCount = 0;
+        // デバイスから確保したバイト数と、そのうち割り当て済みのバイト数
+        vk::DeviceSize reservedBytes = 0;
+        vk::DeviceSize usedBytes = 0;
+    };
+
+    // デバイスメモリのサブアロケータ
+    //
+    // allocateMemoryは遅く、同時に確保できる数にもmaxMemoryAllocationCountという上限がある (4096程度の端末も多い)
+    // そこでメモリタイプごとに大きなブロックをまとめて確保し、その中をバディアロケーションで切り分けて使う
+    // バディアロケーションでは各領域が自分の大きさ(2のべき乗)の倍数のオフセットに置かれるので、アラインメントの要求も自然に満たせる
+    //
+    // ・ブロックの半分より大きい要求は専用のデバイスメモリを確保する
+    // ・バッファ(リニア)とイメージ(ノンリニア)は別のブロックに置く bufferImageGranularityを気にしなくてよくするため
+    // ・ホスト可視メモリのブロックは作成時にマップしたままにする mapはそのアドレスを返すだけ
+    // ・スレッドセーフ
+    //
+    // 割り当てたメモリはfreeで返す
+    // MemoryAllocatorを破棄するとまだ返されていない領域も含めて全てのデバイスメモリが解放される
+    class MemoryAllocator
+    {
+    public:
+        MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize preferredBlockSize = 64ull * 1024 * 1024);
+        ~MemoryAllocator();
+
+        MemoryAllocator(const MemoryAllocator&) = delete;
+        MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+        // memoryTypeBitsに含まれ、requiredのフラグを全て持つメモリタイプのうち、preferredのフラグを一番多く持つものを返す
+        std::optional<uint32_t> findMemoryType(uint32_t memoryTypeBits, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred = {}) const;
+
+        MemoryAllocation allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred = {}, bool linear = true);
+        // バッファのメモリ要件を調べて割り当て、bindBufferMemoryまで行う
+        MemoryAllocation allocateForBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred = {});
+        MemoryAllocation allocateForImage(vk::Image image, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred = {});
+        void free(MemoryAllocation& allocation);
+
+        // ホスト可視でないメモリならnullptr
+        void* map(const MemoryAllocation& allocation) const;
+        // 書き込んだ内容をデバイスに反映する HOST_COHERENTなメモリなら何もしない
+        void flush(const MemoryAllocation& allocation, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) const;
+        // デバイスが書き込んだ内容をホストから読めるようにする HOST_COHERENTなメモリなら何もしない
+        void invalidate(const MemoryAllocation& allocation, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE) const;
+
+        MemoryAllocatorStats getStats() const;
+        const vk::PhysicalDeviceMemoryProperties& getMemoryProperties() const { return _memoryProperties; }
+
+    private:
+        MemoryBlock* createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, bool linear, bool dedicated);
+        void destroyBlock(MemoryBlock* pBlock);
+        vk::MappedMemoryRange getAlignedRange(const MemoryAllocation& allocation, vk::DeviceSize offset, vk::DeviceSize size) const;
+
+        vk::Device _device;
+        vk::PhysicalDeviceMemoryProperties _memoryProperties;
+        vk::DeviceSize _nonCoherentAtomSize;
+        uint32_t _maxMemoryAllocationCount;
+        std::vector<vk::DeviceSize> _blockSizes;
+
+        mutable std::mutex _mutex;
+        std::vector<std::unique_ptr<MemoryBlock>> _blocks;
+        uint32_t _allocationCount = 0;
+        vk::DeviceSize _usedBytes = 0;
+    };
+}
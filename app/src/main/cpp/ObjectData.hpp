@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// 頂点シェーダーのプッシュ定数ブロックと同じ並び
+//
+// layout(push_constant) uniform ObjectData { int id; } objectData;
+// idはSceneData::mvpMatrixのどの行列を使うか
+struct ObjectData {
+    int32_t id;
+};
@@ -0,0 +1,98 @@
+#include "ParallelCommandRecorder.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+#include <future>
+
+namespace Vulkan_Test
+{
+    ParallelCommandRecorder::ParallelCommandRecorder(vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount, ThreadPool& threadPool)
+        : _threadPool(threadPool)
+    {
+        for (uint32_t i = 0; i < getMaxSliceCount(); i++)
+        {
+            _slicePools.push_back(std::make_unique<FrameCommandPools>(device, queueFamilyIndex, frameCount));
+        }
+    }
+
+    void ParallelCommandRecorder::beginFrame(uint32_t frameIndex)
+    {
+        // このスロットのコマンドバッファは実行し終わっているので、プールごとリセットすれば中のバッファも全て記録し直せる
+        for (std::unique_ptr<FrameCommandPools>& pools : _slicePools)
+        {
+            pools->beginFrame(frameIndex);
+        }
+    }
+
+    const std::vector<vk::CommandBuffer>& ParallelCommandRecorder::record(const vk::CommandBufferInheritanceInfo& inheritance, size_t itemCount,
+                                                                           size_t minItemsPerSlice, const RecordFunction& recordSlice)
+    {
+        _recorded.clear();
+        if (itemCount == 0)
+        {
+            return _recorded;
+        }
+
+        size_t sliceCount = std::clamp<size_t>(itemCount / std::max<size_t>(minItemsPerSlice, 1), 1, getMaxSliceCount());
+        size_t itemsPerSlice = (itemCount + sliceCount - 1) / sliceCount;
+
+        // コマンドバッファはレンダースレッドで取っておく (FrameCommandPoolsはスレッドセーフではない)
+        for (size_t i = 0; i < sliceCount; i++)
+        {
+            _recorded.push_back(_slicePools[i]->acquire(vk::CommandBufferLevel::eSecondary));
+        }
+
+        // 継承情報はポインタで渡るので、全てのスライスの記録が終わるまでここに置いておく
+        vk::CommandBufferInheritanceInfo inheritanceInfo = inheritance;
+        auto recordOne = [&](size_t sliceIndex) {
+            TRACE_SCOPE("record slice");
+            size_t begin = sliceIndex * itemsPerSlice;
+            size_t end = std::min(begin + itemsPerSlice, itemCount);
+
+            vk::CommandBufferBeginInfo beginInfo;
+            // レンダーパスの中で実行されるセカンダリコマンドバッファ
+            beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+            vk::CommandBuffer commandBuffer = _recorded[sliceIndex];
+            commandBuffer.begin(beginInfo);
+            if (begin < end)
+            {
+                recordSlice(commandBuffer, begin, end);
+            }
+            commandBuffer.end();
+        };
+
+        // ワーカーはrecordOneとこの関数のローカル変数を参照しているので、例外で抜けるときも全てのワーカーが終わるまで待つ
+        std::vector<std::future<void>> futures;
+        futures.reserve(sliceCount - 1);
+        try
+        {
+            for (size_t i = 0; i + 1 < sliceCount; i++)
+            {
+                futures.push_back(_threadPool.submit([&recordOne, i]() { recordOne(i); }));
+            }
+            recordOne(sliceCount - 1);
+        }
+        catch (...)
+        {
+            for (std::future<void>& future : futures)
+            {
+                future.wait();
+            }
+            throw;
+        }
+
+        for (std::future<void>& future : futures)
+        {
+            future.wait();
+        }
+        for (std::future<void>& future : futures)
+        {
+            // ワーカーで投げられた例外はここで投げ直される
+            future.get();
+        }
+
+        return _recorded;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "FrameCommandPools.hpp"
+#include "ThreadPool.hpp"
+
+namespace Vulkan_Test
+{
+    // ドローのリストを区切り、ワーカースレッドでセカンダリコマンドバッファに並列に記録する
+    //
+    // コマンドプールは同時に1つのスレッドからしか触れないので、区切り(スライス)ごとにFrameCommandPoolsを持つ
+    // 1つのスライスは1つの仕事として1つのスレッドだけが記録するので、プールにロックは要らない
+    // 最後のスライスはレンダースレッド自身が記録し、待っている間もコアを遊ばせない
+    //
+    // 使い方
+    //   1. フレームスロットのフェンスを待った後に beginFrame(スロット番号) (そのスロットのプールをまとめてリセットする)
+    //   2. beginRenderPassをeSecondaryCommandBuffersで始め、record()が返したコマンドバッファをexecuteCommandsに渡す
+    class ParallelCommandRecorder
+    {
+    public:
+        // recordSlice(コマンドバッファ, 最初の番号, 最後の次の番号) はワーカースレッドから同時に呼ばれる
+        using RecordFunction = std::function<void(vk::CommandBuffer, size_t, size_t)>;
+
+        ParallelCommandRecorder(vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount, ThreadPool& threadPool);
+
+        ParallelCommandRecorder(const ParallelCommandRecorder&) = delete;
+        ParallelCommandRecorder& operator=(const ParallelCommandRecorder&) = delete;
+
+        void beginFrame(uint32_t frameIndex);
+
+        // itemCount個をminItemsPerSlice個以上ずつのスライスに分けて記録し、executeCommandsに渡す順に並べて返す
+        // 全てのスライスの記録が終わるまで戻らない
+        const std::vector<vk::CommandBuffer>& record(const vk::CommandBufferInheritanceInfo& inheritance, size_t itemCount,
+                                                     size_t minItemsPerSlice, const RecordFunction& recordSlice);
+
+        uint32_t getMaxSliceCount() const { return static_cast<uint32_t>(_threadPool.getThreadCount() + 1); }
+
+    private:
+        ThreadPool& _threadPool;
+
+        // スライスごとの、フレームスロットごとのプール
+        std::vector<std::unique_ptr<FrameCommandPools>> _slicePools;
+        std::vector<vk::CommandBuffer> _recorded;
+    };
+}
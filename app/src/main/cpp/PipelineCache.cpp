@@ -0,0 +1,144 @@
+#include "PipelineCache.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace Vulkan_Test
+{
+    PipelineCache::PipelineCache(vk::PhysicalDevice physicalDevice, vk::Device device, std::string path)
+        : _device(device), _deviceProperties(physicalDevice.getProperties()), _path(std::move(path))
+    {
+        TRACE_SCOPE("load pipeline cache");
+
+        std::vector<uint8_t> initialData = load();
+
+        vk::PipelineCacheCreateInfo cacheCreateInfo;
+        cacheCreateInfo.initialDataSize = initialData.size();
+        cacheCreateInfo.pInitialData = initialData.data();
+        _cache = _device.createPipelineCacheUnique(cacheCreateInfo);
+
+        _stats.loadedBytes = initialData.size();
+        _savedSize = initialData.size();
+        _savedHash = hashFnv1a(initialData.data(), initialData.size());
+    }
+
+    std::vector<uint8_t> PipelineCache::load()
+    {
+        if (_path.empty())
+        {
+            return {};
+        }
+
+        std::FILE* pFile = std::fopen(_path.c_str(), "rb");
+        if (!pFile)
+        {
+            _stats.rejectReason = "no cache file";
+            return {};
+        }
+
+        FileHeader header = {};
+        std::vector<uint8_t> data;
+        bool readHeader = std::fread(&header, sizeof(header), 1, pFile) == 1;
+        if (readHeader && header.magic == kFileMagic && header.version == kFileVersion && header.dataSize <= 256ull * 1024 * 1024)
+        {
+            data.resize(header.dataSize);
+            if (std::fread(data.data(), 1, data.size(), pFile) != data.size())
+            {
+                data.clear();
+            }
+        }
+        std::fclose(pFile);
+
+        if (data.empty() || hashFnv1a(data.data(), data.size()) != header.dataHash)
+        {
+            _stats.rejectReason = "corrupted cache file";
+            return {};
+        }
+        if (!isCompatible(data))
+        {
+            return {};
+        }
+        return data;
+    }
+
+    bool PipelineCache::isCompatible(const std::vector<uint8_t>& data)
+    {
+        // vkGetPipelineCacheDataが返すデータの先頭はVkPipelineCacheHeaderVersionOne
+        VkPipelineCacheHeaderVersionOne header = {};
+        if (data.size() < sizeof(header))
+        {
+            _stats.rejectReason = "cache data too small";
+            return false;
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        if (header.headerSize < sizeof(header) || header.headerSize > data.size() ||
+            header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        {
+            _stats.rejectReason = "unknown cache header";
+            return false;
+        }
+        if (header.vendorID != _deviceProperties.vendorID || header.deviceID != _deviceProperties.deviceID)
+        {
+            _stats.rejectReason = "cache was created on another device";
+            return false;
+        }
+        if (std::memcmp(header.pipelineCacheUUID, _deviceProperties.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0)
+        {
+            _stats.rejectReason = "cache was created by another driver version";
+            return false;
+        }
+        return true;
+    }
+
+    bool PipelineCache::save()
+    {
+        if (_path.empty())
+        {
+            return false;
+        }
+
+        TRACE_SCOPE("save pipeline cache");
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        std::vector<uint8_t> data = _device.getPipelineCacheData(_cache.get());
+        uint64_t dataHash = hashFnv1a(data.data(), data.size());
+        if (data.empty() || (data.size() == _savedSize && dataHash == _savedHash))
+        {
+            return true;
+        }
+
+        // 一時ファイルに全て書いてディスクに反映させてから置き換える
+        // renameは置き換え先が既にあっても1回の操作で入れ替わるので、読む側が書きかけのファイルを見ることはない
+        std::string tempPath = _path + ".tmp";
+        std::FILE* pFile = std::fopen(tempPath.c_str(), "wb");
+        if (!pFile)
+        {
+            LOGERR("PipelineCache: failed to open " << tempPath);
+            return false;
+        }
+
+        FileHeader header = { kFileMagic, kFileVersion, data.size(), dataHash };
+        bool written = std::fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+                       std::fwrite(data.data(), 1, data.size(), pFile) == data.size() &&
+                       std::fflush(pFile) == 0 &&
+                       fsync(fileno(pFile)) == 0;
+        written = std::fclose(pFile) == 0 && written;
+
+        if (!written || std::rename(tempPath.c_str(), _path.c_str()) != 0)
+        {
+            LOGERR("PipelineCache: failed to write " << _path);
+            std::remove(tempPath.c_str());
+            return false;
+        }
+
+        _savedSize = data.size();
+        _savedHash = dataHash;
+        _stats.savedBytes = data.size();
+        LOG("PipelineCache: saved " << data.size() << " bytes to " << _path);
+        return true;
+    }
+}
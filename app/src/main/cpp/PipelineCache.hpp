@@ -0,0 +1,74 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // ディスクに保存するパイプラインキャッシュ
+    //
+    // 起動時にファイルから読んだデータでvk::PipelineCacheを作り、終了時やバックグラウンドに回ったときに書き戻す
+    // 2回目以降の起動ではシェーダーのコンパイル結果がキャッシュから使われるので、パイプラインの作成が速くなる
+    //
+    // ・キャッシュのデータは作ったドライバでしか使えない
+    //   ヘッダのvendorID・deviceID・pipelineCacheUUIDが今のデバイスと違えば読まずに捨てる (ドライバの更新でUUIDが変わる)
+    // ・ファイルには独自のヘッダ(データの大きさとハッシュ)をつけ、壊れたデータをドライバに渡さないようにする
+    // ・書き込みは一時ファイルに書いてからrenameで置き換えるので、途中で落ちても前のファイルが残る
+    // ・PipelineCompilerの全てのワーカースレッドがこの1つのキャッシュを使う
+    //   (VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BITをつけていないので、同期はドライバの中で行われる)
+    class PipelineCache
+    {
+    public:
+        struct Stats
+        {
+            // ファイルから読んで使ったデータの大きさ (使わなかったら0)
+            size_t loadedBytes = 0;
+            // 読んだが使わなかった理由 (読めなかった・使えなかったとき)
+            std::string rejectReason;
+            size_t savedBytes = 0;
+        };
+
+        // pathが空ならファイルには読み書きしない
+        PipelineCache(vk::PhysicalDevice physicalDevice, vk::Device device, std::string path);
+
+        PipelineCache(const PipelineCache&) = delete;
+        PipelineCache& operator=(const PipelineCache&) = delete;
+
+        vk::PipelineCache get() const { return _cache.get(); }
+
+        // 内容が読んだとき・前回保存したときから変わっていればファイルに書く
+        bool save();
+
+        const Stats& getStats() const { return _stats; }
+        const std::string& getPath() const { return _path; }
+
+    private:
+        // ファイルの先頭につける独自のヘッダ
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t dataSize;
+            uint64_t dataHash;
+        };
+
+        static constexpr uint32_t kFileMagic = 0x43505456; // "VTPC"
+        static constexpr uint32_t kFileVersion = 1;
+
+        std::vector<uint8_t> load();
+        bool isCompatible(const std::vector<uint8_t>& data);
+
+        vk::Device _device;
+        vk::PhysicalDeviceProperties _deviceProperties;
+        std::string _path;
+
+        // saveが複数のスレッドから同時に呼ばれても、ファイルと保存済みの大きさ・ハッシュが食い違わないようにロックする
+        std::mutex _mutex;
+        vk::UniquePipelineCache _cache;
+        uint64_t _savedHash = 0;
+        size_t _savedSize = 0;
+        Stats _stats;
+    };
+}
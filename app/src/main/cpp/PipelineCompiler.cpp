@@ -0,0 +1,154 @@
+#include "PipelineCompiler.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+#include <chrono>
+
+namespace Vulkan_Test
+{
+    vk::UniquePipeline createGraphicsPipeline(vk::Device device, vk::PipelineCache pipelineCache, const PipelineDesc& desc)
+    {
+        // 頂点入力デスクリプションはvk::PipelineVertexInputStateCreateInfo構造体に設定する
+        vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+        vertexInputInfo.vertexBindingDescriptionCount = desc.vertexBindingCount;
+        vertexInputInfo.pVertexBindingDescriptions = desc.vertexBindings.data();
+        vertexInputInfo.vertexAttributeDescriptionCount = desc.vertexAttributeCount;
+        vertexInputInfo.pVertexAttributeDescriptions = desc.vertexAttributes.data();
+
+        // 深度バッファを有効化するための設定を入れる構造体
+        vk::PipelineDepthStencilStateCreateInfo depthstencil;
+        depthstencil.depthTestEnable = desc.depthTestEnable;
+        depthstencil.depthWriteEnable = desc.depthWriteEnable;
+        depthstencil.depthCompareOp = vk::CompareOp::eLess;
+        depthstencil.stencilTestEnable = false;
+
+        // ビューポートとシザーは動的ステートにして、描画するときにコマンドで設定する
+        // 数だけをここで決める (値は無視されるのでポインタは要らない)
+        vk::PipelineViewportStateCreateInfo viewportState;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        std::vector<vk::DynamicState> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+        // VK_EXT_extended_dynamic_stateが使えるときは、こちらもコマンドで設定する
+        if (desc.extendedDynamicState)
+        {
+            dynamicStates.push_back(vk::DynamicState::eCullModeEXT);
+            dynamicStates.push_back(vk::DynamicState::eFrontFaceEXT);
+            dynamicStates.push_back(vk::DynamicState::ePrimitiveTopologyEXT);
+            dynamicStates.push_back(vk::DynamicState::eDepthTestEnableEXT);
+            dynamicStates.push_back(vk::DynamicState::eDepthWriteEnableEXT);
+            dynamicStates.push_back(vk::DynamicState::eDepthCompareOpEXT);
+        }
+        vk::PipelineDynamicStateCreateInfo dynamicState;
+        dynamicState.dynamicStateCount = dynamicStates.size();
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
+        inputAssembly.topology = desc.topology;
+        inputAssembly.primitiveRestartEnable = false;
+
+        vk::PipelineRasterizationStateCreateInfo rasterizer;
+        rasterizer.depthClampEnable = false;
+        rasterizer.rasterizerDiscardEnable = false;
+        rasterizer.polygonMode = desc.polygonMode;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = desc.cullMode;
+        rasterizer.frontFace = desc.frontFace;
+        rasterizer.depthBiasEnable = false;
+
+        vk::PipelineMultisampleStateCreateInfo multisample;
+        multisample.sampleShadingEnable = false;
+        multisample.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+        vk::PipelineColorBlendAttachmentState blendattachment[1];
+        blendattachment[0].colorWriteMask =
+                vk::ColorComponentFlagBits::eA |
+                vk::ColorComponentFlagBits::eR |
+                vk::ColorComponentFlagBits::eG |
+                vk::ColorComponentFlagBits::eB;
+        blendattachment[0].blendEnable = desc.blendEnable;
+        // 有効にしたときは普通のアルファブレンド
+        blendattachment[0].srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+        blendattachment[0].dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        blendattachment[0].colorBlendOp = vk::BlendOp::eAdd;
+        blendattachment[0].srcAlphaBlendFactor = vk::BlendFactor::eOne;
+        blendattachment[0].dstAlphaBlendFactor = vk::BlendFactor::eZero;
+        blendattachment[0].alphaBlendOp = vk::BlendOp::eAdd;
+
+        vk::PipelineColorBlendStateCreateInfo blend;
+        blend.logicOpEnable = false;
+        blend.attachmentCount = 1;
+        blend.pAttachments = blendattachment;
+
+        vk::PipelineShaderStageCreateInfo shaderStage[2];
+        shaderStage[0] = desc.vertexShader->getStageCreateInfo();
+        shaderStage[1] = desc.fragmentShader->getStageCreateInfo();
+
+        vk::GraphicsPipelineCreateInfo pipelineCreateInfo;
+        pipelineCreateInfo.pViewportState = &viewportState;
+        pipelineCreateInfo.pVertexInputState = &vertexInputInfo;
+        pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+        pipelineCreateInfo.pRasterizationState = &rasterizer;
+        pipelineCreateInfo.pMultisampleState = &multisample;
+        pipelineCreateInfo.pColorBlendState = &blend;
+        pipelineCreateInfo.pDepthStencilState = &depthstencil;
+        pipelineCreateInfo.pDynamicState = &dynamicState;
+        pipelineCreateInfo.layout = desc.layout;
+        pipelineCreateInfo.renderPass = desc.renderPass;
+        pipelineCreateInfo.subpass = desc.subpass;
+        pipelineCreateInfo.stageCount = std::size(shaderStage);
+        pipelineCreateInfo.pStages = shaderStage;
+
+        return device.createGraphicsPipelineUnique(pipelineCache, pipelineCreateInfo).value;
+    }
+
+    vk::Pipeline PipelineHandle::wait() const
+    {
+        if (!_state)
+        {
+            return vk::Pipeline();
+        }
+        _state->done.wait();
+        return _state->pipeline.get();
+    }
+
+    PipelineCompiler::PipelineCompiler(vk::Device device, PipelineCache& pipelineCache, ThreadPool& threadPool)
+        : _device(device), _pipelineCache(pipelineCache), _threadPool(threadPool)
+    {
+    }
+
+    PipelineHandle PipelineCompiler::compile(const PipelineDesc& desc, std::string name)
+    {
+        PipelineHandle handle;
+        handle._state = std::make_shared<PipelineHandle::State>();
+        handle._state->name = std::move(name);
+
+        std::shared_ptr<PipelineHandle::State> state = handle._state;
+        _pendingCount.fetch_add(1, std::memory_order_relaxed);
+        handle._state->done = _threadPool.submit([this, state, desc]() {
+            TRACE_SCOPE("compile pipeline");
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            try
+            {
+                state->pipeline = createGraphicsPipeline(_device, _pipelineCache.get(), desc);
+            }
+            catch (vk::SystemError& error)
+            {
+                LOGERR("PipelineCompiler: failed to compile " << state->name << " : " << error.what());
+            }
+            state->compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            LOG("Compiled pipeline " << state->name << " : " << state->compileMs << " ms");
+
+            state->ready.store(true, std::memory_order_release);
+            _pendingCount.fetch_sub(1, std::memory_order_relaxed);
+        }).share();
+
+        return handle;
+    }
+
+    void PipelineCompiler::waitIdle()
+    {
+        _threadPool.waitIdle();
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "PipelineCache.hpp"
+#include "PipelineDesc.hpp"
+#include "ThreadPool.hpp"
+
+namespace Vulkan_Test
+{
+    // descからその場で(呼び出したスレッドで)パイプラインを作る
+    vk::UniquePipeline createGraphicsPipeline(vk::Device device, vk::PipelineCache pipelineCache, const PipelineDesc& desc);
+
+    // PipelineCompilerが返す、コンパイル中またはコンパイル済みのパイプライン
+    // コピーしても同じパイプラインを指す 最後のハンドルが破棄されるとパイプラインも破棄される
+    class PipelineHandle
+    {
+    public:
+        PipelineHandle() = default;
+
+        explicit operator bool() const { return static_cast<bool>(_state); }
+
+        // コンパイルが終わっていればtrue (失敗した場合も含む) 待たない
+        bool isReady() const { return _state && _state->ready.load(std::memory_order_acquire); }
+        // コンパイルが終わっていなければ、または失敗していれば空のハンドルを返す 待たない
+        vk::Pipeline get() const { return isReady() ? _state->pipeline.get() : vk::Pipeline(); }
+        // コンパイルが終わるまで待って返す
+        vk::Pipeline wait() const;
+
+        double getCompileMs() const { return isReady() ? _state->compileMs : 0.0; }
+
+    private:
+        friend class PipelineCompiler;
+
+        struct State
+        {
+            std::string name;
+            vk::UniquePipeline pipeline;
+            double compileMs = 0.0;
+            std::atomic<bool> ready{ false };
+            std::shared_future<void> done;
+        };
+
+        std::shared_ptr<State> _state;
+    };
+
+    // パイプラインをワーカースレッドでコンパイルする
+    //
+    // compileはすぐに戻り、ハンドルを返す 描画する側は毎フレームhandle.get()を見て、まだ空ならそのドローを飛ばす
+    // マテリアルが途中で増えても、レンダースレッドがシェーダーのコンパイルを待って止まることがない
+    //
+    // 全てのワーカーは同じパイプラインキャッシュを使う (vkCreateGraphicsPipelinesのキャッシュはドライバの中で同期される)
+    class PipelineCompiler
+    {
+    public:
+        PipelineCompiler(vk::Device device, PipelineCache& pipelineCache, ThreadPool& threadPool);
+
+        PipelineCompiler(const PipelineCompiler&) = delete;
+        PipelineCompiler& operator=(const PipelineCompiler&) = delete;
+
+        // nameはログに出す名前
+        PipelineHandle compile(const PipelineDesc& desc, std::string name);
+
+        // 投げた全てのコンパイルが終わるまで待つ
+        void waitIdle();
+
+        uint32_t getPendingCount() const { return _pendingCount.load(std::memory_order_relaxed); }
+
+    private:
+        vk::Device _device;
+        PipelineCache& _pipelineCache;
+        ThreadPool& _threadPool;
+        std::atomic<uint32_t> _pendingCount{ 0 };
+    };
+}
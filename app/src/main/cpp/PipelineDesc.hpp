@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "ShaderRegistry.hpp"
+#include "Utility.hpp"
+
+namespace Vulkan_Test
+{
+    // グラフィックスパイプラインを作るのに必要な状態を、値として1つにまとめたもの
+    //
+    // ・固定長のメンバだけで持つので、コピーが安く、ハッシュと比較がそのままできる
+    //   (PipelineObjectCacheのキーにして、同じ組み合わせを2回コンパイルしないようにする)
+    // ・vk::GraphicsPipelineCreateInfoはポインタだらけで別のスレッドに渡しにくいので、これを渡してワーカーで組み立てる
+    // ・ビューポートとシザーは動的ステートなので含まない (描画先の大きさが変わってもパイプラインはそのまま使える)
+    //
+    // シェーダー・パイプラインレイアウト・レンダーパスはハンドルで持つので、それを使うパイプラインより長生きさせる
+    struct PipelineDesc
+    {
+        static constexpr uint32_t kMaxVertexBindings = 4;
+        static constexpr uint32_t kMaxVertexAttributes = 8;
+
+        const Shader* vertexShader = nullptr;
+        const Shader* fragmentShader = nullptr;
+
+        std::array<vk::VertexInputBindingDescription, kMaxVertexBindings> vertexBindings = {};
+        std::array<vk::VertexInputAttributeDescription, kMaxVertexAttributes> vertexAttributes = {};
+        uint8_t vertexBindingCount = 0;
+        uint8_t vertexAttributeCount = 0;
+
+        vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+        vk::PolygonMode polygonMode = vk::PolygonMode::eFill;
+        vk::CullModeFlags cullMode = vk::CullModeFlagBits::eBack;
+        vk::FrontFace frontFace = vk::FrontFace::eClockwise;
+        bool depthTestEnable = false;
+        bool depthWriteEnable = false;
+        bool blendEnable = false;
+
+        // trueなら、カリング・表裏・トポロジー・深度テスト/書き込みを動的ステートにする (ExtendedDynamicStateを参照)
+        // そのときパイプラインに入る上の値は使われないので、withExtendedDynamicState()で揃えたものをキーにする
+        bool extendedDynamicState = false;
+
+        vk::PipelineLayout layout;
+        vk::RenderPass renderPass;
+        uint32_t subpass = 0;
+
+        // 入りきらなければfalse
+        bool setVertexInput(const std::vector<vk::VertexInputBindingDescription>& bindings,
+                            const std::vector<vk::VertexInputAttributeDescription>& attributes)
+        {
+            if (bindings.size() > kMaxVertexBindings || attributes.size() > kMaxVertexAttributes)
+            {
+                return false;
+            }
+            vertexBindings = {};
+            vertexAttributes = {};
+            std::copy(bindings.begin(), bindings.end(), vertexBindings.begin());
+            std::copy(attributes.begin(), attributes.end(), vertexAttributes.begin());
+            vertexBindingCount = static_cast<uint8_t>(bindings.size());
+            vertexAttributeCount = static_cast<uint8_t>(attributes.size());
+            return true;
+        }
+
+        // 動的ステートにする値を決まった値に揃えたコピーを返す
+        // 動的ステートだけが違うdesc同士が同じキーになり、パイプラインを1つにまとめられる
+        // トポロジーは同じ種類(点・線・三角形)の中でしか切り替えられないので、種類ごとの代表に揃える
+        PipelineDesc withExtendedDynamicState() const
+        {
+            PipelineDesc desc = *this;
+            desc.extendedDynamicState = true;
+            desc.cullMode = vk::CullModeFlagBits::eNone;
+            desc.frontFace = vk::FrontFace::eCounterClockwise;
+            desc.depthTestEnable = false;
+            desc.depthWriteEnable = false;
+            switch (topology)
+            {
+            case vk::PrimitiveTopology::ePointList:
+                desc.topology = vk::PrimitiveTopology::ePointList;
+                break;
+            case vk::PrimitiveTopology::eLineList:
+            case vk::PrimitiveTopology::eLineStrip:
+            case vk::PrimitiveTopology::eLineListWithAdjacency:
+            case vk::PrimitiveTopology::eLineStripWithAdjacency:
+                desc.topology = vk::PrimitiveTopology::eLineList;
+                break;
+            case vk::PrimitiveTopology::ePatchList:
+                desc.topology = vk::PrimitiveTopology::ePatchList;
+                break;
+            default:
+                desc.topology = vk::PrimitiveTopology::eTriangleList;
+                break;
+            }
+            return desc;
+        }
+
+        // 構造体のパディングを含めないよう、メンバごとにハッシュする
+        uint64_t hash() const
+        {
+            uint64_t h = hashFnv1a(&vertexShader, sizeof(vertexShader));
+            h = hashFnv1a(&fragmentShader, sizeof(fragmentShader), h);
+            h = hashFnv1a(vertexBindings.data(), sizeof(vk::VertexInputBindingDescription) * vertexBindingCount, h);
+            h = hashFnv1a(vertexAttributes.data(), sizeof(vk::VertexInputAttributeDescription) * vertexAttributeCount, h);
+            uint32_t state[] = {
+                static_cast<uint32_t>(topology),
+                static_cast<uint32_t>(polygonMode),
+                static_cast<uint32_t>(cullMode),
+                static_cast<uint32_t>(frontFace),
+                static_cast<uint32_t>(depthTestEnable) | static_cast<uint32_t>(depthWriteEnable) << 1 |
+                    static_cast<uint32_t>(blendEnable) << 2 | static_cast<uint32_t>(extendedDynamicState) << 3,
+                subpass,
+            };
+            h = hashFnv1a(state, sizeof(state), h);
+            VkPipelineLayout rawLayout = layout;
+            VkRenderPass rawRenderPass = renderPass;
+            h = hashFnv1a(&rawLayout, sizeof(rawLayout), h);
+            return hashFnv1a(&rawRenderPass, sizeof(rawRenderPass), h);
+        }
+
+        bool operator==(const PipelineDesc& other) const
+        {
+            return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+                   vertexBindingCount == other.vertexBindingCount && vertexAttributeCount == other.vertexAttributeCount &&
+                   std::equal(vertexBindings.begin(), vertexBindings.begin() + vertexBindingCount, other.vertexBindings.begin()) &&
+                   std::equal(vertexAttributes.begin(), vertexAttributes.begin() + vertexAttributeCount, other.vertexAttributes.begin()) &&
+                   topology == other.topology && polygonMode == other.polygonMode && cullMode == other.cullMode &&
+                   frontFace == other.frontFace && depthTestEnable == other.depthTestEnable &&
+                   depthWriteEnable == other.depthWriteEnable && blendEnable == other.blendEnable &&
+                   extendedDynamicState == other.extendedDynamicState &&
+                   layout == other.layout && renderPass == other.renderPass && subpass == other.subpass;
+        }
+
+        bool operator!=(const PipelineDesc& other) const { return !(*this == other); }
+
+        struct Hasher
+        {
+            size_t operator()(const PipelineDesc& desc) const { return static_cast<size_t>(desc.hash()); }
+        };
+    };
+}
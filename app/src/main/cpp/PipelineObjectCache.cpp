@@ -0,0 +1,56 @@
+#include "PipelineObjectCache.hpp"
+#include "Utility.hpp"
+
+#include <mutex>
+
+namespace Vulkan_Test
+{
+    PipelineObjectCache::PipelineObjectCache(PipelineCompiler& compiler)
+        : _compiler(compiler)
+    {
+    }
+
+    PipelineHandle PipelineObjectCache::get(const PipelineDesc& desc, const char* name)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto it = _pipelines.find(desc);
+            if (it != _pipelines.end())
+            {
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        // ロックを取り直す間に別のスレッドが同じdescを追加しているかもしれない
+        auto it = _pipelines.find(desc);
+        if (it != _pipelines.end())
+        {
+            _hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second;
+        }
+
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        PipelineHandle handle = _compiler.compile(desc, name);
+        _pipelines.emplace(desc, handle);
+        LOGDEBUG("PipelineObjectCache: new pipeline " << name << " (hash " << std::hex << desc.hash() << std::dec << ")");
+        return handle;
+    }
+
+    void PipelineObjectCache::clear()
+    {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _pipelines.clear();
+    }
+
+    PipelineObjectCache::Stats PipelineObjectCache::getStats() const
+    {
+        Stats stats;
+        stats.hits = _hits.load(std::memory_order_relaxed);
+        stats.misses = _misses.load(std::memory_order_relaxed);
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        stats.pipelineCount = _pipelines.size();
+        return stats;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include "PipelineCompiler.hpp"
+#include "PipelineDesc.hpp"
+
+namespace Vulkan_Test
+{
+    // PipelineDescをキーにして、作ったパイプラインを使い回す
+    //
+    // 同じdescが来たら、コンパイル中であっても同じハンドルを返す (2回コンパイルしない)
+    // 見つからなければPipelineCompilerにコンパイルを投げ、そのハンドルを覚えておく
+    // 探すのは毎フレームいろいろなスレッドから呼ばれるので読み込みは共有ロック、追加するときだけ排他ロックにする
+    //
+    // ディスクのPipelineCache(ドライバのキャッシュ)とは別物で、こちらはvk::Pipelineそのものを持つ
+    class PipelineObjectCache
+    {
+    public:
+        struct Stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            size_t pipelineCount = 0;
+        };
+
+        explicit PipelineObjectCache(PipelineCompiler& compiler);
+
+        PipelineObjectCache(const PipelineObjectCache&) = delete;
+        PipelineObjectCache& operator=(const PipelineObjectCache&) = delete;
+
+        // nameは初めてコンパイルするときのログに使う
+        PipelineHandle get(const PipelineDesc& desc, const char* name);
+
+        // 持っているパイプラインを全て捨てる (レンダーパスやレイアウトを作り直したとき用)
+        // 描画中のコマンドバッファが使っていないことを確かめてから呼ぶ
+        void clear();
+
+        Stats getStats() const;
+
+    private:
+        PipelineCompiler& _compiler;
+
+        mutable std::shared_mutex _mutex;
+        std::unordered_map<PipelineDesc, PipelineHandle, PipelineDesc::Hasher> _pipelines;
+
+        std::atomic<uint64_t> _hits{ 0 };
+        std::atomic<uint64_t> _misses{ 0 };
+    };
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // Rendererが動く環境の違いを吸収するもの
+    //
+    // Rendererはインスタンスの拡張機能・サーフェスの作り方・アセットの読み方をここから受け取る
+    // サーフェスを持たないプラットフォーム(ヘッドレス)では、Rendererはスワップチェーンの代わりに
+    // オフスクリーンのイメージに描画し、表示の代わりに読み戻しができるようになる
+    class Platform
+    {
+    public:
+        virtual ~Platform() = default;
+
+        // インスタンスの作成時に有効化する拡張機能
+        virtual std::vector<const char*> getRequiredInstanceExtensions() const = 0;
+
+        // falseならサーフェスもスワップチェーンも作らない
+        virtual bool hasSurface() const = 0;
+        virtual vk::UniqueSurfaceKHR createSurface(vk::Instance instance) = 0;
+
+        // サーフェスを持たないときの描画先の大きさ
+        virtual vk::Extent2D getOffscreenExtent() const { return vk::Extent2D(0, 0); }
+
+        // シェーダーなどアプリに同梱したファイルを読む 見つからなければnullopt
+        virtual std::optional<std::vector<char>> readAsset(const std::string& name) = 0;
+
+        // パイプラインキャッシュなど、次の起動でも使うファイルを書くディレクトリ 空なら保存しない
+        virtual std::string getCacheDirectory() const { return std::string(); }
+    };
+}
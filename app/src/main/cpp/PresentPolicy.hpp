@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vulkan_Test
+{
+    // スワップチェーンのプレゼントモードとイメージ数の選び方
+    //
+    // 候補を優先順に並べておき、サーフェスが対応している最初のものを使う
+    // イメージ数は minImageCount + extraImages と minimumImages の大きい方を、maxImageCountに収まるように丸める
+    // FIFOはどのサーフェスでも必ず使えるので、どの候補も使えなかったときはFIFOにする
+    //
+    // lowLatency: MAILBOXで常に最新のフレームを表示する 使えなければイメージ数最小のFIFO
+    // throughput: FIFOのトリプルバッファリング GPUが表示待ちで止まりにくい
+    // powerSaver: イメージ数最小のFIFO 垂直同期より速く描かないので消費電力が少ない
+    struct PresentPolicy
+    {
+        struct Candidate
+        {
+            vk::PresentModeKHR presentMode;
+            uint32_t extraImages;
+            uint32_t minimumImages;
+        };
+
+        const char* name;
+        std::vector<Candidate> candidates;
+
+        static PresentPolicy lowLatency()
+        {
+            return PresentPolicy{ "low_latency", {
+                { vk::PresentModeKHR::eMailbox, 1, 3 },
+                { vk::PresentModeKHR::eFifo, 0, 0 },
+            } };
+        }
+
+        static PresentPolicy throughput()
+        {
+            return PresentPolicy{ "throughput", {
+                { vk::PresentModeKHR::eFifo, 0, 3 },
+            } };
+        }
+
+        static PresentPolicy powerSaver()
+        {
+            return PresentPolicy{ "power_saver", {
+                { vk::PresentModeKHR::eFifo, 0, 0 },
+            } };
+        }
+
+        // 設定ファイルやシステムプロパティの文字列から選ぶ
+        // 再コンパイルせずに端末のティアごとに切り替えられるようにするため
+        static std::optional<PresentPolicy> fromName(std::string_view policyName)
+        {
+            for (PresentPolicy policy : { lowLatency(), throughput(), powerSaver() })
+            {
+                if (policyName == policy.name)
+                {
+                    return policy;
+                }
+            }
+            return std::nullopt;
+        }
+
+        Candidate select(const std::vector<vk::PresentModeKHR>& presentModes) const
+        {
+            for (const Candidate& candidate : candidates)
+            {
+                if (std::find(presentModes.begin(), presentModes.end(), candidate.presentMode) != presentModes.end())
+                {
+                    return candidate;
+                }
+            }
+            return Candidate{ vk::PresentModeKHR::eFifo, 0, 0 };
+        }
+
+        vk::PresentModeKHR selectPresentMode(const std::vector<vk::PresentModeKHR>& presentModes) const
+        {
+            return select(presentModes).presentMode;
+        }
+
+        uint32_t selectImageCount(const std::vector<vk::PresentModeKHR>& presentModes, const vk::SurfaceCapabilitiesKHR& surfaceCapabilities) const
+        {
+            Candidate candidate = select(presentModes);
+            uint32_t imageCount = std::max(surfaceCapabilities.minImageCount + candidate.extraImages, candidate.minimumImages);
+            // maxImageCountが0のときは上限なし
+            if (surfaceCapabilities.maxImageCount != 0)
+            {
+                imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+            }
+            return imageCount;
+        }
+    };
+}
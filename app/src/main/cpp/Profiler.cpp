@@ -0,0 +1,299 @@
+#include "Profiler.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace Vulkan_Test
+{
+    void RollingStats::add(double value)
+    {
+        if (_samples.size() < _capacity)
+        {
+            _samples.push_back(value);
+        }
+        else
+        {
+            _samples[_next] = value;
+        }
+        _next = (_next + 1) % _capacity;
+    }
+
+    void RollingStats::clear()
+    {
+        _samples.clear();
+        _next = 0;
+    }
+
+    double RollingStats::percentile(double p) const
+    {
+        if (_samples.empty())
+        {
+            return 0.0;
+        }
+
+        // dumpのときにしか呼ばないので、毎回コピーして部分的に並べ替える
+        std::vector<double> sorted = _samples;
+        size_t index = std::min(static_cast<size_t>(p * (sorted.size() - 1) + 0.5), sorted.size() - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+    double RollingStats::average() const
+    {
+        if (_samples.empty())
+        {
+            return 0.0;
+        }
+        return std::accumulate(_samples.begin(), _samples.end(), 0.0) / _samples.size();
+    }
+
+    double RollingStats::max() const
+    {
+        if (_samples.empty())
+        {
+            return 0.0;
+        }
+        return *std::max_element(_samples.begin(), _samples.end());
+    }
+
+    Profiler::Profiler(vk::PhysicalDevice physicalDevice, vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount,
+                       uint32_t reportInterval, uint32_t maxGpuScopesPerFrame)
+        : _device(device), _frameCount(frameCount), _reportInterval(reportInterval), _maxGpuScopesPerFrame(maxGpuScopesPerFrame)
+    {
+        _gpuScopes.resize(_frameCount);
+        _queryCounts = std::vector<uint32_t>(_frameCount, 0);
+
+        // timestampValidBitsが0のキューではタイムスタンプが取れない その場合はCPUの時間だけを計る
+        std::vector<vk::QueueFamilyProperties> queueProps = physicalDevice.getQueueFamilyProperties();
+        uint32_t timestampValidBits = queueProps[queueFamilyIndex].timestampValidBits;
+        _timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+        if (timestampValidBits == 0 || _timestampPeriod <= 0.0)
+        {
+            LOG("Profiler: GPU timestamps are not supported on queue family " << queueFamilyIndex);
+            return;
+        }
+        _timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+        // 区間ごとに開始と終了の2つのクエリを使う フレームスロットごとに領域を分ける
+        vk::QueryPoolCreateInfo queryPoolCreateInfo;
+        queryPoolCreateInfo.queryType = vk::QueryType::eTimestamp;
+        queryPoolCreateInfo.queryCount = _frameCount * _maxGpuScopesPerFrame * 2;
+        _queryPool = _device.createQueryPoolUnique(queryPoolCreateInfo);
+    }
+
+    void Profiler::beginFrame(uint32_t frameIndex)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (_hasLastFrame)
+        {
+            _frameMs.add(std::chrono::duration<double, std::milli>(now - _lastFrameStart).count());
+        }
+        _lastFrameStart = now;
+        _hasLastFrame = true;
+
+        // このスロットのフェンスは待った後なので、前回このスロットで積んだクエリの結果はもう出ている
+        resolveGpuScopes(frameIndex);
+        _currentFrame = frameIndex;
+
+        _frameNumber++;
+        if (_reportInterval != 0 && _frameNumber % _reportInterval == 0)
+        {
+            dump();
+        }
+    }
+
+    void Profiler::recordFrameStart(vk::CommandBuffer commandBuffer)
+    {
+        if (!_queryPool)
+        {
+            return;
+        }
+        // クエリは使う前にリセットが必要 レンダーパスの外で行う
+        commandBuffer.resetQueryPool(_queryPool.get(), _currentFrame * _maxGpuScopesPerFrame * 2, _maxGpuScopesPerFrame * 2);
+    }
+
+    std::optional<uint32_t> Profiler::beginGpuScope(vk::CommandBuffer commandBuffer, const char* name)
+    {
+        if (!_queryPool || _queryCounts[_currentFrame] + 2 > _maxGpuScopesPerFrame * 2)
+        {
+            return std::nullopt;
+        }
+
+        uint32_t query = _currentFrame * _maxGpuScopesPerFrame * 2 + _queryCounts[_currentFrame];
+        _queryCounts[_currentFrame] += 2;
+        _gpuScopes[_currentFrame].push_back(GpuScopeRecord{ name, query });
+
+        // それより前のコマンドが始まった時点ではなく、この区間のコマンドが始まる時点を取りたいのでeTopOfPipe
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, _queryPool.get(), query);
+        return query;
+    }
+
+    void Profiler::endGpuScope(vk::CommandBuffer commandBuffer, std::optional<uint32_t> query)
+    {
+        if (!query)
+        {
+            return;
+        }
+        // 区間のコマンドが全て終わった時点
+        commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, _queryPool.get(), query.value() + 1);
+    }
+
+    void Profiler::resolveGpuScopes(uint32_t frameIndex)
+    {
+        std::vector<GpuScopeRecord>& records = _gpuScopes[frameIndex];
+        uint32_t queryCount = _queryCounts[frameIndex];
+        _queryCounts[frameIndex] = 0;
+        if (records.empty())
+        {
+            return;
+        }
+
+        uint32_t firstQuery = frameIndex * _maxGpuScopesPerFrame * 2;
+        vk::ResultValue<std::vector<uint64_t>> results = _device.getQueryPoolResults<uint64_t>(
+                _queryPool.get(), firstQuery, queryCount, queryCount * sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+        if (results.result != vk::Result::eSuccess)
+        {
+            records.clear();
+            return;
+        }
+
+        uint64_t frameBegin = ~0ull;
+        uint64_t frameEnd = 0;
+        for (const GpuScopeRecord& record : records)
+        {
+            uint64_t begin = results.value[record.query - firstQuery] & _timestampMask;
+            uint64_t end = results.value[record.query - firstQuery + 1] & _timestampMask;
+            getScopeStats(record.name).gpuMs.add(((end - begin) & _timestampMask) * _timestampPeriod / 1'000'000.0);
+            if (_gpuClockCalibrated)
+            {
+                TraceRecorder::get().recordGpu(record.name,
+                                               static_cast<uint64_t>(static_cast<int64_t>(begin * _timestampPeriod) + _gpuClockOffsetNs),
+                                               static_cast<uint64_t>(static_cast<int64_t>(end * _timestampPeriod) + _gpuClockOffsetNs));
+            }
+            frameBegin = std::min(frameBegin, begin);
+            frameEnd = std::max(frameEnd, end);
+        }
+        _gpuFrameMs.add(((frameEnd - frameBegin) & _timestampMask) * _timestampPeriod / 1'000'000.0);
+        records.clear();
+    }
+
+    void Profiler::addCpuSample(const char* name, uint64_t startNs, uint64_t endNs)
+    {
+        getScopeStats(name).cpuMs.add((endNs - startNs) / 1'000'000.0);
+        TraceRecorder::get().record(name, "cpu", startNs, endNs);
+    }
+
+    void Profiler::calibrateGpuClock(vk::Queue queue, uint32_t queueFamilyIndex)
+    {
+        if (!_queryPool)
+        {
+            return;
+        }
+
+        vk::CommandPoolCreateInfo cmdPoolCreateInfo;
+        cmdPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+        cmdPoolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+        vk::UniqueCommandPool commandPool = _device.createCommandPoolUnique(cmdPoolCreateInfo);
+
+        vk::CommandBufferAllocateInfo cmdBufferAllocateInfo;
+        cmdBufferAllocateInfo.commandPool = commandPool.get();
+        cmdBufferAllocateInfo.commandBufferCount = 1;
+        cmdBufferAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+        std::vector<vk::UniqueCommandBuffer> commandBuffers = _device.allocateCommandBuffersUnique(cmdBufferAllocateInfo);
+
+        // フレーム用のクエリとは別に1つだけのプールを使う
+        vk::QueryPoolCreateInfo queryPoolCreateInfo;
+        queryPoolCreateInfo.queryType = vk::QueryType::eTimestamp;
+        queryPoolCreateInfo.queryCount = 1;
+        vk::UniqueQueryPool queryPool = _device.createQueryPoolUnique(queryPoolCreateInfo);
+
+        vk::CommandBufferBeginInfo cmdBeginInfo;
+        cmdBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        commandBuffers[0]->begin(cmdBeginInfo);
+        commandBuffers[0]->resetQueryPool(queryPool.get(), 0, 1);
+        commandBuffers[0]->writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool.get(), 0);
+        commandBuffers[0]->end();
+
+        vk::UniqueFence fence = _device.createFenceUnique(vk::FenceCreateInfo());
+        vk::CommandBuffer submitCmdBuf[1] = { commandBuffers[0].get() };
+        vk::SubmitInfo submitInfo;
+        submitInfo.commandBufferCount = std::size(submitCmdBuf);
+        submitInfo.pCommandBuffers = submitCmdBuf;
+
+        // タイムスタンプはsubmitしてから完了を待ち終わるまでの間のどこかで書かれる
+        // その中点をGPUの時刻に対応するCPUの時刻とみなす 誤差は往復の時間の半分以下
+        uint64_t cpuBeforeNs = TraceRecorder::now();
+        queue.submit({ submitInfo }, fence.get());
+        vk::Result waitResult = _device.waitForFences({ fence.get() }, VK_TRUE, 1'000'000'000);
+        uint64_t cpuAfterNs = TraceRecorder::now();
+        if (waitResult != vk::Result::eSuccess)
+        {
+            LOGERR("Profiler: failed to calibrate GPU clock : " << to_string(waitResult));
+            return;
+        }
+
+        vk::ResultValue<std::vector<uint64_t>> results = _device.getQueryPoolResults<uint64_t>(
+                queryPool.get(), 0, 1, sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+        if (results.result != vk::Result::eSuccess)
+        {
+            return;
+        }
+
+        int64_t gpuNs = static_cast<int64_t>((results.value[0] & _timestampMask) * _timestampPeriod);
+        _gpuClockOffsetNs = static_cast<int64_t>(cpuBeforeNs + (cpuAfterNs - cpuBeforeNs) / 2) - gpuNs;
+        _gpuClockCalibrated = true;
+    }
+
+    Profiler::ScopeStats& Profiler::getScopeStats(const char* name)
+    {
+        // 区間の数は少ないので線形に探す ほとんどは同じリテラルなのでポインタの比較で見つかる
+        for (ScopeStats& scopeStats : _scopeStats)
+        {
+            if (scopeStats.name == name || std::strcmp(scopeStats.name, name) == 0)
+            {
+                return scopeStats;
+            }
+        }
+        _scopeStats.push_back(ScopeStats{ name, RollingStats(), RollingStats() });
+        return _scopeStats.back();
+    }
+
+    void Profiler::dump() const
+    {
+        LOG("Profiler frames: " << _frameMs.count() << std::fixed << std::setprecision(3) <<
+            " frame p50: " << _frameMs.percentile(0.5) << "ms" <<
+            " p95: " << _frameMs.percentile(0.95) << "ms" <<
+            " p99: " << _frameMs.percentile(0.99) << "ms" <<
+            " max: " << _frameMs.max() << "ms");
+        if (_gpuFrameMs.count() != 0)
+        {
+            LOG("Profiler gpu frame p50: " << std::fixed << std::setprecision(3) << _gpuFrameMs.percentile(0.5) << "ms" <<
+                " p95: " << _gpuFrameMs.percentile(0.95) << "ms" <<
+                " p99: " << _gpuFrameMs.percentile(0.99) << "ms");
+        }
+        for (const ScopeStats& scopeStats : _scopeStats)
+        {
+            std::stringstream line;
+            line << std::fixed << std::setprecision(3) << "  " << scopeStats.name;
+            if (scopeStats.cpuMs.count() != 0)
+            {
+                line << " cpu avg: " << scopeStats.cpuMs.average() << "ms p95: " << scopeStats.cpuMs.percentile(0.95) << "ms";
+            }
+            if (scopeStats.gpuMs.count() != 0)
+            {
+                line << " gpu avg: " << scopeStats.gpuMs.average() << "ms p95: " << scopeStats.gpuMs.percentile(0.95) << "ms";
+            }
+            LOG(line.str());
+        }
+    }
+
+    void Profiler::reset()
+    {
+        _frameMs.clear();
+        _gpuFrameMs.clear();
+        _scopeStats.clear();
+        _hasLastFrame = false;
+    }
+}
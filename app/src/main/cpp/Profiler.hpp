@@ -0,0 +1,181 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "TraceRecorder.hpp"
+
+namespace Vulkan_Test
+{
+    // 直近のcapacity個の値だけを覚えておき、平均やパーセンタイルを出す
+    class RollingStats
+    {
+    public:
+        explicit RollingStats(size_t capacity = 600) : _capacity(capacity)
+        {
+            _samples.reserve(capacity);
+        }
+
+        void add(double value);
+        void clear();
+
+        // pは0～1 (0.5ならp50)
+        double percentile(double p) const;
+        double average() const;
+        double max() const;
+        size_t count() const { return _samples.size(); }
+
+    private:
+        size_t _capacity;
+        // いっぱいになったら一番古い値を上書きする
+        std::vector<double> _samples;
+        size_t _next = 0;
+    };
+
+    // CPUとGPUの時間を区間(スコープ)ごとに計る
+    //
+    // CPU: CpuScopeを置いたブロックの実行時間
+    // GPU: GpuScopeで挟んだコマンドの実行時間 タイムスタンプクエリで計る
+    //      結果はそのフレームスロットのフェンスを次に待ったとき(beginFrame)に読むので、読むためにGPUを待つことはない
+    //
+    // フレーム時間はbeginFrameを呼ぶ間隔で計り、直近のフレームのp50/p95/p99を出す
+    // 端末ごと・変更ごとの性能の比較に使う
+    //
+    // TraceRecorderが記録中なら、CPUの区間とGPUの区間(CPUの時刻に直したもの)をイベントとしても記録する
+    //
+    // 使い方
+    //   1. フレームスロットのフェンスを待った後に beginFrame(スロット番号)
+    //   2. コマンドバッファの記録を始めたら recordFrameStart(コマンドバッファ) (このスロットのクエリをリセットする)
+    //   3. 計りたい所を CpuScope / GpuScope で囲む
+    //
+    // レンダースレッドからだけ使う想定 (スレッドセーフではない)
+    class Profiler
+    {
+    public:
+        // 区間の名前は文字列リテラルなど、Profilerより長生きするものを渡す
+        class CpuScope
+        {
+        public:
+            CpuScope(Profiler& profiler, const char* name)
+                : _profiler(profiler), _name(name), _startNs(TraceRecorder::now())
+            {
+            }
+
+            ~CpuScope()
+            {
+                stop();
+            }
+
+            // ブロックの終わりより前で区間を閉じたいときに呼ぶ
+            void stop()
+            {
+                if (_name)
+                {
+                    _profiler.addCpuSample(_name, _startNs, TraceRecorder::now());
+                    _name = nullptr;
+                }
+            }
+
+            CpuScope(const CpuScope&) = delete;
+            CpuScope& operator=(const CpuScope&) = delete;
+
+        private:
+            Profiler& _profiler;
+            const char* _name;
+            uint64_t _startNs;
+        };
+
+        class GpuScope
+        {
+        public:
+            GpuScope(Profiler& profiler, vk::CommandBuffer commandBuffer, const char* name)
+                : _profiler(profiler), _commandBuffer(commandBuffer), _query(profiler.beginGpuScope(commandBuffer, name))
+            {
+            }
+
+            ~GpuScope()
+            {
+                _profiler.endGpuScope(_commandBuffer, _query);
+            }
+
+            GpuScope(const GpuScope&) = delete;
+            GpuScope& operator=(const GpuScope&) = delete;
+
+        private:
+            Profiler& _profiler;
+            vk::CommandBuffer _commandBuffer;
+            std::optional<uint32_t> _query;
+        };
+
+        struct ScopeStats
+        {
+            const char* name;
+            RollingStats cpuMs;
+            RollingStats gpuMs;
+        };
+
+        // queueFamilyIndexはGpuScopeを積むコマンドバッファを送るキューのファミリ
+        // reportIntervalフレームごとにdumpする (0ならしない)
+        Profiler(vk::PhysicalDevice physicalDevice, vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount,
+                 uint32_t reportInterval = 0, uint32_t maxGpuScopesPerFrame = 32);
+
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+
+        void beginFrame(uint32_t frameIndex);
+        void recordFrameStart(vk::CommandBuffer commandBuffer);
+
+        void addCpuSample(const char* name, uint64_t startNs, uint64_t endNs);
+
+        // GPUのタイムスタンプとCPUの時刻の差を測る TraceRecorderでGPUの区間をCPUの区間と並べるために使う
+        // 1回だけsubmitして完了を待つので、初期化のときに呼ぶ
+        void calibrateGpuClock(vk::Queue queue, uint32_t queueFamilyIndex);
+
+        // 統計をログに出す
+        void dump() const;
+        void reset();
+
+        bool isGpuTimingSupported() const { return static_cast<bool>(_queryPool); }
+        const RollingStats& getFrameMs() const { return _frameMs; }
+        const RollingStats& getGpuFrameMs() const { return _gpuFrameMs; }
+        const std::vector<ScopeStats>& getScopeStats() const { return _scopeStats; }
+
+    private:
+        struct GpuScopeRecord
+        {
+            const char* name;
+            uint32_t query;
+        };
+
+        std::optional<uint32_t> beginGpuScope(vk::CommandBuffer commandBuffer, const char* name);
+        void endGpuScope(vk::CommandBuffer commandBuffer, std::optional<uint32_t> query);
+        void resolveGpuScopes(uint32_t frameIndex);
+        ScopeStats& getScopeStats(const char* name);
+
+        vk::Device _device;
+        uint32_t _frameCount;
+        uint32_t _reportInterval;
+        uint32_t _maxGpuScopesPerFrame;
+
+        // タイムスタンプの1tickが何ナノ秒か、値の有効なビット
+        double _timestampPeriod = 0.0;
+        uint64_t _timestampMask = 0;
+        // GPUのタイムスタンプをナノ秒にしたものにこれを足すとTraceRecorder::now()の時刻になる
+        int64_t _gpuClockOffsetNs = 0;
+        bool _gpuClockCalibrated = false;
+        vk::UniqueQueryPool _queryPool;
+        // フレームスロットごとに、記録したGPUの区間とクエリの使用数
+        std::vector<std::vector<GpuScopeRecord>> _gpuScopes;
+        std::vector<uint32_t> _queryCounts;
+        uint32_t _currentFrame = 0;
+
+        std::chrono::steady_clock::time_point _lastFrameStart;
+        bool _hasLastFrame = false;
+        uint64_t _frameNumber = 0;
+
+        RollingStats _frameMs;
+        RollingStats _gpuFrameMs;
+        std::vector<ScopeStats> _scopeStats;
+    };
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "ShaderRegistry.hpp"
+#include "Utility.hpp"
+
+namespace Vulkan_Test
+{
+    // 型Tのプッシュ定数をパイプラインレイアウトに宣言し、ドローごとに書き込む
+    //
+    // ドローごとに変わる小さなデータ(変換行列の番号やマテリアルの番号など)はプッシュ定数で渡す
+    // コマンドバッファに直接積まれるので、ユニフォームバッファへの書き込みもデスクリプタの更新も要らない
+    //
+    // 使い方
+    //   1. 使うシェーダーを渡して作る (ステージとサイズはリフレクションと突き合わせる)
+    //   2. getRange()をパイプラインレイアウトのpushConstantRangesに入れる
+    //   3. ドローの前にpush(コマンドバッファ, レイアウト, データ)
+    template<class T>
+    class PushConstantBlock
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "push constant data must be trivially copyable");
+        // maxPushConstantsSizeは全ての端末で128バイト以上あることが保証されている
+        static_assert(sizeof(T) <= 128, "push constant data must fit in 128 bytes");
+        static_assert(sizeof(T) % 4 == 0, "push constant size must be a multiple of 4");
+
+    public:
+        PushConstantBlock() = default;
+
+        // shadersのうち、プッシュ定数を使っているステージを集める
+        // シェーダーのブロックがTより大きければ、書き込まれない部分ができるのでエラーにする
+        explicit PushConstantBlock(const std::vector<const Shader*>& shaders)
+        {
+            for (const Shader* pShader : shaders)
+            {
+                uint32_t size = pShader->reflection.pushConstantSize;
+                if (size == 0)
+                {
+                    continue;
+                }
+                if (size > sizeof(T))
+                {
+                    LOGERR("PushConstantBlock: " << pShader->assetPath << " uses " << size << " bytes of push constants but only " << sizeof(T) << " are provided");
+                    exit(EXIT_FAILURE);
+                }
+                _stages |= pShader->reflection.getStage();
+            }
+        }
+
+        // どのシェーダーも使っていなければfalse (レイアウトに宣言しない)
+        bool isUsed() const { return static_cast<bool>(_stages); }
+
+        vk::PushConstantRange getRange() const { return vk::PushConstantRange(_stages, 0, sizeof(T)); }
+
+        void push(vk::CommandBuffer commandBuffer, vk::PipelineLayout layout, const T& data) const
+        {
+            commandBuffer.pushConstants(layout, _stages, 0, sizeof(T), &data);
+        }
+
+    private:
+        vk::ShaderStageFlags _stages;
+    };
+}
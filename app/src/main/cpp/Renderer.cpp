@@ -1,5 +1,9 @@
 #include "Renderer.hpp"
 
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
 ////////////////// instance //////////////////
 
 void Renderer::createInstance()
@@ -10,9 +14,8 @@ void Renderer::createInstance()
     _applicationInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
     _applicationInfo.apiVersion = vk::enumerateInstanceVersion();
 
-    _instanceRequiredExtensions = std::vector<const char*>();
-    _instanceRequiredExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
-    _instanceRequiredExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
+    // サーフェスの拡張機能はプラットフォームごとに違う (ヘッドレスなら何も要らない)
+    _instanceRequiredExtensions = _platform->getRequiredInstanceExtensions();
 //    _instanceRequiredExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
     vk::InstanceCreateInfo instanceCreateInfo = vk::InstanceCreateInfo();
@@ -43,11 +46,16 @@ std::optional<uint32_t> Renderer::getQueueFamilyIndex(vk::PhysicalDevice& physic
     for (size_t i = 0; i < queueProps.size(); i++)
     {
         // グラフィックス機能に加えてサーフェスへのプレゼンテーションもサポートしているキューを厳選
+        // サーフェスが無い(ヘッドレス)ならグラフィックス機能だけでよい
         if (!(queueProps[i].queueFlags & vk::QueueFlagBits::eGraphics) ||
-            !physicalDevice.getSurfaceSupportKHR(i, *surface))
+            (surface && !physicalDevice.getSurfaceSupportKHR(i, *surface)))
         {
             continue;
         }
+        if (!surface)
+        {
+            return i;
+        }
 
         for (size_t j = 0; j < extProps.size(); j++)
         {
@@ -65,6 +73,25 @@ std::optional<uint32_t> Renderer::getQueueFamilyIndex(vk::PhysicalDevice& physic
     return std::nullopt;
 }
 
+// 転送(コピー)だけができるキューファミリを探す
+// 多くのGPUはグラフィックスキューとは別にDMAエンジンにつながった転送専用のキューを持っている
+// 大きな転送をこちらに流せば、グラフィックスキューの実行時間を転送に取られずに済む
+std::optional<uint32_t> Renderer::getTransferQueueFamilyIndex(vk::PhysicalDevice& physicalDevice)
+{
+    std::vector<vk::QueueFamilyProperties> queueProps = physicalDevice.getQueueFamilyProperties();
+    for (size_t i = 0; i < queueProps.size(); i++)
+    {
+        // グラフィックスやコンピュートのキューも転送はできるが、それではグラフィックスキューと同じハードウェアを取り合うだけ
+        if ((queueProps[i].queueFlags & vk::QueueFlagBits::eTransfer) &&
+            !(queueProps[i].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+        {
+            return i;
+        }
+    }
+
+    return std::nullopt;
+}
+
 void Renderer::selectPhysicalDeviceAndQueueFamilyIndex()
 {
     // vk::Instanceにはそれに対応するvk::UniqueInstanceが存在したが、
@@ -84,7 +111,8 @@ void Renderer::selectPhysicalDeviceAndQueueFamilyIndex()
         _physicalDevice = _cachedPhysicalDevices[i];
 
         // デバイスがサーフェスを間違いなくサポートしていることを確かめる
-        if (_physicalDevice.getSurfaceFormatsKHR(*_surface).empty() &&
+        if (_surface &&
+            _physicalDevice.getSurfaceFormatsKHR(*_surface).empty() &&
             _physicalDevice.getSurfacePresentModesKHR(*_surface).empty())
         {
             continue;
@@ -96,6 +124,7 @@ void Renderer::selectPhysicalDeviceAndQueueFamilyIndex()
             continue;
         }
         _queueFamilyIndex = queueFamilyIndex.value();
+        _transferQueueFamilyIndex = getTransferQueueFamilyIndex(_physicalDevice);
 
         success = true;
         break;
@@ -110,20 +139,72 @@ void Renderer::selectPhysicalDeviceAndQueueFamilyIndex()
     _cachedPhysicalDeviceMemoryProperties = _physicalDevice.getMemoryProperties();
 }
 
+void Renderer::createMemoryAllocator() {
+    // デバイスメモリはバッファごとに確保せず、MemoryAllocatorが大きなブロックから切り出して渡す
+    _memoryAllocator = std::make_unique<Vulkan_Test::MemoryAllocator>(_physicalDevice, _device.get());
+}
+
+void Renderer::createPipelineCache() {
+    // 2回目以降の起動では、前回作ったパイプラインのコンパイル結果がここから使われる
+    std::string cacheDirectory = _platform->getCacheDirectory();
+    std::string path = cacheDirectory.empty() ? std::string() : cacheDirectory + "/pipeline_cache.bin";
+    _pipelineCache = std::make_unique<Vulkan_Test::PipelineCache>(_physicalDevice, _device.get(), path);
+}
+
+void Renderer::createPipelineCompiler() {
+    // パイプラインのコンパイルなど、レンダースレッドを止めたくない重い処理をワーカースレッドで行う
+    _threadPool = std::make_unique<Vulkan_Test::ThreadPool>();
+    _pipelineCompiler = std::make_unique<Vulkan_Test::PipelineCompiler>(_device.get(), *_pipelineCache, *_threadPool);
+    _pipelineObjectCache = std::make_unique<Vulkan_Test::PipelineObjectCache>(*_pipelineCompiler);
+    LOG("Worker threads : " << _threadPool->getThreadCount());
+}
+
+void Renderer::createShaderRegistry() {
+    // シェーダーは使われたときに初めて読まれる
+    _shaderRegistry = std::make_unique<Vulkan_Test::ShaderRegistry>(_device.get(), *_platform);
+}
+
+void Renderer::savePipelineCache() {
+    if (_pipelineCache)
+    {
+        _pipelineCache->save();
+    }
+}
+
 void Renderer::createGraphicsQueue() {
     _graphicsQueue = _device.get().getQueue(_queueFamilyIndex, 0);
 }
 
+void Renderer::createTransferQueue() {
+    // 転送専用キューが無ければ、転送はグラフィックスキューのコマンドバッファに積む
+    if (_transferQueueFamilyIndex)
+    {
+        _transferQueue = _device.get().getQueue(_transferQueueFamilyIndex.value(), 0);
+    }
+}
+
 ////////////////// surface //////////////////
 
 void Renderer::createSurface()
 {
-    vk::AndroidSurfaceCreateInfoKHR surfaceCreateInfo = vk::AndroidSurfaceCreateInfoKHR(vk::AndroidSurfaceCreateFlagsKHR(), _pApp->window);
-    _surface = _instance->createAndroidSurfaceKHRUnique(surfaceCreateInfo);
+    // サーフェスの作り方はプラットフォームに任せる
+    if (!_headless)
+    {
+        _surface = _platform->createSurface(_instance.get());
+    }
 }
 
 void Renderer::cacheSurfaceData()
 {
+    // ヘッドレスではサーフェスに問い合わせられないので、どのデバイスでもカラーアタッチメントと転送元に使えるフォーマットを使う
+    if (_headless)
+    {
+        _surfaceFormats = { vk::SurfaceFormatKHR(vk::Format::eR8G8B8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear) };
+        _surfaceCapabilities = vk::SurfaceCapabilitiesKHR();
+        _surfacePresentModes.clear();
+        return;
+    }
+
     // 「物理デバイスが対象のサーフェスを扱う能力」の情報を取得する
     _surfaceFormats = _physicalDevice.getSurfaceFormatsKHR(_surface.get());
 
@@ -146,9 +227,12 @@ void Renderer::createDevice()
     // スワップチェーンは拡張機能なので、機能を有効化する必要がある
     // スワップチェーンは「デバイスレベル」の拡張機能
     std::vector<const char*> deviceRequiredExtensions = std::vector<const char*>();
-    deviceRequiredExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    if (!_headless)
+    {
+        deviceRequiredExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
-    // 今のところ欲しいキューは1つだけなので要素数1の配列にする
+    // 欲しいキューはキューファミリごとに1つだけなので要素数1の配列にする
     std::vector<float> queuePriorities = std::vector<float>();
     queuePriorities.push_back(1.0f);
 
@@ -163,7 +247,81 @@ void Renderer::createDevice()
     queueCreateInfo[0].queueCount = queuePriorities.size();
     queueCreateInfo[0].pQueuePriorities = queuePriorities.data();
 
+    // 転送専用のキューファミリがあれば、そこからも1つキューをもらう
+    if (_transferQueueFamilyIndex)
+    {
+        queueCreateInfo.emplace_back();
+        queueCreateInfo[1].queueFamilyIndex = _transferQueueFamilyIndex.value();
+        queueCreateInfo[1].queueCount = queuePriorities.size();
+        queueCreateInfo[1].pQueuePriorities = queuePriorities.data();
+    }
+
+    // 使えるコアの機能は、インスタンスとデバイスのバージョンの低い方で決まる
+    // (1.1のローダーで作ったインスタンスでは、1.2のデバイスでも1.2の関数や構造体は使えない)
+    uint32_t apiVersion = std::min(_applicationInfo.apiVersion, _physicalDevice.getProperties().apiVersion);
+
+    // タイムラインセマフォはVulkan 1.2で入った機能なので、対応しているかを確かめてから有効化する
+    // 非対応の端末ではバイナリセマフォとフェンスだけで同期する
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures;
+    if (apiVersion >= VK_API_VERSION_1_2)
+    {
+        vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceTimelineSemaphoreFeatures> supportedFeatures =
+                _physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+        _timelineSemaphoreSupported = supportedFeatures.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore;
+    }
+    timelineSemaphoreFeatures.timelineSemaphore = _timelineSemaphoreSupported;
+
+    // カリングや深度テストなどを動的ステートにできれば、パイプラインの組み合わせの数を減らせる
+    // 非対応の端末では今まで通りパイプラインに焼き込む
+    bool extendedDynamicStateSupported = Vulkan_Test::ExtendedDynamicState::isSupported(_physicalDevice, apiVersion);
+    vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures;
+    extendedDynamicStateFeatures.extendedDynamicState = true;
+    if (extendedDynamicStateSupported)
+    {
+        deviceRequiredExtensions.push_back(Vulkan_Test::ExtendedDynamicState::getExtensionName());
+    }
+
+    // 間接描画のコマンドの数をバッファから読めれば、GPUのカリングで数を決められる
+    // 拡張機能が無くVulkan 1.2のコアの機能を使うときは、Vulkan12Featuresで有効にする
+    // (Vulkan12Featuresと個別の機能の構造体は一緒につなげないので、タイムラインセマフォもそちらで有効にする)
+    Vulkan_Test::DrawIndirectCount::Support drawIndirectCountSupport = Vulkan_Test::DrawIndirectCount::getSupport(_physicalDevice, apiVersion);
+    vk::PhysicalDeviceVulkan12Features vulkan12Features;
+    vulkan12Features.drawIndirectCount = true;
+    vulkan12Features.timelineSemaphore = _timelineSemaphoreSupported;
+    if (drawIndirectCountSupport == Vulkan_Test::DrawIndirectCount::Support::Extension)
+    {
+        deviceRequiredExtensions.push_back(Vulkan_Test::DrawIndirectCount::getExtensionName());
+    }
+
+    // 1回の間接描画で複数のコマンドを描くのと、コマンドのfirstInstanceに0以外を入れるのは、どちらも対応していれば使う
+    vk::PhysicalDeviceFeatures supportedFeatures = _physicalDevice.getFeatures();
+    _multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect;
+    _drawIndirectFirstInstanceSupported = supportedFeatures.drawIndirectFirstInstance;
+    vk::PhysicalDeviceFeatures enabledFeatures;
+    enabledFeatures.multiDrawIndirect = _multiDrawIndirectSupported;
+    enabledFeatures.drawIndirectFirstInstance = _drawIndirectFirstInstanceSupported;
+
+    // 有効にする機能の構造体をpNextでつなぐ
+    void* pFeatures = nullptr;
+    if (drawIndirectCountSupport == Vulkan_Test::DrawIndirectCount::Support::Core)
+    {
+        vulkan12Features.pNext = pFeatures;
+        pFeatures = &vulkan12Features;
+    }
+    else if (_timelineSemaphoreSupported)
+    {
+        timelineSemaphoreFeatures.pNext = pFeatures;
+        pFeatures = &timelineSemaphoreFeatures;
+    }
+    if (extendedDynamicStateSupported)
+    {
+        extendedDynamicStateFeatures.pNext = pFeatures;
+        pFeatures = &extendedDynamicStateFeatures;
+    }
+
     vk::DeviceCreateInfo deviceCreateInfo = vk::DeviceCreateInfo();
+    deviceCreateInfo.pNext = pFeatures;
+    deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
     deviceCreateInfo.enabledLayerCount = deviceRequiredLayers.size();
     deviceCreateInfo.ppEnabledLayerNames = deviceRequiredLayers.data();
     deviceCreateInfo.enabledExtensionCount = deviceRequiredExtensions.size();
@@ -185,6 +343,15 @@ void Renderer::createDevice()
     // 仮想化されたデバイスが論理デバイス
     // これならあるプロセスが他のプロセスの存在を意識することなくGPUの能力を使うことができる
     _device = _physicalDevice.createDeviceUnique(deviceCreateInfo);
+
+    if (extendedDynamicStateSupported)
+    {
+        _extendedDynamicState.load(_device.get());
+    }
+    LOG("Extended dynamic state : " << (_extendedDynamicState.isEnabled() ? "enabled" : "not supported"));
+
+    _drawIndirectCount.load(_device.get(), drawIndirectCountSupport);
+    LOG("Draw indirect count : " << (_drawIndirectCount.isEnabled() ? "enabled" : "not supported"));
 }
 
 void Renderer::createSwapchain() {
@@ -193,9 +360,10 @@ void Renderer::createSwapchain() {
     swapchainCreateInfo.surface = _surface.get();
     // minImageCountはスワップチェーンが扱うイメージの数
     // getSurfaceCapabilitiesKHRで得られたminImageCount(最小値)とmaxImageCount(最大値)の間の数なら何枚でも問題ない
-    // https://vulkan-tutorial.com/
-    // の記述に従って最小値+1を指定する
-    swapchainCreateInfo.minImageCount = _surfaceCapabilities.minImageCount + 1;
+    // 枚数が多いほどGPUが表示待ちで止まりにくくなるが、表示までの遅延とメモリが増える
+    // どちらを優先するかはPresentPolicyで決める
+    _swapchainMinImageCount = _presentPolicy.selectImageCount(_surfacePresentModes, _surfaceCapabilities);
+    swapchainCreateInfo.minImageCount = _swapchainMinImageCount;
     // imageFormatやimageColorSpaceなどには、スワップチェーンが取り扱う画像の形式などを指定する
     // しかしこれらに指定できる値はサーフェスとデバイスの事情によって制限されるものであり、自由に決めることができるものではない
     // ここに指定する値は、必ずgetSurfaceFormatsKHRが返した配列に含まれる組み合わせでなければならない
@@ -204,7 +372,8 @@ void Renderer::createSwapchain() {
     // imageExtentはスワップチェーンの画像サイズを表す
     // getSurfaceCapabilitiesKHRで得られたminImageExtent(最小値)とmaxImageExtent(最大値)の間でなければならない
     // currentExtentで現在のサイズが得られるため、それを指定
-    swapchainCreateInfo.imageExtent = _surfaceCapabilities.currentExtent;
+    _swapchainExtent = _surfaceCapabilities.currentExtent;
+    swapchainCreateInfo.imageExtent = _swapchainExtent;
     swapchainCreateInfo.imageArrayLayers = 1;
     swapchainCreateInfo.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
     swapchainCreateInfo.imageSharingMode = vk::SharingMode::eExclusive;
@@ -214,8 +383,16 @@ void Renderer::createSwapchain() {
     swapchainCreateInfo.preTransform = _surfaceCapabilities.currentTransform;
     // presentModeは表示処理のモードを示すもの
     // getSurfacePresentModesKHRの戻り値の配列に含まれる値である必要がある
-    swapchainCreateInfo.presentMode = _surfacePresentModes[0];
+    // eFifo: 垂直同期に合わせて順番に表示する 必ずサポートされている
+    // eMailbox: 垂直同期に合わせて表示するが、待っているイメージは新しいものに置き換わる 遅延が小さい
+    // eImmediate: 垂直同期を待たずに表示する ティアリングが起こる
+    _presentMode = _presentPolicy.selectPresentMode(_surfacePresentModes);
+    swapchainCreateInfo.presentMode = _presentMode;
     swapchainCreateInfo.clipped = VK_TRUE;
+    // 作り直す場合は古いスワップチェーンを渡す
+    // ドライバはこれを手がかりに古いイメージなどの資源を再利用できる
+    // 初回はnullptrなので何も起こらない
+    swapchainCreateInfo.oldSwapchain = _swapchain.get();
 
     // 一般的なコンピュータは、アニメーションを描画・表示する際に「描いている途中」が見えないようにするため、
     // 2枚以上のキャンバスを用意して、1枚を使って現在のフレームを表示させている裏で別の1枚に次のフレームを描画する、という仕組みを採用している
@@ -229,6 +406,8 @@ void Renderer::createSwapchain() {
     // レンダーパス・パイプラインなどの作成、
     // フレームバッファを作成してイメージビューと紐づけ、
     // コマンドバッファにコマンドを積んでキューに送信
+    //
+    // 古いスワップチェーンはここで新しいものが代入されたときに破棄される
     _swapchain = _device->createSwapchainKHRUnique(swapchainCreateInfo);
 
     _swapchainImages = _device.get().getSwapchainImagesKHR(_swapchain.get());
@@ -254,12 +433,58 @@ void Renderer::createSwapchain() {
 
         _swapchainImageViews[i] = _device.get().createImageViewUnique(imgViewCreateInfo);
     }
+}
 
+// ヘッドレスのときにスワップチェーンの代わりに使う描画先を作る
+// イメージはフレームスロットの数だけ作り、スロットの番号をそのままイメージの番号として使う
+void Renderer::createOffscreenTargets() {
+    _swapchainExtent = _platform->getOffscreenExtent();
+    _swapchainMinImageCount = _maxFramesInFlight;
+
+    // 描画結果を読み戻せるよう、カラーアタッチメントに加えて転送元にも使えるようにしておく
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = _surfaceFormats[0].format;
+    imageCreateInfo.extent = vk::Extent3D(_swapchainExtent.width, _swapchainExtent.height, 1);
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+    imageCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+    _offscreenImages.resize(_maxFramesInFlight);
+    _offscreenImageMemories.resize(_maxFramesInFlight);
+    _swapchainImages.resize(_maxFramesInFlight);
+    _swapchainImageViews.resize(_maxFramesInFlight);
+    for (uint32_t i = 0; i < _maxFramesInFlight; i++)
+    {
+        _offscreenImages[i] = _device->createImageUnique(imageCreateInfo);
+        _offscreenImageMemories[i] = _memoryAllocator->allocateForImage(_offscreenImages[i].get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+        _swapchainImages[i] = _offscreenImages[i].get();
 
+        vk::ImageViewCreateInfo imgViewCreateInfo;
+        imgViewCreateInfo.image = _swapchainImages[i];
+        imgViewCreateInfo.viewType = vk::ImageViewType::e2D;
+        imgViewCreateInfo.format = _surfaceFormats[0].format;
+        imgViewCreateInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+        imgViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imgViewCreateInfo.subresourceRange.levelCount = 1;
+        imgViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imgViewCreateInfo.subresourceRange.layerCount = 1;
+        _swapchainImageViews[i] = _device->createImageViewUnique(imgViewCreateInfo);
+    }
 
-
-    vk::FenceCreateInfo fenceCreateInfo;
-    _swapchainImgFence = _device->createFenceUnique(fenceCreateInfo);
+    // 読み戻し先 ホストから読むのでキャッシュの効くメモリが望ましい
+    vk::BufferCreateInfo readbackBufferCreateInfo;
+    readbackBufferCreateInfo.size = vk::DeviceSize(_swapchainExtent.width) * _swapchainExtent.height * 4;
+    readbackBufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferDst;
+    readbackBufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+    _readbackBuffer = _device->createBufferUnique(readbackBufferCreateInfo);
+    _readbackBufferMemory = _memoryAllocator->allocateForBuffer(_readbackBuffer.get(),
+                                                                vk::MemoryPropertyFlagBits::eHostVisible,
+                                                                vk::MemoryPropertyFlagBits::eHostCached);
 }
 
 void Renderer::createFramebuffers() {
@@ -280,8 +505,8 @@ void Renderer::createFramebuffers() {
 
         // フレームバッファを介して「0番のアタッチメントはこのイメージビュー、1番のアタッチメントは…」という結び付けを行うことで初めてレンダーパスが使える
         vk::FramebufferCreateInfo framebufferCreateInfo;
-        framebufferCreateInfo.width = _surfaceCapabilities.currentExtent.width;
-        framebufferCreateInfo.height = _surfaceCapabilities.currentExtent.height;
+        framebufferCreateInfo.width = _swapchainExtent.width;
+        framebufferCreateInfo.height = _swapchainExtent.height;
         framebufferCreateInfo.layers = 1;
         framebufferCreateInfo.renderPass = _renderPass.get();
         framebufferCreateInfo.attachmentCount = std::size(frameBufferAttachments);
@@ -299,61 +524,17 @@ void Renderer::createFramebuffers() {
     }
 }
 
-void Renderer::createStagingVertexBuffer() {
-    vk::BufferCreateInfo stagingBufferCreateInfo;
-    stagingBufferCreateInfo.size = sizeof(Vertex) * _vertices.size();
-    stagingBufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
-    stagingBufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
-
-    _stagingVertexBuffer = _device.get().createBufferUnique(stagingBufferCreateInfo);
-
-
-
-    vk::MemoryRequirements vertexBufferMemoryRequirements = _device.get().getBufferMemoryRequirements(_stagingVertexBuffer.get());
-
-    vk::MemoryAllocateInfo vertexBufferMemAllocInfo;
-    vertexBufferMemAllocInfo.allocationSize = vertexBufferMemoryRequirements.size;
-
-    bool suitableMemoryTypeFound = false;
-    for (uint32_t i = 0; i < _cachedPhysicalDeviceMemoryProperties.memoryTypeCount; i++)
-    {
-        if ((vertexBufferMemoryRequirements.memoryTypeBits & (1 << i)) &&
-            (_cachedPhysicalDeviceMemoryProperties.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible))
-        {
-            vertexBufferMemAllocInfo.memoryTypeIndex = i;
-            suitableMemoryTypeFound = true;
-            break;
-        }
-    }
-    if (!suitableMemoryTypeFound)
-    {
-        LOGERR("Suitable memory type not found. ");
-        exit(EXIT_FAILURE);
-    }
-
-    _stagingVertexBufferMemory = _device.get().allocateMemoryUnique(vertexBufferMemAllocInfo);
-    _device.get().bindBufferMemory(_stagingVertexBuffer.get(), _stagingVertexBufferMemory.get(), 0);
-
-
-
-    // デバイスメモリに書き込むために、メモリマッピングというものをする
-    // これは操作したい対象のデバイスメモリを仮想的にアプリケーションのメモリ空間に対応付けることで操作出来るようにするもの
-    // 対象のデバイスメモリを直接操作するわけにはいかないのでこういう形になっている
-    void* pStagingVertexBufferMem = _device.get().mapMemory(_stagingVertexBufferMemory.get(), 0, sizeof(Vertex) * _vertices.size());
-
-    std::memcpy(pStagingVertexBufferMem, _vertices.data(), sizeof(Vertex) * _vertices.size());
-
-    vk::MappedMemoryRange flushMemoryRange;
-    flushMemoryRange.memory = _stagingVertexBufferMemory.get();
-    flushMemoryRange.offset = 0;
-    flushMemoryRange.size = sizeof(Vertex) * _vertices.size();
+void Renderer::createStagingRing() {
+    // ステージングバッファは転送のたびに作らず、マップしたままのリングバッファを使い回す
+    // 各フレームスロットのフェンスが待たれた時点で、そのスロットが使った領域が解放される
+    _stagingRing = std::make_unique<Vulkan_Test::StagingRing>(_device.get(), *_memoryAllocator, kStagingRingSize, _maxFramesInFlight);
+}
 
-    // 書き込んだら flushMappedMemoryRangesメソッドを呼ぶことで書き込んだ内容がデバイスメモリに反映される
-    // マッピングされたメモリはあくまで仮想的にデバイスメモリと対応付けられているだけ
-    // 「同期しておけよ」と念をおさないとデータが同期されない可能性がある
-    _device.get().flushMappedMemoryRanges({ flushMemoryRange });
-    // 作業が終わった後はunmapMemoryできちんと後片付けをする
-    _device.get().unmapMemory(_stagingVertexBufferMemory.get());
+void Renderer::createUniformRing() {
+    // ユニフォームバッファはオブジェクトごとやフレームごとに作らず、マップしたままの1つのバッファから切り出す
+    // インスタンスごとのデータも毎フレーム書き換えるので、同じバッファに置いて頂点バッファとしても使う
+    _uniformRing = std::make_unique<Vulkan_Test::UniformRing>(_physicalDevice, _device.get(), *_memoryAllocator, kUniformRingSizePerFrame, _maxFramesInFlight,
+                                                              vk::BufferUsageFlagBits::eVertexBuffer);
 }
 
 void Renderer::createVertexBuffer()
@@ -369,11 +550,11 @@ void Renderer::createVertexBuffer()
     // ここでは前節で定義した構造体のバイト数をsizeof演算子で取得し、それにデータの数をかけている
 
     // 次は実際に使われる頂点バッファの作成
-    // 今までと違い、メモリの確保時にvk::MemoryPropertyFlagBits::eDeviceLocalフラグを持ったメモリを使うようにするE
+    // メモリの確保時にvk::MemoryPropertyFlagBits::eDeviceLocalフラグを持ったメモリを使うようにする
     // 逆にeHostVisibleは要らない
     // また、usageにvk::BufferUsageFlagBits::eTransferDstを追加で指定する
     // データの転送先という意味
-    // あとでステージングバッファからデータを転送してくる
+    // あとでステージングリングからデータを転送してくる
     vk::BufferCreateInfo vertexBufferCreateInfo;
     vertexBufferCreateInfo.size = sizeof(Vertex) * _vertices.size();
     // usage は作成するバッファの使い道を示すためのもの
@@ -389,102 +570,66 @@ void Renderer::createVertexBuffer()
 
 
     // 実際に使われる頂点バッファのデバイスメモリを確保する
+    // デバイスメモリが確保出来たら bindBufferMemoryで結び付ける (allocateForBufferの中で行っている)
+    _vertexBufferMemory = _memoryAllocator->allocateForBuffer(_vertexBuffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
 
-    vk::MemoryRequirements vertexBufferMemReq = _device.get().getBufferMemoryRequirements(_vertexBuffer.get());
-
-    vk::MemoryAllocateInfo vertexBufferMemAllocateInfo;
-    vertexBufferMemAllocateInfo.allocationSize = vertexBufferMemReq.size;
-
-    bool suitableMemoryTypeFound = false;
-    for (uint32_t i = 0; i < _cachedPhysicalDeviceMemoryProperties.memoryTypeCount; i++)
-    {
-        if ((vertexBufferMemReq.memoryTypeBits & (1 << i)) &&
-            (_cachedPhysicalDeviceMemoryProperties.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal))
-        {
-            vertexBufferMemAllocateInfo.memoryTypeIndex = i;
-            suitableMemoryTypeFound = true;
-            break;
-        }
-    }
-    if (!suitableMemoryTypeFound)
-    {
-        LOGERR("Suitable memory type not found. ");
-        exit(EXIT_FAILURE);
-    }
 
-    _vertexBufferMemory = _device.get().allocateMemoryUnique(vertexBufferMemAllocateInfo);
-    // デバイスメモリが確保出来たら bindBufferMemoryで結び付ける
-    // 第1引数は結びつけるバッファ、第2引数は結びつけるデバイスメモリ
-    // 第3引数は、確保したデバイスメモリのどこを(先頭から何バイト目以降を)使用するかを指定するもの
-    _device.get().bindBufferMemory(_vertexBuffer.get(), _vertexBufferMemory.get(), 0);
 
 
-
-
-    // デバイスメモリに書き込むために、メモリマッピングというものをする
-    // これは操作したい対象のデバイスメモリを仮想的にアプリケーションのメモリ空間に対応付けることで操作出来るようにするもの
-    // 対象のデバイスメモリを直接操作するわけにはいかないのでこういう形になっている
-    void* pStagingVertexBufferMemory = _device.get().mapMemory(_stagingVertexBufferMemory.get(), 0, sizeof(Vertex) * _vertices.size());
-
-    std::memcpy(pStagingVertexBufferMemory, _vertices.data(), sizeof(Vertex) * _vertices.size());
-
-    vk::MappedMemoryRange flushMemoryRange;
-    flushMemoryRange.memory = _stagingVertexBufferMemory.get();
-    flushMemoryRange.offset = 0;
-    flushMemoryRange.size = sizeof(Vertex) * _vertices.size();
-
-    // 書き込んだら flushMappedMemoryRangesメソッドを呼ぶことで書き込んだ内容がデバイスメモリに反映される
-    // マッピングされたメモリはあくまで仮想的にデバイスメモリと対応付けられているだけ
-    // 「同期しておけよ」と念をおさないとデータが同期されない可能性がある
-    _device.get().flushMappedMemoryRanges({ flushMemoryRange });
-    // 作業が終わった後はunmapMemoryできちんと後片付けをする
-    _device.get().unmapMemory(_stagingVertexBufferMemory.get());
-}
-
-void Renderer::sendVertexBuffer()
-{
     // こちらはメモリマッピングではデータを入れられない ホスト可視でないため
     // ホスト可視でないメモリはCPUからは触れない
-    // GPUにコピーさせる訳だが、GPUに命令するということは例によってコマンドバッファとキューを使う
-    // データの転送用に、コマンドバッファを作成するコードを別途追加する
-    vk::CommandPoolCreateInfo tmpCommandPoolCreateInfo;
-    tmpCommandPoolCreateInfo.queueFamilyIndex = _queueFamilyIndex;
-    // vk::CommandPoolCreateFlagBits::eTransientフラグを指定
-    // これは比較的すぐに使ってすぐに役目を終えるコマンドバッファ用であることを意味するフラグ
-    // 必須ではないが指定しておくと内部的に最適化が起きる可能性がある
-    tmpCommandPoolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
-    vk::UniqueCommandPool tmpCmdPool = _device->createCommandPoolUnique(tmpCommandPoolCreateInfo);
-
-    vk::CommandBufferAllocateInfo tmpCommandBufferAllocateInfo;
-    tmpCommandBufferAllocateInfo.commandPool = tmpCmdPool.get();
-    tmpCommandBufferAllocateInfo.commandBufferCount = 1;
-    tmpCommandBufferAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
-    std::vector<vk::UniqueCommandBuffer> tmpCommandBuffers = _device->allocateCommandBuffersUnique(tmpCommandBufferAllocateInfo);
-
-    // バッファ間でデータをコピーするには copyBuffer を使う
-    // そしてコピーするバッファやコピーする領域を指定するために vk::BufferCopy 構造体を使う
-    // srcOffsetは転送元バッファの先頭から何バイト目を読み込むというデータ位置、dstOffsetは転送先バッファの先頭から何バイト目に書き込むというデータ位置、sizeはデータサイズを表す
-    // memcpyの引数と似たような感じだと理解すると分かりやすい
-    // あとはキューに投げるだけ
-    vk::BufferCopy bufferCopy;
-    bufferCopy.srcOffset = 0;
-    bufferCopy.dstOffset = 0;
-    bufferCopy.size = sizeof(Vertex) * _vertices.size();
+    // ステージングリングに書き込んでおき、GPUにコピーさせる
+    // コピーは最初のフレームのコマンドバッファの先頭で、他の転送とまとめて行われる
+    // 転送用にコマンドプールを作ったりキューのアイドルを待ったりする必要はない
+    //
+    // 転送先の頂点バッファは頂点入力ステージで頂点属性として読まれるので、そのようにバリアを張ってもらう
+    _stagingRing->uploadBuffer(_vertexBuffer.get(), 0, _vertices.data(), sizeof(Vertex) * _vertices.size(),
+                               vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
+}
 
-    vk::CommandBufferBeginInfo cmdBeginInfo;
-    cmdBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+void Renderer::createIndexBuffer()
+{
+    // インデックスバッファは頂点の番号を並べたもの 同じ頂点を何度も使うメッシュでは頂点バッファが小さくなる
+    // 間接描画のコマンド(vk::DrawIndexedIndirectCommand)はインデックス付きのドローなので、そのためにも要る
+    // 作り方は頂点バッファと同じで、デバイスローカルに置いてステージングリングから転送する
+    vk::BufferCreateInfo indexBufferCreateInfo;
+    indexBufferCreateInfo.size = sizeof(uint16_t) * _indices.size();
+    indexBufferCreateInfo.usage = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    indexBufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+
+    _indexBuffer = _device.get().createBufferUnique(indexBufferCreateInfo);
+    _indexBufferMemory = _memoryAllocator->allocateForBuffer(_indexBuffer.get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    // インデックスは頂点入力ステージで読まれる
+    _stagingRing->uploadBuffer(_indexBuffer.get(), 0, _indices.data(), sizeof(uint16_t) * _indices.size(),
+                               vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead);
+}
 
-    tmpCommandBuffers[0]->begin(cmdBeginInfo);
-    tmpCommandBuffers[0]->copyBuffer(_stagingVertexBuffer.get(), _vertexBuffer.get(), { bufferCopy });
-    tmpCommandBuffers[0]->end();
+void Renderer::createIndirectDrawBuffer()
+{
+    if (!_indirectDraws)
+    {
+        return;
+    }
 
-    vk::CommandBuffer submitCmdBuf[1] = {tmpCommandBuffers[0].get()};
-    vk::SubmitInfo submitInfo;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = submitCmdBuf;
+    // インスタンスのデータの位置をコマンドのfirstInstanceで渡すので、それができない端末では直接描く
+    if (!_drawIndirectFirstInstanceSupported)
+    {
+        LOG("Indirect draws : drawIndirectFirstInstance not supported, using direct draws");
+        _indirectDraws = false;
+        return;
+    }
+    _indirectDrawBuffer = std::make_unique<Vulkan_Test::IndirectDrawBuffer>(_device.get(), *_memoryAllocator, _maxFramesInFlight);
+    LOG("Indirect draws : " << (_drawIndirectCount.isEnabled() ? "drawIndexedIndirectCount" :
+                                _multiDrawIndirectSupported ? "drawIndexedIndirect" : "drawIndexedIndirect (one command per call)"));
+}
 
-    _graphicsQueue.submit({submitInfo});
-    _graphicsQueue.waitIdle();
+void Renderer::createDescriptorAllocators()
+{
+    // デスクリプタセットレイアウトは同じ内容なら1つだけ作り、パイプライン同士で共有する
+    _descriptorLayoutCache = std::make_unique<Vulkan_Test::DescriptorLayoutCache>(_device.get());
+    // デスクリプタプールは足りなくなったら増やす 毎フレーム書き換えるセットはフレームスロットごとにまとめて解放する
+    _frameDescriptorAllocator = std::make_unique<Vulkan_Test::FrameDescriptorAllocator>(_device.get(), _maxFramesInFlight);
 }
 
 void Renderer::createDiscriptorSetLayouts()
@@ -501,20 +646,33 @@ void Renderer::createDiscriptorSetLayouts()
     // stageFlags はデータを渡す対象となるシェーダを示す
     //    今回は頂点シェーダだけに渡すのでvk::ShaderStageFlagBits::eVertexを指定 フラグメントシェーダに渡したい場合はvk::ShaderStageFlagBits::eFragmentを指定します。ビットマスクなので、ORで重ねれば両方に渡すことも可能です。
 
-    vk::DescriptorSetLayoutBinding descSetLayoutBinding[1];
-    descSetLayoutBinding[0].binding = 0;
-    descSetLayoutBinding[0].descriptorType = vk::DescriptorType::eUniformBuffer;
-    descSetLayoutBinding[0].descriptorCount = 1;
-    descSetLayoutBinding[0].stageFlags = vk::ShaderStageFlagBits::eVertex;
+    //
+    // 手で書くとシェーダーとずれてしまうので、バインディングはシェーダーのリフレクションから集める
+    // (今のシェーダーなら、頂点シェーダーのユニフォームバッファがbinding 0、フラグメントシェーダーのテクスチャがbinding 1)
+    // 同じ内容のレイアウトはDescriptorLayoutCacheが1つにまとめる
+    const Vulkan_Test::Shader* vertShader = _shaderRegistry->get("shader_instanced.vert.spv");
+    const Vulkan_Test::Shader* fragShader = _shaderRegistry->get("shader.frag.spv");
+    if (!vertShader || !fragShader)
+    {
+        LOGERR("Failed to load shaders");
+        exit(EXIT_FAILURE);
+    }
+    std::vector<vk::DescriptorSetLayoutBinding> bindings = Vulkan_Test::DescriptorLayoutCache::collectBindings(0, { vertShader, fragShader });
 
-    vk::DescriptorSetLayoutCreateInfo descSetLayoutCreateInfo{};
-    descSetLayoutCreateInfo.bindingCount = std::size(descSetLayoutBinding);
-    descSetLayoutCreateInfo.pBindings = descSetLayoutBinding;
+    // ユニフォームバッファはUniformRingの中の位置をダイナミックオフセットで指定するので、eUniformBufferDynamicにする
+    // シェーダーから見ると普通のユニフォームバッファと変わらない
+    for (vk::DescriptorSetLayoutBinding& binding : bindings)
+    {
+        if (binding.descriptorType == vk::DescriptorType::eUniformBuffer)
+        {
+            binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+        }
+    }
 
     // デスクリプタセットレイアウトを作成したあとはそれをパイプラインレイアウトに設定する必要がある
     // パイプラインは描画の手順を表すオブジェクト
     // 頂点入力デスクリプションなどと同様、シェーダへのデータの読み込ませ方はここで設定する
-    _discriptorSetLayouts.push_back(_device->createDescriptorSetLayoutUnique(descSetLayoutCreateInfo));
+    _discriptorSetLayouts.push_back(_descriptorLayoutCache->get(bindings));
 }
 
 void Renderer::createVertexBindingDescription()
@@ -589,6 +747,33 @@ void Renderer::createVertexBindingDescription()
     _vertexInputAttributeDescriptions[1].location = 1;
     _vertexInputAttributeDescriptions[1].format = vk::Format::eR32G32B32Sfloat;
     _vertexInputAttributeDescriptions[1].offset = offsetof(Vertex, color);
+
+    // インスタンス化
+    // バインディング1はinputRateをeInstanceにして、頂点ごとではなくインスタンスごとに次のデータを読ませる
+    // 同じメッシュを何個も描くときに、位置や色だけをここに並べて1回のドローで描ける
+    vk::VertexInputBindingDescription instanceBindingDescription;
+    instanceBindingDescription.binding = 1;
+    instanceBindingDescription.stride = sizeof(InstanceData);
+    instanceBindingDescription.inputRate = vk::VertexInputRate::eInstance;
+
+    _vertexInputBindingDescriptions.push_back(instanceBindingDescription);
+
+    // 変換行列は1行ずつvec4のアトリビュートにする (1つのアトリビュートに入るのはvec4まで)
+    // location 2はシェーダーのテクスチャ座標が使っているので3から
+    for (uint32_t row = 0; row < 3; row++)
+    {
+        vk::VertexInputAttributeDescription& transformAttribute = _vertexInputAttributeDescriptions.emplace_back();
+        transformAttribute.binding = 1;
+        transformAttribute.location = 3 + row;
+        transformAttribute.format = vk::Format::eR32G32B32A32Sfloat;
+        transformAttribute.offset = offsetof(InstanceData, transform) + sizeof(float) * 4 * row;
+    }
+
+    vk::VertexInputAttributeDescription& colorAttribute = _vertexInputAttributeDescriptions.emplace_back();
+    colorAttribute.binding = 1;
+    colorAttribute.location = 6;
+    colorAttribute.format = vk::Format::eR8G8B8A8Unorm;
+    colorAttribute.offset = offsetof(InstanceData, color);
 }
 
 
@@ -615,7 +800,6 @@ void Renderer::createRenderPass()
 {
 
 
-    _attachmentDescriptions.emplace_back();
     _attachmentDescriptions.emplace_back();
 
     // flags: アタッチメントに関する追加のフラグを指定する。例えば、vk::AttachmentDescriptionFlagBits::eMayAlias は、異なるレンダーパスにおいて同じメモリ領域がエイリアスされる可能性があることを示す。
@@ -660,23 +844,37 @@ void Renderer::createRenderPass()
     // finalLayout: レンダーパス終了後の、アタッチメントの最終レイアウトを指定する。
     // レンダーパスの後にどのようにアタッチメントを使用するかによって適切なレイアウトを選択する必要がある。
     // 例えば、描画結果をスワップチェーンに表示する場合は vk::ImageLayout::ePresentSrcKHR、次のレンダーパスで入力として使用する場合は vk::ImageLayout::eShaderReadOnlyOptimal などが考えられる。
-    _attachmentDescriptions[0].finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    // ヘッドレスでは表示せずにバッファへコピーして読み戻すので、転送元に向いたレイアウトにする
+    _attachmentDescriptions[0].finalLayout = _headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
 
     // レンダーパスは描画処理の大まかな流れを表すオブジェクト
     // 今までは画像一枚を出力するだけだったが、深度バッファが関わる場合は少し設定を変える必要がある
     // 具体的には、深度バッファもアタッチメントの一種という扱いなのでその設定をする
-    _attachmentDescriptions[1].format = vk::Format::eD32Sfloat;
-    _attachmentDescriptions[1].samples = vk::SampleCountFlagBits::e1;
-    _attachmentDescriptions[1].loadOp = vk::AttachmentLoadOp::eClear;
+    //
+    // 深度バッファのイメージはまだ作っておらず、フレームバッファもカラーの1枚しか持たない
+    // アタッチメントの数がフレームバッファと食い違うと作成時にエラーになるので、深度バッファを作るまでは無効にしておく
+    //_attachmentDescriptions[1].format = vk::Format::eD32Sfloat;
+    //_attachmentDescriptions[1].samples = vk::SampleCountFlagBits::e1;
+    //_attachmentDescriptions[1].loadOp = vk::AttachmentLoadOp::eClear;
     // storeOpはeDontCareにする
     // 深度バッファの最終的な値はどうでもいいため
-    _attachmentDescriptions[1].storeOp = vk::AttachmentStoreOp::eDontCare;
-    _attachmentDescriptions[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    _attachmentDescriptions[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    _attachmentDescriptions[1].initialLayout = vk::ImageLayout::eUndefined;
+    //_attachmentDescriptions[1].storeOp = vk::AttachmentStoreOp::eDontCare;
+    //_attachmentDescriptions[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    //_attachmentDescriptions[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    //_attachmentDescriptions[1].initialLayout = vk::ImageLayout::eUndefined;
     // finalLayoutはeDepthStencilAttachmentOptimalを指定
     // 深度バッファとして使うイメージはこのレイアウトになっていると良いとされている
-    _attachmentDescriptions[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    //_attachmentDescriptions[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+    // ヘッドレスではレンダーパスの後でイメージをバッファにコピーする
+    // カラーアタッチメントへの書き込み(と最終レイアウトへの遷移)が終わってからコピーが読むように依存関係を書いておく
+    vk::SubpassDependency readbackDependency;
+    readbackDependency.srcSubpass = 0;
+    readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readbackDependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    readbackDependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    readbackDependency.dstStageMask = vk::PipelineStageFlagBits::eTransfer;
+    readbackDependency.dstAccessMask = vk::AccessFlagBits::eTransferRead;
 
 
 
@@ -686,8 +884,8 @@ void Renderer::createRenderPass()
     renderPassCreateInfo.pAttachments = _attachmentDescriptions.data();
     renderPassCreateInfo.subpassCount = _subpassDescriptions.size();
     renderPassCreateInfo.pSubpasses = _subpassDescriptions.data();
-    renderPassCreateInfo.dependencyCount = 0;
-    renderPassCreateInfo.pDependencies = nullptr;
+    renderPassCreateInfo.dependencyCount = _headless ? 1 : 0;
+    renderPassCreateInfo.pDependencies = _headless ? &readbackDependency : nullptr;
 
     // レンダーパスを作成
 
@@ -704,29 +902,38 @@ void Renderer::createRenderPass()
 
 void Renderer::createPipeline()
 {
-    vk::PipelineLayoutCreateInfo layoutCreateInfo;
-    layoutCreateInfo.setLayoutCount = _discriptorSetLayouts.size();
-    std::shared_ptr<std::vector<vk::DescriptorSetLayout>> unwrapedDescSetLayouts = Vulkan_Test::unwrapHandles<vk::DescriptorSetLayout, vk::UniqueDescriptorSetLayout>(_discriptorSetLayouts);
-    layoutCreateInfo.pSetLayouts = unwrapedDescSetLayouts.get()->data();
-    layoutCreateInfo.pushConstantRangeCount = 0;
+    TRACE_SCOPE("create pipeline");
+
+    // 頂点シェーダーとフラグメントシェーダー
+    // モジュールはレジストリが持っているので、パイプラインを作り直しても読み直さない
+    // 頂点シェーダーはバインディング1のインスタンスのデータ(location 3～6)を使う版 (InstanceData.hppを参照)
+    const Vulkan_Test::Shader* vertShader = _shaderRegistry->get("shader_instanced.vert.spv");
+    const Vulkan_Test::Shader* fragShader = _shaderRegistry->get("shader.frag.spv");
+    if (!vertShader || !fragShader)
+    {
+        LOGERR("Failed to load shaders");
+        exit(EXIT_FAILURE);
+    }
 
-    _pipelineLayout = _device->createPipelineLayoutUnique(layoutCreateInfo);
+    // レイアウトは描画先の大きさに依存しないので、作り直すときも最初に作ったものを使う
+    // (コンパイル中のパイプラインが参照しているので、ここで破棄してはいけない)
+    if (!_pipelineLayout)
+    {
+        vk::PipelineLayoutCreateInfo layoutCreateInfo;
+        layoutCreateInfo.setLayoutCount = _discriptorSetLayouts.size();
+        layoutCreateInfo.pSetLayouts = _discriptorSetLayouts.data();
 
+        // プッシュ定数を使うステージはリフレクションから決める
+        _objectPushConstants = Vulkan_Test::PushConstantBlock<ObjectData>({ vertShader, fragShader });
+        vk::PushConstantRange pushConstantRange = _objectPushConstants.getRange();
+        layoutCreateInfo.pushConstantRangeCount = _objectPushConstants.isUsed() ? 1 : 0;
+        layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        _pipelineLayout = _device->createPipelineLayoutUnique(layoutCreateInfo);
+    }
 
 
 
-    // 2種類の頂点入力デスクリプションを作成したら、それをパイプラインに設定する
-    // 頂点入力デスクリプションはvk::PipelineVertexInputStateCreateInfo構造体に設定する
-    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
-    vertexInputInfo.vertexBindingDescriptionCount = _vertexInputBindingDescriptions.size();
-    vertexInputInfo.pVertexBindingDescriptions = _vertexInputBindingDescriptions.data();
-    vertexInputInfo.vertexAttributeDescriptionCount = _vertexInputAttributeDescriptions.size();
-    vertexInputInfo.pVertexAttributeDescriptions = _vertexInputAttributeDescriptions.data();
-
-    // 深度バッファを有効化するための設定を入れる構造体
-    vk::PipelineDepthStencilStateCreateInfo depthstencil;
-    depthstencil.depthTestEnable = false;
-    depthstencil.stencilTestEnable = false;
 
     // パイプラインとは、3DCGの基本的な描画処理をひとつながりにまとめたもの
     // パイプラインは「点の集まりで出来た図形を色のついたピクセルの集合に変換するもの」
@@ -741,111 +948,42 @@ void Renderer::createPipeline()
     // Vulkanにおけるパイプラインには「グラフィックスパイプライン」と「コンピュートパイプライン」の2種類がある
     // コンピュートパイプラインはGPGPUなどに使うもの
     // 今回は普通に描画が目的なのでグラフィックスパイプラインを作成する
-    // グラフィックスパイプラインはvk::DeviceのcreateGraphicsPipelineメソッドで作成できる
-
-    vk::Viewport viewports[1];
-    viewports[0].x = 0.0;
-    viewports[0].y = 0.0;
-    viewports[0].minDepth = 0.0;
-    viewports[0].maxDepth = 1.0;
-    viewports[0].width = _surfaceCapabilities.currentExtent.width;
-    viewports[0].height = _surfaceCapabilities.currentExtent.height;
-
-    vk::Rect2D scissors[1];
-    scissors[0].offset = vk::Offset2D(0, 0);
-    scissors[0].extent = _surfaceCapabilities.currentExtent;
-
-    vk::PipelineViewportStateCreateInfo viewportState;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = viewports;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = scissors;
-
-    vk::PipelineInputAssemblyStateCreateInfo inputAssembly;
-    inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
-    inputAssembly.primitiveRestartEnable = false;
-
-    vk::PipelineRasterizationStateCreateInfo rasterizer;
-    rasterizer.depthClampEnable = false;
-    rasterizer.rasterizerDiscardEnable = false;
-    rasterizer.polygonMode = vk::PolygonMode::eFill;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = vk::CullModeFlagBits::eBack;
-    rasterizer.frontFace = vk::FrontFace::eClockwise;
-    rasterizer.depthBiasEnable = false;
-
-    vk::PipelineMultisampleStateCreateInfo multisample;
-    multisample.sampleShadingEnable = false;
-    multisample.rasterizationSamples = vk::SampleCountFlagBits::e1;
-
-    vk::PipelineColorBlendAttachmentState blendattachment[1];
-    blendattachment[0].colorWriteMask =
-            vk::ColorComponentFlagBits::eA |
-            vk::ColorComponentFlagBits::eR |
-            vk::ColorComponentFlagBits::eG |
-            vk::ColorComponentFlagBits::eB;
-    blendattachment[0].blendEnable = false;
-
-    vk::PipelineColorBlendStateCreateInfo blend;
-    blend.logicOpEnable = false;
-    blend.attachmentCount = 1;
-    blend.pAttachments = blendattachment;
-
-    vk::UniqueShaderModule vertShader;
-    vk::UniqueShaderModule fragShader;
-    {
-        AAssetManager* assetManager = _pApp->activity->assetManager;
-
-        // 頂点シェーダーを読み込む
-        std::vector<char> vertSpvFileData;
-        AAsset* vertSpvFile = AAssetManager_open(assetManager, "shader.vert.spv", AASSET_MODE_BUFFER);
-        size_t vertSpvFileSz = AAsset_getLength(vertSpvFile);
-        vertSpvFileData.resize(vertSpvFileSz);
-        AAsset_read(vertSpvFile, vertSpvFileData.data(), vertSpvFileSz);
-        AAsset_close(vertSpvFile);
-
-        vk::ShaderModuleCreateInfo vertShaderCreateInfo;
-        vertShaderCreateInfo.codeSize = vertSpvFileSz;
-        vertShaderCreateInfo.pCode = reinterpret_cast<const uint32_t*>(vertSpvFileData.data());
-        vertShader = _device.get().createShaderModuleUnique(vertShaderCreateInfo);
-
-        // フラグメントシェーダーを読み込む
-        std::vector<char> fragSpvFileData;
-        AAsset* fragSpvFile = AAssetManager_open(assetManager, "shader.frag.spv", AASSET_MODE_BUFFER);
-        size_t fragSpvFileSz = AAsset_getLength(fragSpvFile);
-        fragSpvFileData.resize(fragSpvFileSz);
-        AAsset_read(fragSpvFile, fragSpvFileData.data(), fragSpvFileSz);
-        AAsset_close(fragSpvFile);
-
-        vk::ShaderModuleCreateInfo fragShaderCreateInfo;
-        fragShaderCreateInfo.codeSize = fragSpvFileSz;
-        fragShaderCreateInfo.pCode = reinterpret_cast<const uint32_t*>(fragSpvFileData.data());
-        fragShader = _device.get().createShaderModuleUnique(fragShaderCreateInfo);
-    }
-
-    vk::PipelineShaderStageCreateInfo shaderStage[2];
-    shaderStage[0].stage = vk::ShaderStageFlagBits::eVertex;
-    shaderStage[0].module = vertShader.get();
-    shaderStage[0].pName = "main";
-    shaderStage[1].stage = vk::ShaderStageFlagBits::eFragment;
-    shaderStage[1].module = fragShader.get();
-    shaderStage[1].pName = "main";
-
-    vk::GraphicsPipelineCreateInfo pipelineCreateInfo;
-    pipelineCreateInfo.pViewportState = &viewportState;
-    pipelineCreateInfo.pVertexInputState = &vertexInputInfo;
-    pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
-    pipelineCreateInfo.pRasterizationState = &rasterizer;
-    pipelineCreateInfo.pMultisampleState = &multisample;
-    pipelineCreateInfo.pColorBlendState = &blend;
-    pipelineCreateInfo.pDepthStencilState = &depthstencil;
-    pipelineCreateInfo.layout = _pipelineLayout.get();
-    pipelineCreateInfo.renderPass = _renderPass.get();
-    pipelineCreateInfo.subpass = 0;
-    pipelineCreateInfo.stageCount = std::size(shaderStage);
-    pipelineCreateInfo.pStages = shaderStage;
-
-    _pipeline = _device.get().createGraphicsPipelineUnique(nullptr, pipelineCreateInfo).value;
+    //
+    // 作成(シェーダーのコンパイル)には時間がかかるので、PipelineCompilerでワーカースレッドに任せる
+    // コンパイルが終わるまでは_pipeline.get()が空になり、render()はドローを飛ばす
+    //
+    // パイプラインの状態はPipelineDescという値で表し、同じdescなら作ったものを使い回す
+    // ビューポートとシザーは動的ステートにしたので、画面の大きさが変わってもパイプラインは作り直さない
+
+    Vulkan_Test::PipelineDesc desc;
+    desc.vertexShader = vertShader;
+    desc.fragmentShader = fragShader;
+    // 2種類の頂点入力デスクリプションを作成したら、それをパイプラインに設定する
+    if (!desc.setVertexInput(_vertexInputBindingDescriptions, _vertexInputAttributeDescriptions))
+    {
+        LOGERR("Too many vertex inputs");
+        exit(EXIT_FAILURE);
+    }
+    desc.topology = vk::PrimitiveTopology::eTriangleList;
+    desc.cullMode = vk::CullModeFlagBits::eBack;
+    desc.frontFace = vk::FrontFace::eClockwise;
+    desc.layout = _pipelineLayout.get();
+    desc.renderPass = _renderPass.get();
+    desc.subpass = 0;
+
+    // 拡張動的ステートが使えるなら、動的にした部分を揃えたdescでパイプラインを探す
+    // 本来の値は_pipelineDescに残しておき、描画するときにコマンドで設定する
+    _pipelineDesc = desc;
+    _pipeline = _pipelineObjectCache->get(_extendedDynamicState.isEnabled() ? desc.withExtendedDynamicState() : desc, "triangle");
+
+    // カリングだけが違うマテリアル 拡張動的ステートが使えればキャッシュに当たり、パイプラインは増えない
+    desc.cullMode = vk::CullModeFlagBits::eNone;
+    _doubleSidedPipelineDesc = desc;
+    _doubleSidedPipeline = _pipelineObjectCache->get(_extendedDynamicState.isEnabled() ? desc.withExtendedDynamicState() : desc, "triangle (double sided)");
+}
+
+void Renderer::waitForPipelines() {
+    _pipelineCompiler->waitIdle();
 }
 
 
@@ -873,6 +1011,11 @@ void Renderer::createCommandBuffer()
     // そこで毎フレームコマンドバッファをリセットして、コマンドを記録し直す こうすることで毎回別のイメージに向けて描画できる
     // コマンドプール作成時 vk::CommandPoolCreateInfo::flags に vk::CommandPoolCreateFlagBits::eResetCommandBuffer を指定すると、
     // そのコマンドプールから作成したコマンドバッファはリセット可能になる
+    //
+    // ただしコマンドバッファを1つずつリセットするのは、多くのドライバで遅い方の道になる
+    // そこで毎フレーム記録するコマンドバッファは、フレームスロットごとのプール(FrameCommandPools)から取り、
+    // スロットのフェンスを待ったあとにプールごとresetCommandPoolでリセットする
+    // このプールは起動時の転送など、1回きりのコマンドに使う
     cmdPoolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
     _commandPool = _device.get().createCommandPoolUnique(cmdPoolCreateInfo);
 
@@ -884,99 +1027,902 @@ void Renderer::createCommandBuffer()
     // 作るコマンドバッファの数はCommandBufferAllocateInfoの commandBufferCount で指定する
     // commandPoolにはコマンドバッファの作成に使うコマンドプールを指定する
     // このコードではUniqueCommandPoolを使っているので.get()を呼び出して生のCommandPoolを取得している
+    //
+    // フレームインフライトでは、GPUが前のフレームのコマンドバッファを実行している間に次のフレームを記録する
+    // 実行中のコマンドバッファはリセットも再記録もできないので、プールはフレームスロットの数だけ用意する
+    // コマンドバッファはプールから初めて取られたときに作られ、それ以降は空きリストから使い回される
+    _frameCommandPools = std::make_unique<Vulkan_Test::FrameCommandPools>(_device.get(), _queueFamilyIndex, _maxFramesInFlight);
+
+    // 並列記録では、ワーカースレッドごとのセカンダリコマンドバッファに記録してからプライマリで実行する
+    if (_parallelRecording)
+    {
+        _recordThreadPool = std::make_unique<Vulkan_Test::ThreadPool>(0, "record");
+        _parallelCommandRecorder = std::make_unique<Vulkan_Test::ParallelCommandRecorder>(_device.get(), _queueFamilyIndex, _maxFramesInFlight, *_recordThreadPool);
+        LOG("Parallel recording : " << _parallelCommandRecorder->getMaxSliceCount() << " slices");
+    }
+}
+
+void Renderer::createTransferCommandBuffer()
+{
+    if (!_transferQueueFamilyIndex)
+    {
+        return;
+    }
+
+    // コマンドバッファは送信先のキューファミリのコマンドプールから作らなければならないので、転送キュー用にプールを分ける
+    // 転送のコマンドバッファは同じフレームスロットのグラフィックスのコマンドバッファより先に終わる
+    // (グラフィックス側がセマフォで待つため) ので、スロットのフェンスを待てばプールごとリセットしてよい
+    _transferFrameCommandPools = std::make_unique<Vulkan_Test::FrameCommandPools>(_device.get(), _transferQueueFamilyIndex.value(), _maxFramesInFlight);
+}
+
+void Renderer::createDefaultTexture()
+{
+    // フラグメントシェーダーはbinding 1のテクスチャを必ずサンプリングするので、テクスチャを使わない描画にも何か書いておく必要がある
+    // 1x1の白いテクスチャなら頂点カラーがそのまま出る
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = vk::Format::eR8G8B8A8Unorm;
+    imageCreateInfo.extent = vk::Extent3D(1, 1, 1);
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    imageCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    _defaultTexture = _device->createImageUnique(imageCreateInfo);
+    _defaultTextureMemory = _memoryAllocator->allocateForImage(_defaultTexture.get(), vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::ImageViewCreateInfo viewCreateInfo;
+    viewCreateInfo.image = _defaultTexture.get();
+    viewCreateInfo.viewType = vk::ImageViewType::e2D;
+    viewCreateInfo.format = imageCreateInfo.format;
+    viewCreateInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    _defaultTextureView = _device->createImageViewUnique(viewCreateInfo);
+
+    vk::SamplerCreateInfo samplerCreateInfo;
+    samplerCreateInfo.magFilter = vk::Filter::eLinear;
+    samplerCreateInfo.minFilter = vk::Filter::eLinear;
+    samplerCreateInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
+    samplerCreateInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
+    samplerCreateInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+    _defaultSampler = _device->createSamplerUnique(samplerCreateInfo);
+
+    // 起動時に1回だけなので、ステージングリングを通さずにその場で転送して完了を待つ
+    vk::BufferCreateInfo stagingCreateInfo;
+    stagingCreateInfo.size = 4;
+    stagingCreateInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    stagingCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+    vk::UniqueBuffer stagingBuffer = _device->createBufferUnique(stagingCreateInfo);
+    Vulkan_Test::MemoryAllocation stagingMemory = _memoryAllocator->allocateForBuffer(stagingBuffer.get(), vk::MemoryPropertyFlagBits::eHostVisible);
+    const uint8_t white[4] = { 255, 255, 255, 255 };
+    std::memcpy(stagingMemory.pMapped, white, sizeof(white));
+    _memoryAllocator->flush(stagingMemory);
+
     vk::CommandBufferAllocateInfo cmdBufferAllocateInfo;
     cmdBufferAllocateInfo.commandPool = _commandPool.get();
     cmdBufferAllocateInfo.commandBufferCount = 1;
     cmdBufferAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    vk::UniqueCommandBuffer commandBuffer = std::move(_device->allocateCommandBuffersUnique(cmdBufferAllocateInfo)[0]);
 
-    // allocateCommandBufferではなくallocateCommandBuffersである名前から分かる通り、一度にいくつも作れる仕様になっている
-    _commandBuffers = _device.get().allocateCommandBuffersUnique(cmdBufferAllocateInfo);
+    vk::CommandBufferBeginInfo cmdBeginInfo;
+    cmdBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    commandBuffer->begin(cmdBeginInfo);
+
+    vk::ImageMemoryBarrier toTransferDst;
+    toTransferDst.srcAccessMask = {};
+    toTransferDst.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toTransferDst.oldLayout = vk::ImageLayout::eUndefined;
+    toTransferDst.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    toTransferDst.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransferDst.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransferDst.image = _defaultTexture.get();
+    toTransferDst.subresourceRange = viewCreateInfo.subresourceRange;
+    commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, { toTransferDst });
+
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageExtent = imageCreateInfo.extent;
+    commandBuffer->copyBufferToImage(stagingBuffer.get(), _defaultTexture.get(), vk::ImageLayout::eTransferDstOptimal, { region });
+
+    vk::ImageMemoryBarrier toShaderRead = toTransferDst;
+    toShaderRead.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toShaderRead.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    toShaderRead.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    toShaderRead.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, { toShaderRead });
+
+    commandBuffer->end();
+
+    vk::CommandBuffer submitCmdBuf[1] = { commandBuffer.get() };
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = std::size(submitCmdBuf);
+    submitInfo.pCommandBuffers = submitCmdBuf;
+    _graphicsQueue.submit({ submitInfo }, nullptr);
+    _graphicsQueue.waitIdle();
+
+    _memoryAllocator->free(stagingMemory);
 }
 
-////////////////// public functions //////////////////
+void Renderer::createProfiler()
+{
+    // GPUの区間はグラフィックスキューのコマンドバッファに積む
+    _profiler = std::make_unique<Vulkan_Test::Profiler>(_physicalDevice, _device.get(), _queueFamilyIndex, _maxFramesInFlight, _profilerReportInterval);
+    // トレースにGPUの区間をCPUの区間と同じ時間軸で並べるため、GPUのタイムスタンプとCPUの時刻の差を測っておく
+    _profiler->calibrateGpuClock(_graphicsQueue, _queueFamilyIndex);
+    Vulkan_Test::TraceRecorder::get().setThreadName("render");
+    Vulkan_Test::Logger::get().setThreadName("render");
+}
 
-void Renderer::render() {
+void Renderer::createSyncObjects()
+{
+    // セマフォはGPU同士(キューの処理同士)の待ち合わせ、フェンスはCPUがGPUの処理を待つためのもの
+    // イメージの取得→描画→表示の流れはすべてセマフォでつなぎ、CPUがこの流れの途中で待つことはない
+    // フェンスはフレームスロットを使い回すときにCPUが待つためだけに使う
+    //
+    // _imageAcquiredSemaphores: スワップチェーンのイメージが使えるようになったことをsubmitに伝える (フレームスロットごと)
+    // _renderFinishedSemaphores: 描画が終わったことをpresentに伝える (スワップチェーンのイメージごと)
+    // _inFlightFences: そのフレームスロットのコマンドバッファの実行が終わったことをCPUに伝える
+    //
+    // presentが待つセマフォはプレゼンテーションエンジンがいつ使い終わるか分からない
+    // 次に同じイメージが取得できたときには確実に使い終わっているので、イメージごとに持たせる
+    //
+    // フェンスはシグナル状態で作っておく
+    // そうしないと最初のフレームでまだ一度も投げていないコマンドを永遠に待つことになる
+    vk::SemaphoreCreateInfo semaphoreCreateInfo;
+    vk::FenceCreateInfo fenceCreateInfo;
+    fenceCreateInfo.flags = vk::FenceCreateFlagBits::eSignaled;
+
+    _imageAcquiredSemaphores.resize(_maxFramesInFlight);
+    _inFlightFences.resize(_maxFramesInFlight);
+    _frameSlotNumbers = std::vector<uint64_t>(_maxFramesInFlight, 0);
+    for (uint32_t i = 0; i < _maxFramesInFlight; i++)
+    {
+        _imageAcquiredSemaphores[i] = _device->createSemaphoreUnique(semaphoreCreateInfo);
+        _inFlightFences[i] = _device->createFenceUnique(fenceCreateInfo);
+    }
 
-    _device->resetFences({ _swapchainImgFence.get() });
+    // 転送キューでのコピーが終わったことをグラフィックスキューに伝えるセマフォ
+    // 同じフレームのsubmit同士をつなぐだけなので、CPUは待たない
+    if (_transferQueueFamilyIndex)
+    {
+        _uploadFinishedSemaphores.resize(_maxFramesInFlight);
+        for (uint32_t i = 0; i < _maxFramesInFlight; i++)
+        {
+            _uploadFinishedSemaphores[i] = _device->createSemaphoreUnique(semaphoreCreateInfo);
+        }
+    }
 
-    vk::ResultValue acquireImgResult = _device->acquireNextImageKHR(_swapchain.get(), 1'000'000'000, {}, _swapchainImgFence.get());
+    createSwapchainSyncObjects();
 
-    // 再作成処理
-    if(acquireImgResult.result == vk::Result::eSuboptimalKHR || acquireImgResult.result == vk::Result::eErrorOutOfDateKHR)
+    // タイムラインセマフォは64bitのカウンタを持つセマフォ
+    // submitのたびにフレーム番号でシグナルしておけば、getSemaphoreCounterValueでGPUが終えたフレームがわかる
+    if (_timelineSemaphoreSupported)
     {
-        LOGERR("Recreate swapchain : " << to_string(acquireImgResult.result));
-        return;
+        vk::SemaphoreTypeCreateInfo semaphoreTypeCreateInfo;
+        semaphoreTypeCreateInfo.semaphoreType = vk::SemaphoreType::eTimeline;
+        semaphoreTypeCreateInfo.initialValue = 0;
+
+        vk::SemaphoreCreateInfo timelineSemaphoreCreateInfo;
+        timelineSemaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+        _frameTimelineSemaphore = _device->createSemaphoreUnique(timelineSemaphoreCreateInfo);
     }
-    if (acquireImgResult.result != vk::Result::eSuccess)
+}
+
+// スワップチェーンのイメージごとに持つ同期オブジェクト
+// スワップチェーンを作り直すとイメージの数が変わることがあるので、createSyncObjectsとは分けてある
+void Renderer::createSwapchainSyncObjects()
+{
+    vk::SemaphoreCreateInfo semaphoreCreateInfo;
+
+    _renderFinishedSemaphores.clear();
+    _renderFinishedSemaphores.resize(_swapchainImages.size());
+    for (size_t i = 0; i < _swapchainImages.size(); i++)
     {
-        LOGERR("Failed to get next frame");
-        exit(EXIT_FAILURE);
+        _renderFinishedSemaphores[i] = _device->createSemaphoreUnique(semaphoreCreateInfo);
     }
+    // スワップチェーンのイメージ数とフレームスロット数は一致するとは限らない
+    // 取得したイメージを別のスロットがまだ描画中かもしれないので、イメージごとに最後に使ったスロットのフェンスを覚えておく
+    _imagesInFlight = std::vector<vk::Fence>(_swapchainImages.size(), nullptr);
+}
 
+////////////////// public functions //////////////////
 
+// ウィンドウのサイズや向きが変わったときに呼ぶ
+// 実際の作り直しは次のrender()の先頭で行う
+void Renderer::requestSwapchainRecreation() {
+    _swapchainDirty = true;
+}
 
-    uint32_t imgIndex = acquireImgResult.value;
+// スワップチェーンとそれに依存するもの(イメージビュー・フレームバッファ・イメージごとのセマフォ)だけを作り直す
+// インスタンス・デバイス・パイプライン・バッファなどはそのまま使い続けるので、Rendererを作り直すよりずっと速い
+void Renderer::recreateSwapchain() {
+    // ヘッドレスの描画先は大きさが変わらないので作り直すものがない
+    if (_headless)
+    {
+        _swapchainDirty = false;
+        return;
+    }
 
-    _commandBuffers[0]->reset();
+    TRACE_SCOPE("recreate swapchain");
 
-    vk::CommandBufferBeginInfo cmdBeginInfo;
-    _commandBuffers[0]->begin(cmdBeginInfo);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    vk::ClearValue clearVal[2];
-    clearVal[0].color.float32[0] = 0.3f;
-    clearVal[0].color.float32[1] = 0.3f;
-    clearVal[0].color.float32[2] = 0.3f;
-    clearVal[0].color.float32[3] = 1.0f;
+    // 古いイメージビューやフレームバッファを使うコマンドが実行中かもしれないので、すべて終わるのを待つ
+    _device->waitIdle();
 
-    // 深度バッファの値は最初は1.0fにクリアされている必要がある
-    // 手前かどうかを判定するためのものなので、初期値は何よりも遠くになっていなければならない
-    // クリッピングにより1.0より遠くは描画されないので、1.0より大きい値でクリアする必要はない
-    //clearVal[1].depthStencil.depth = 1.0f;
+    _surfaceCapabilities = _physicalDevice.getSurfaceCapabilitiesKHR(_surface.get());
 
-    vk::RenderPassBeginInfo renderpassBeginInfo;
-    renderpassBeginInfo.renderPass = _renderPass.get();
-    renderpassBeginInfo.framebuffer = _framebuffer[imgIndex].get();
-    renderpassBeginInfo.renderArea = vk::Rect2D({ 0,0 }, _surfaceCapabilities.currentExtent);
-    renderpassBeginInfo.clearValueCount = 1;
-    renderpassBeginInfo.pClearValues = clearVal;
+    // 最小化などでサイズが0になっているときはスワップチェーンを作れない
+    // サイズが戻るまで作り直しを保留しておく
+    if (_surfaceCapabilities.currentExtent.width == 0 || _surfaceCapabilities.currentExtent.height == 0)
+    {
+        _swapchainDirty = true;
+        return;
+    }
 
-    _commandBuffers[0]->beginRenderPass(renderpassBeginInfo, vk::SubpassContents::eInline);
+    // イメージビューとフレームバッファは古いスワップチェーンのイメージを参照しているので、先に破棄する
+    _framebuffer.clear();
+    _swapchainImageViews.clear();
 
-    _commandBuffers[0]->bindPipeline(vk::PipelineBindPoint::eGraphics, _pipeline.get());
-//    _commandBuffers[0]->bindVertexBuffers(0, { _vertexBuffer.get() }, { 0 });
-//    //_commandBuffers[0]->bindIndexBuffer(indexBuf->get(), 0, vk::IndexType::eUint16);
-//    _commandBuffers[0]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _descpriptorPipelineLayout->get(), 0, { (*descSets)[0].get() }, {});
-//
-//    _commandBuffers[0]->pushConstants(descpriptorPipelineLayout->get(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(ObjectData), &objectData);
-//    _commandBuffers[0]->drawIndexed(indices.size(), 1, 0, 0, 0);
+    createSwapchain();
+    createFramebuffers();
+    createSwapchainSyncObjects();
 
+    // ビューポートとシザーは動的ステートなので、サイズが変わってもパイプラインは作り直さなくてよい
 
-    _commandBuffers[0]->draw(3, 1, 0, 0);
+    _swapchainDirty = false;
 
-    _commandBuffers[0]->endRenderPass();
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG("Recreate swapchain : " << _swapchainExtent.width << "x" << _swapchainExtent.height <<
+        " images: " << _swapchainImages.size() << " (" << elapsedMs << "ms)");
+}
 
-    _commandBuffers[0]->end();
+// スワップチェーンから次に描画するイメージを取得する
+// 取得できなかった(スワップチェーンを作り直した)ときはnulloptを返すので、そのフレームは描画しない
+std::optional<uint32_t> Renderer::acquireNextImage(vk::Semaphore imageAcquiredSemaphore) {
+    // イメージの取得はフェンスではなくセマフォで待ち合わせる
+    // CPUは取得の完了を待たずにコマンドの記録・送信まで進み、GPUがsubmitの中で待つ
+    vk::ResultValue<uint32_t> acquireImgResult = vk::ResultValue<uint32_t>(vk::Result::eErrorOutOfDateKHR, 0);
+    try
+    {
+        acquireImgResult = _device->acquireNextImageKHR(_swapchain.get(), 1'000'000'000, imageAcquiredSemaphore, {});
+    }
+    catch (vk::OutOfDateKHRError&)
+    {
+        // vulkan.hppではeErrorOutOfDateKHRは戻り値ではなく例外になる
+    }
 
-    vk::CommandBuffer submitCmdBuf[1] = { _commandBuffers[0].get() };
-    vk::SubmitInfo submitInfo;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = submitCmdBuf;
-    _graphicsQueue.submit({ submitInfo }, nullptr);
+    // 再作成処理
+    // eErrorOutOfDateKHRのときはイメージが取得できていないので、このフレームは描画せずに作り直す
+    // eSuboptimalKHRのときはイメージもセマフォも有効なので、このフレームは描画・表示してから作り直す
+    if (acquireImgResult.result == vk::Result::eErrorOutOfDateKHR)
+    {
+        recreateSwapchain();
+        return std::nullopt;
+    }
+    if (acquireImgResult.result == vk::Result::eSuboptimalKHR)
+    {
+        LOGDEBUG("Swapchain is suboptimal, recreate after this frame");
+        _swapchainDirty = true;
+    }
+    else if (acquireImgResult.result != vk::Result::eSuccess)
+    {
+        LOGERR("Failed to get next frame : " << to_string(acquireImgResult.result));
+        exit(EXIT_FAILURE);
+    }
 
-    _graphicsQueue.waitIdle();
+    return acquireImgResult.value;
+}
 
+void Renderer::presentImage(uint32_t imgIndex, vk::Semaphore renderFinishedSemaphore) {
     vk::PresentInfoKHR presentInfo;
 
     auto presentSwapchains = { _swapchain.get() };
     auto imgIndices = { imgIndex };
 
+    // 描画が終わるまで表示しないよう、presentにもセマフォを渡す
+    // presentはタイムラインセマフォを待てないので、ここは必ずバイナリセマフォ
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphore;
     presentInfo.swapchainCount = presentSwapchains.size();
     presentInfo.pSwapchains = presentSwapchains.begin();
     presentInfo.pImageIndices = imgIndices.begin();
 
-    _graphicsQueue.presentKHR(presentInfo);
+    vk::Result presentResult = vk::Result::eErrorOutOfDateKHR;
+    try
+    {
+        presentResult = _graphicsQueue.presentKHR(presentInfo);
+    }
+    catch (vk::OutOfDateKHRError&)
+    {
+    }
+    if (presentResult == vk::Result::eSuboptimalKHR || presentResult == vk::Result::eErrorOutOfDateKHR)
+    {
+        LOGDEBUG("Present : " << to_string(presentResult));
+        _swapchainDirty = true;
+    }
+}
 
-    _graphicsQueue.waitIdle();
+void Renderer::buildDrawItems(vk::DescriptorSet frameDescriptorSet)
+{
+    TRACE_SCOPE("build draws");
+
+    _drawList.clear();
+
+    // パイプラインがまだコンパイル中ならドローは作らない (クリアだけが表示される)
+    vk::Pipeline pipeline = _pipeline.get();
+    vk::Pipeline doubleSidedPipeline = _doubleSidedPipeline.get();
+    if (!pipeline || !doubleSidedPipeline)
+    {
+        return;
+    }
+
+    // シーン全体のユニフォームデータはフレームに1回だけリングに書き込み、全てのドローで同じオフセットを使う
+    // バッファやデスクリプタは作らない
+    uint32_t sceneDataOffset = 0;
+    if (!_uniformRing->push(_sceneData, sceneDataOffset))
+    {
+        LOG("Uniform ring is full");
+        return;
+    }
+
+    // オブジェクトは画面を格子に分けたマスに1つずつ置き、インスタンスのデータで位置と色を変える
+    uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(_objectCount))));
+    float cellSize = 2.0f / gridSize;
+
+    uint32_t descriptorSetId = _drawList.getDescriptorSetId(frameDescriptorSet);
+    for (uint32_t i = 0; i < _objectCount; i++)
+    {
+        // マテリアルは片面と両面を交互に使う (並べ替えないと毎回パイプラインを切り替えることになる)
+        uint32_t materialId = i % 2;
+
+        Vulkan_Test::DrawItem item;
+        item.pipeline = materialId == 0 ? pipeline : doubleSidedPipeline;
+        item.pPipelineDesc = materialId == 0 ? &_pipelineDesc : &_doubleSidedPipelineDesc;
+        item.descriptorSet = frameDescriptorSet;
+        item.uniformOffset = sceneDataOffset;
+        item.vertexBuffer = _vertexBuffer.get();
+        item.vertexCount = 3;
+        item.firstVertex = 0;
+        item.indexBuffer = _indexBuffer.get();
+        item.indexType = vk::IndexType::eUint16;
+        item.indexCount = static_cast<uint32_t>(_indices.size());
+        item.firstIndex = 0;
+        // SceneDataの2つの行列を交互に使う
+        item.objectData.id = static_cast<int32_t>(i % 2);
+
+        uint32_t column = i % gridSize;
+        uint32_t row = i / gridSize;
+        float x = -1.0f + cellSize * (column + 0.5f);
+        float y = -1.0f + cellSize * (row + 0.5f);
+        uint32_t red = column * 255 / gridSize;
+        uint32_t green = row * 255 / gridSize;
+        InstanceData instance = InstanceData::translateScale(x, y, cellSize * 0.8f, red | (green << 8) | (0xffu << 16) | (0xffu << 24));
+
+        // 深度はオブジェクトの原点(インスタンスの平行移動の行き先)を行列で変換したときのクリップ空間のz/w (列優先)
+        const float* mvpMatrix = _sceneData.mvpMatrix[item.objectData.id];
+        float clipZ = mvpMatrix[2] * x + mvpMatrix[6] * y + mvpMatrix[14];
+        float clipW = mvpMatrix[3] * x + mvpMatrix[7] * y + mvpMatrix[15];
+        float depth = clipW != 0.0f ? clipZ / clipW : 0.0f;
+
+        _drawList.push(Vulkan_Test::DrawList::makeSortKey(_drawList.getPipelineId(item.pipeline), descriptorSetId, materialId, depth),
+                       item, instance);
+    }
+
+    if (_sortDraws)
+    {
+        _drawList.sort();
+    }
+    if (_instancing)
+    {
+        _drawList.mergeInstances();
+    }
+
+    // インスタンスのデータはフレームに1回まとめてリングに書き込み、ドローごとの位置はfirstInstanceで渡す
+    const std::vector<InstanceData>& instances = _drawList.getInstances();
+    Vulkan_Test::UniformRing::Allocation instanceAllocation = _uniformRing->allocate(sizeof(InstanceData) * instances.size());
+    if (!instanceAllocation)
+    {
+        LOG("Uniform ring is full");
+        _drawList.clear();
+        return;
+    }
+    std::memcpy(instanceAllocation.pMapped, instances.data(), sizeof(InstanceData) * instances.size());
+    _instanceDataOffset = instanceAllocation.offset;
+
+    // 間接描画では、並べ替えてまとめたドローをコマンドにしてバッファに書く
+    // CPUが積むドローは状態の切り替えの数だけになり、オブジェクトの数にほとんどよらない
+    if (_indirectDraws)
+    {
+        _drawList.buildIndirectCommands();
+        if (!_indirectDrawBuffer->upload(*_stagingRing, _drawList.getIndirectCommands(), _drawList.getIndirectCounts()))
+        {
+            LOG("Staging ring is full");
+            _drawList.clear();
+        }
+    }
+}
+
+Vulkan_Test::DrawStats Renderer::recordDrawItems(vk::CommandBuffer commandBuffer, size_t begin, size_t end) const
+{
+    Vulkan_Test::DrawStats stats;
+    const std::vector<Vulkan_Test::DrawItem>& drawItems = _drawList.getItems();
+
+    // セカンダリコマンドバッファには前の状態が引き継がれないので、範囲の最初で必ず全てバインドし直す
+    // それ以降は前のドローと同じものはバインドしない
+    vk::Pipeline boundPipeline;
+    const Vulkan_Test::PipelineDesc* pAppliedDesc = nullptr;
+    vk::DescriptorSet boundDescriptorSet;
+    uint32_t boundUniformOffset = 0;
+    vk::Buffer boundVertexBuffer;
+    vk::Buffer boundIndexBuffer;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const Vulkan_Test::DrawItem& item = drawItems[i];
+
+        if (item.pipeline != boundPipeline)
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, item.pipeline);
+            if (!boundPipeline)
+            {
+                // ビューポートとシザーは動的ステートなので、最初にバインドしたあとに今の描画先の大きさで設定する
+                // どのパイプラインも動的ステートにしているので、パイプラインを替えても設定し直さなくてよい
+                vk::Viewport viewport(0.0f, 0.0f, static_cast<float>(_swapchainExtent.width), static_cast<float>(_swapchainExtent.height), 0.0f, 1.0f);
+                commandBuffer.setViewport(0, { viewport });
+                commandBuffer.setScissor(0, { vk::Rect2D({ 0, 0 }, _swapchainExtent) });
+            }
+            boundPipeline = item.pipeline;
+            stats.pipelineBinds++;
+        }
+        if (item.pPipelineDesc != pAppliedDesc)
+        {
+            _extendedDynamicState.apply(commandBuffer, *item.pPipelineDesc);
+            pAppliedDesc = item.pPipelineDesc;
+        }
+        if (item.descriptorSet != boundDescriptorSet || item.uniformOffset != boundUniformOffset)
+        {
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _pipelineLayout.get(), 0, { item.descriptorSet }, { item.uniformOffset });
+            boundDescriptorSet = item.descriptorSet;
+            boundUniformOffset = item.uniformOffset;
+            stats.descriptorSetBinds++;
+        }
+        if (item.vertexBuffer != boundVertexBuffer)
+        {
+            // インスタンスのデータはフレームで1か所なので、メッシュの頂点バッファと一緒にバインドする
+            commandBuffer.bindVertexBuffers(0, { item.vertexBuffer, _uniformRing->getBuffer() }, { 0, _instanceDataOffset });
+            boundVertexBuffer = item.vertexBuffer;
+            stats.vertexBufferBinds++;
+        }
+        if (item.indexBuffer && item.indexBuffer != boundIndexBuffer)
+        {
+            commandBuffer.bindIndexBuffer(item.indexBuffer, 0, item.indexType);
+            boundIndexBuffer = item.indexBuffer;
+            stats.indexBufferBinds++;
+        }
+
+        // オブジェクトごとのデータはプッシュ定数でコマンドバッファに直接積む
+        if (_objectPushConstants.isUsed())
+        {
+            _objectPushConstants.push(commandBuffer, _pipelineLayout.get(), item.objectData);
+        }
+        if (item.indirectCommandCount > 0)
+        {
+            recordIndirectDraw(commandBuffer, item, stats);
+        }
+        else if (item.indexBuffer)
+        {
+            commandBuffer.drawIndexed(item.indexCount, item.instanceCount, item.firstIndex, static_cast<int32_t>(item.firstVertex), item.firstInstance);
+            stats.draws++;
+        }
+        else
+        {
+            commandBuffer.draw(item.vertexCount, item.instanceCount, item.firstVertex, item.firstInstance);
+            stats.draws++;
+        }
+        stats.instances += item.instanceCount;
+    }
+    return stats;
+}
+
+void Renderer::recordIndirectDraw(vk::CommandBuffer commandBuffer, const Vulkan_Test::DrawItem& item, Vulkan_Test::DrawStats& stats) const
+{
+    vk::Buffer indirectBuffer = _indirectDrawBuffer->getBuffer();
+    vk::DeviceSize commandOffset = _indirectDrawBuffer->getCommandOffset(item.firstIndirectCommand);
+    uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    stats.indirectCommands += item.indirectCommandCount;
+
+    // コマンドの数もバッファから読む 今はCPUが書いた数だが、GPUでカリングすればその結果をそのまま使える
+    if (_drawIndirectCount.isEnabled())
+    {
+        _drawIndirectCount.drawIndexedIndirectCount(commandBuffer, indirectBuffer, commandOffset,
+                                                    indirectBuffer, _indirectDrawBuffer->getCountOffset(item.indirectBatch),
+                                                    item.indirectCommandCount, stride);
+        stats.draws++;
+    }
+    else if (_multiDrawIndirectSupported)
+    {
+        commandBuffer.drawIndexedIndirect(indirectBuffer, commandOffset, item.indirectCommandCount, stride);
+        stats.draws++;
+    }
+    else
+    {
+        // multiDrawIndirectが無ければ1回に1つのコマンドしか描けない
+        for (uint32_t i = 0; i < item.indirectCommandCount; i++)
+        {
+            commandBuffer.drawIndexedIndirect(indirectBuffer, commandOffset + stride * i, 1, stride);
+            stats.draws++;
+        }
+    }
+}
+
+// 描画したイメージを読み戻し用のバッファにコピーするコマンドを積む
+// イメージはレンダーパスの最終レイアウトでeTransferSrcOptimalになっていて、書き込みとの依存関係もレンダーパスに書いてある
+void Renderer::recordReadback(vk::CommandBuffer commandBuffer, uint32_t imgIndex) {
+    vk::BufferImageCopy region;
+    region.bufferOffset = 0;
+    // 0はイメージの大きさのまま詰めて並べるという意味
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = vk::Offset3D(0, 0, 0);
+    region.imageExtent = vk::Extent3D(_swapchainExtent.width, _swapchainExtent.height, 1);
+    commandBuffer.copyImageToBuffer(_swapchainImages[imgIndex], vk::ImageLayout::eTransferSrcOptimal, _readbackBuffer.get(), { region });
+
+    // コピーの書き込みをホストから見えるようにする
+    vk::BufferMemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = _readbackBuffer.get();
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, {}, { barrier }, {});
+}
+
+// ステージングリングに予約された転送をcommandBufferに積む
+// 転送専用キューを使ったときは、グラフィックスキューのsubmitで待つべきセマフォとステージを返す (使わなければ空のまま)
+void Renderer::recordUploads(vk::CommandBuffer commandBuffer, vk::Semaphore& uploadFinishedSemaphore, vk::PipelineStageFlags& uploadWaitStages) {
+    // 転送専用キューがあるときはコピーをそちらに送り、グラフィックスキューはセマフォで完了を待つ
+    // コピーがグラフィックスキューの時間を使わず、前のフレームの描画と並行して進められる
+    // セマフォを待つのは転送先を使うステージ(頂点バッファなら頂点入力)からなので、それより前の処理は待たされない
+    // 転送専用キューに送れるのはまだGPUが使っていないバッファへの初回の転送だけで、書き直しはグラフィックスキューで行われる
+    if (_transferQueueFamilyIndex && _stagingRing->hasPendingFirstUploads())
+    {
+        vk::CommandBuffer transferCommandBuffer = _transferFrameCommandPools->acquire();
+        vk::CommandBufferBeginInfo cmdBeginInfo;
+        cmdBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        transferCommandBuffer.begin(cmdBeginInfo);
+        uploadWaitStages = _stagingRing->recordUploads(transferCommandBuffer, commandBuffer,
+                                                       _transferQueueFamilyIndex.value(), _queueFamilyIndex);
+        transferCommandBuffer.end();
+
+        uploadFinishedSemaphore = _uploadFinishedSemaphores[_currentFrame].get();
+
+        vk::CommandBuffer transferSubmitCmdBuf[1] = { transferCommandBuffer };
+        vk::SubmitInfo transferSubmitInfo;
+        transferSubmitInfo.commandBufferCount = std::size(transferSubmitCmdBuf);
+        transferSubmitInfo.pCommandBuffers = transferSubmitCmdBuf;
+        transferSubmitInfo.signalSemaphoreCount = 1;
+        transferSubmitInfo.pSignalSemaphores = &uploadFinishedSemaphore;
+        _transferQueue.submit({ transferSubmitInfo }, nullptr);
+    }
+    else
+    {
+        _stagingRing->recordUploads(commandBuffer);
+    }
+}
+
+void Renderer::render() {
+
+    if (_swapchainDirty)
+    {
+        recreateSwapchain();
+        if (_swapchainDirty)
+        {
+            return;
+        }
+    }
+
+    // このフレームスロットを前回使ったときのコマンドがGPUで実行し終わるのを待つ
+    // 待つのは_maxFramesInFlightフレーム前の処理なので、その間CPUは次のフレームの準備を進められる
+    vk::Fence inFlightFence = _inFlightFences[_currentFrame].get();
+    {
+        Vulkan_Test::Profiler::CpuScope waitScope(*_profiler, "wait frame");
+        vk::Result waitResult = _device->waitForFences({ inFlightFence }, VK_TRUE, 1'000'000'000);
+        if (waitResult != vk::Result::eSuccess)
+        {
+            LOGERR("Failed to wait frame fence : " << to_string(waitResult));
+            exit(EXIT_FAILURE);
+        }
+    }
+    _completedFrameNumber = std::max(_completedFrameNumber, _frameSlotNumbers[_currentFrame]);
+    _stagingRing->beginFrame(_currentFrame);
+    // このスロットのコマンドバッファはもう実行し終わっているので、プールごとまとめてリセットする
+    _frameCommandPools->beginFrame(_currentFrame);
+    if (_transferFrameCommandPools)
+    {
+        _transferFrameCommandPools->beginFrame(_currentFrame);
+    }
+    _frameDescriptorAllocator->beginFrame(_currentFrame);
+    _uniformRing->beginFrame(_currentFrame);
+    if (_indirectDrawBuffer)
+    {
+        _indirectDrawBuffer->beginFrame(_currentFrame);
+    }
+    if (_parallelCommandRecorder)
+    {
+        _parallelCommandRecorder->beginFrame(_currentFrame);
+    }
+    // このスロットで前回計ったGPUの時間もここで読む (フェンスを待った後なのでGPUを待たずに読める)
+    _profiler->beginFrame(_currentFrame);
+
+    // ヘッドレスではフレームスロットと同じ番号のオフスクリーンイメージに描くので、取得を待つ必要はない
+    vk::Semaphore imageAcquiredSemaphore;
+    uint32_t imgIndex = _currentFrame;
+    if (!_headless)
+    {
+        Vulkan_Test::Profiler::CpuScope acquireScope(*_profiler, "acquire");
+        imageAcquiredSemaphore = _imageAcquiredSemaphores[_currentFrame].get();
+        std::optional<uint32_t> acquiredImgIndex = acquireNextImage(imageAcquiredSemaphore);
+        if (!acquiredImgIndex)
+        {
+            return;
+        }
+        imgIndex = acquiredImgIndex.value();
+    }
+
+    // 取得したイメージに別のフレームスロットがまだ描画しているなら、その完了を待つ
+    // イメージ数がフレームスロット数より少ない場合や、イメージが順番通りに返ってこない場合に起こる
+    if (_imagesInFlight[imgIndex] && _imagesInFlight[imgIndex] != inFlightFence)
+    {
+        vk::Result imageWaitResult = _device->waitForFences({ _imagesInFlight[imgIndex] }, VK_TRUE, 1'000'000'000);
+        if (imageWaitResult != vk::Result::eSuccess)
+        {
+            LOGERR("Failed to wait image fence : " << to_string(imageWaitResult));
+            exit(EXIT_FAILURE);
+        }
+    }
+    _imagesInFlight[imgIndex] = inFlightFence;
+
+    // 確実にsubmitすることが決まってからフェンスをリセットする
+    // 途中でreturnしたときにリセット済みのフェンスが残ると、次にこのスロットを使うときに永遠に待つことになる
+    _device->resetFences({ inFlightFence });
+
+    Vulkan_Test::Profiler::CpuScope recordScope(*_profiler, "record");
+
+    // プールはbeginFrameでリセット済みなので、ここで1つずつリセットしなくてよい
+    vk::CommandBuffer commandBuffer = _frameCommandPools->acquire();
+
+    vk::CommandBufferBeginInfo cmdBeginInfo;
+    cmdBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    commandBuffer.begin(cmdBeginInfo);
+
+    _profiler->recordFrameStart(commandBuffer);
+
+    // このフレームで使うデスクリプタセットは1つだけ
+    // ユニフォームバッファにはリングの先頭とSceneData1つ分の大きさを書いておき、ドローごとの位置はダイナミックオフセットで渡す
+    vk::DescriptorSet frameDescriptorSet = _frameDescriptorAllocator->allocate(_discriptorSetLayouts[0]);
+    _descriptorWriter.writeBuffer(frameDescriptorSet, 0, vk::DescriptorType::eUniformBufferDynamic, _uniformRing->getBuffer(), 0, sizeof(SceneData))
+                     .writeImage(frameDescriptorSet, 1, vk::DescriptorType::eCombinedImageSampler,
+                                 _defaultTextureView.get(), _defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal);
+    _descriptorWriter.update(_device.get());
+
+    buildDrawItems(frameDescriptorSet);
+
+    // このフレームまでに予約された転送をまとめて積む
+    // レンダーパスの中ではコピーできないので、レンダーパスを始める前に行う
+    vk::Semaphore uploadFinishedSemaphore;
+    vk::PipelineStageFlags uploadWaitStages;
+    {
+        // 転送専用キューがあるとき、このスコープが計るのはグラフィックスキュー側のアクワイアと書き直しの転送だけ
+        // 転送キューでのコピーは含まれない (プロファイラのクエリプールはグラフィックスキュー用)
+        const char* uploadScopeName = _transferQueueFamilyIndex ? "uploads (acquire + rewrites)" : "uploads";
+        Vulkan_Test::Profiler::GpuScope uploadScope(*_profiler, commandBuffer, uploadScopeName);
+        recordUploads(commandBuffer, uploadFinishedSemaphore, uploadWaitStages);
+    }
+
+    {
+        Vulkan_Test::Profiler::GpuScope renderPassScope(*_profiler, commandBuffer, "render pass");
+
+        vk::ClearValue clearVal[2];
+        clearVal[0].color.float32[0] = 0.3f;
+        clearVal[0].color.float32[1] = 0.3f;
+        clearVal[0].color.float32[2] = 0.3f;
+        clearVal[0].color.float32[3] = 1.0f;
+
+        // 深度バッファの値は最初は1.0fにクリアされている必要がある
+        // 手前かどうかを判定するためのものなので、初期値は何よりも遠くになっていなければならない
+        // クリッピングにより1.0より遠くは描画されないので、1.0より大きい値でクリアする必要はない
+        //clearVal[1].depthStencil.depth = 1.0f;
+
+        vk::RenderPassBeginInfo renderpassBeginInfo;
+        renderpassBeginInfo.renderPass = _renderPass.get();
+        renderpassBeginInfo.framebuffer = _framebuffer[imgIndex].get();
+        renderpassBeginInfo.renderArea = vk::Rect2D({ 0,0 }, _swapchainExtent);
+        renderpassBeginInfo.clearValueCount = 1;
+        renderpassBeginInfo.pClearValues = clearVal;
+
+        Vulkan_Test::DrawStats frameStats;
+        frameStats.frames = 1;
+
+        // ドローが多ければワーカースレッドでセカンダリコマンドバッファに分けて記録し、プライマリからはそれを実行するだけにする
+        // 1つのレンダーパスの中ではインラインとセカンダリを混ぜられないので、どちらかに決めてから始める
+        bool parallel = _parallelCommandRecorder && _drawList.size() >= kMinDrawsPerRecordSlice * 2;
+        commandBuffer.beginRenderPass(renderpassBeginInfo, parallel ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline);
+
+        if (parallel)
+        {
+            vk::CommandBufferInheritanceInfo inheritanceInfo;
+            inheritanceInfo.renderPass = _renderPass.get();
+            inheritanceInfo.subpass = 0;
+            inheritanceInfo.framebuffer = _framebuffer[imgIndex].get();
+            // 範囲ごとの数はスレッドごとに数え、終わったときに1度だけ足す
+            std::mutex statsMutex;
+            const std::vector<vk::CommandBuffer>& secondaryCommandBuffers = _parallelCommandRecorder->record(
+                    inheritanceInfo, _drawList.size(), kMinDrawsPerRecordSlice,
+                    [this, &frameStats, &statsMutex](vk::CommandBuffer secondaryCommandBuffer, size_t begin, size_t end) {
+                        Vulkan_Test::DrawStats sliceStats = recordDrawItems(secondaryCommandBuffer, begin, end);
+                        std::lock_guard<std::mutex> lock(statsMutex);
+                        frameStats += sliceStats;
+                    });
+            commandBuffer.executeCommands(secondaryCommandBuffers);
+        }
+        else
+        {
+            frameStats += recordDrawItems(commandBuffer, 0, _drawList.size());
+        }
+        _drawStats += frameStats;
+
+        commandBuffer.endRenderPass();
+    }
+
+    // 読み戻しが頼まれていれば、このフレームの描画結果をバッファにコピーする
+    if (_headless && _readbackRequested)
+    {
+        recordReadback(commandBuffer, imgIndex);
+        _readbackRequested = false;
+        _readbackPending = true;
+        _readbackFrameNumber = _frameNumber + 1;
+        _readbackFrameSlot = _currentFrame;
+    }
+
+    commandBuffer.end();
+    recordScope.stop();
+
+    // このフレームにユニフォームリングへ書き込んだ内容をsubmitの前に反映する
+    _uniformRing->flush();
+
+    _frameNumber++;
+    _frameSlotNumbers[_currentFrame] = _frameNumber;
+
+    // イメージの取得が終わるまで待つのはカラーアタッチメントへの書き込みの段階だけでよい
+    // それより前の頂点処理などはイメージの取得と並行して進められる
+    // 転送キューのコピーの完了は、転送先を使うステージで待つ
+    // バイナリセマフォの値は無視されるので0を入れておく
+    std::vector<vk::Semaphore> submitWaitSemaphores;
+    std::vector<vk::PipelineStageFlags> submitWaitStages;
+    std::vector<uint64_t> submitWaitValues;
+    if (imageAcquiredSemaphore)
+    {
+        submitWaitSemaphores.push_back(imageAcquiredSemaphore);
+        submitWaitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+        submitWaitValues.push_back(0);
+    }
+    if (uploadFinishedSemaphore)
+    {
+        submitWaitSemaphores.push_back(uploadFinishedSemaphore);
+        submitWaitStages.push_back(uploadWaitStages);
+        submitWaitValues.push_back(0);
+    }
+
+    // presentに渡すセマフォと、使える端末ではタイムラインセマフォをシグナルする
+    // ヘッドレスではpresentしないので、誰も待たないバイナリセマフォはシグナルしない
+    vk::Semaphore renderFinishedSemaphore = _renderFinishedSemaphores[imgIndex].get();
+    std::vector<vk::Semaphore> submitSignalSemaphores;
+    std::vector<uint64_t> submitSignalValues;
+    if (!_headless)
+    {
+        submitSignalSemaphores.push_back(renderFinishedSemaphore);
+        submitSignalValues.push_back(0);
+    }
+    if (_timelineSemaphoreSupported)
+    {
+        submitSignalSemaphores.push_back(_frameTimelineSemaphore.get());
+        submitSignalValues.push_back(_frameNumber);
+    }
+
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo;
+    timelineSubmitInfo.waitSemaphoreValueCount = submitWaitValues.size();
+    timelineSubmitInfo.pWaitSemaphoreValues = submitWaitValues.data();
+    timelineSubmitInfo.signalSemaphoreValueCount = submitSignalValues.size();
+    timelineSubmitInfo.pSignalSemaphoreValues = submitSignalValues.data();
+
+    vk::CommandBuffer submitCmdBuf[1] = { commandBuffer };
+    vk::SubmitInfo submitInfo;
+    submitInfo.pNext = _timelineSemaphoreSupported ? &timelineSubmitInfo : nullptr;
+    submitInfo.waitSemaphoreCount = submitWaitSemaphores.size();
+    submitInfo.pWaitSemaphores = submitWaitSemaphores.data();
+    submitInfo.pWaitDstStageMask = submitWaitStages.data();
+    submitInfo.commandBufferCount = std::size(submitCmdBuf);
+    submitInfo.pCommandBuffers = submitCmdBuf;
+    submitInfo.signalSemaphoreCount = submitSignalSemaphores.size();
+    submitInfo.pSignalSemaphores = submitSignalSemaphores.data();
+
+    // 実行が終わったらフェンスがシグナルされ、次にこのスロットを使うときにCPUがそれを待つ
+    {
+        Vulkan_Test::Profiler::CpuScope submitScope(*_profiler, "submit");
+        _graphicsQueue.submit({ submitInfo }, inFlightFence);
+    }
+
+    if (!_headless)
+    {
+        Vulkan_Test::Profiler::CpuScope presentScope(*_profiler, "present");
+        presentImage(imgIndex, renderFinishedSemaphore);
+    }
+
+    // 比較用の直列パス
+    // CPUとGPUが重ならないので、フレームインフライトの効果を測るときの基準になる
+    if (_serializeFrames)
+    {
+        _graphicsQueue.waitIdle();
+    }
+
+    _currentFrame = (_currentFrame + 1) % _maxFramesInFlight;
+
+    _frameBenchmark.frame();
+}
+
+// 次のrender()で描画するフレームの結果を読み戻すよう頼む (ヘッドレスのときだけ)
+void Renderer::requestReadback() {
+    if (!_headless)
+    {
+        LOGERR("Readback is only available without a surface");
+        return;
+    }
+    _readbackRequested = true;
+}
+
+// requestReadback()の後のrender()で描画した結果を、R8G8B8A8で1行ずつ詰めて並べたピクセルとして返す
+// GPUがそのフレームを終えるまで待つ 読み戻すものが無ければfalse
+bool Renderer::readback(std::vector<uint8_t>& pixels) {
+    if (!_readbackPending)
+    {
+        return false;
+    }
+
+    // スロットがまだそのフレームのものなら、スロットのフェンスがそのフレームの完了を表す
+    // 別のフレームに使われていれば、そのときrender()がフェンスを待っているのでもう終わっている
+    if (_frameSlotNumbers[_readbackFrameSlot] == _readbackFrameNumber)
+    {
+        vk::Result waitResult = _device->waitForFences({ _inFlightFences[_readbackFrameSlot].get() }, VK_TRUE, UINT64_MAX);
+        if (waitResult != vk::Result::eSuccess)
+        {
+            LOGERR("Failed to wait readback fence : " << to_string(waitResult));
+            return false;
+        }
+    }
+    _readbackPending = false;
+
+    _memoryAllocator->invalidate(_readbackBufferMemory);
+    const uint8_t* pMapped = static_cast<const uint8_t*>(_readbackBufferMemory.pMapped);
+    pixels.assign(pMapped, pMapped + vk::DeviceSize(_swapchainExtent.width) * _swapchainExtent.height * 4);
+    return true;
+}
+
+// GPUが実行を終えたフレームの番号を返す (まだ1フレームも終えていなければ0)
+// ブロックしないので、フレームの途中で「このフレームで使ったリソースはもう解放してよいか」を判断するのに使える
+uint64_t Renderer::getCompletedFrameNumber() {
+    if (_timelineSemaphoreSupported)
+    {
+        _completedFrameNumber = std::max(_completedFrameNumber, _device->getSemaphoreCounterValue(_frameTimelineSemaphore.get()));
+    }
+    return _completedFrameNumber;
 }
 
 void Renderer::handleInput() {
@@ -3,15 +3,68 @@
 #include <vulkan/vulkan.hpp>
 #include "Vec3.hpp"
 #include "Vertex.hpp"
+#include "SceneData.hpp"
+#include "ObjectData.hpp"
+#include "InstanceData.hpp"
 #include "Utility.hpp"
+#include "FrameBenchmark.hpp"
+#include "PresentPolicy.hpp"
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+#include "Platform.hpp"
+#include "Profiler.hpp"
+#include "PipelineCache.hpp"
+#include "ShaderRegistry.hpp"
+#include "ThreadPool.hpp"
+#include "PipelineCompiler.hpp"
+#include "PipelineObjectCache.hpp"
+#include "ExtendedDynamicState.hpp"
+#include "DescriptorLayoutCache.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DescriptorWriter.hpp"
+#include "UniformRing.hpp"
+#include "PushConstants.hpp"
+#include "DrawItem.hpp"
+#include "DrawList.hpp"
+#include "DrawIndirectCount.hpp"
+#include "IndirectDrawBuffer.hpp"
+#include "ParallelCommandRecorder.hpp"
+#include "FrameCommandPools.hpp"
 
-extern "C" {
-    #include <game-activity/native_app_glue/android_native_app_glue.h>
-}
+// Rendererの生成時に渡す設定
+struct RendererConfig {
+    // 同時にGPUへ投げておけるフレームの数 (2～3が目安)
+    uint32_t maxFramesInFlight = 2;
+    // trueにすると毎フレームキューのアイドルを待つ従来の直列パスになる (ベンチマークの比較用)
+    bool serializeFrames = false;
+    // プレゼントモードとスワップチェーンのイメージ数の選び方
+    Vulkan_Test::PresentPolicy presentPolicy = Vulkan_Test::PresentPolicy::throughput();
+    // このフレーム数ごとにプロファイラの統計をログに出す (0なら出さない)
+    uint32_t profilerReportInterval = 0;
+    // 1フレームに描くオブジェクトの数 (ドローの数の負荷を調べる用)
+    uint32_t objectCount = 1;
+    // trueにするとドローが多いときにワーカースレッドでセカンダリコマンドバッファに並列に記録する
+    bool parallelRecording = false;
+    // trueにするとドローをソートキーの順に並べ替えてから記録する (falseは並べ替えない場合との比較用)
+    bool sortDraws = true;
+    // trueにすると同じメッシュとマテリアルのドローを1つのインスタンス描画にまとめる
+    bool instancing = true;
+    // trueにするとドローを間接描画のコマンドにしてバッファに書き、drawIndexedIndirect(Count)で描く
+    bool indirectDraws = false;
+};
 
 class Renderer {
 
-PUBLIC_GET_PRIVATE_SET(android_app*, _pApp);
+// ステージングリングの大きさ 1フレームで転送できる量の上限になる
+static constexpr vk::DeviceSize kStagingRingSize = 8 * 1024 * 1024;
+// ユニフォームリングの1フレーム分の大きさ 1フレームで書けるユニフォームデータの上限になる
+static constexpr vk::DeviceSize kUniformRingSizePerFrame = 1024 * 1024;
+// 並列記録で1つのスレッドに任せるドローの最低数 これより少ないとスレッドに渡す手間の方が大きい
+static constexpr size_t kMinDrawsPerRecordSlice = 64;
+
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::Platform>, _platform);
+// サーフェスを持たないプラットフォームではスワップチェーンの代わりにオフスクリーンのイメージに描く
+PUBLIC_GET_PRIVATE_SET(bool, _headless) = false;
 PUBLIC_GET_PRIVATE_SET(vk::ApplicationInfo, _applicationInfo);
 PUBLIC_GET_PRIVATE_SET(std::vector<const char*>, _instanceRequiredExtensions);
 PUBLIC_GET_PRIVATE_SET(vk::UniqueInstance, _instance);
@@ -23,33 +76,91 @@ PUBLIC_GET_PRIVATE_SET(std::vector<vk::PhysicalDevice>, _cachedPhysicalDevices);
 PUBLIC_GET_PRIVATE_SET(vk::PhysicalDevice, _physicalDevice);
 PUBLIC_GET_PRIVATE_SET(vk::PhysicalDeviceMemoryProperties, _cachedPhysicalDeviceMemoryProperties);
 PUBLIC_GET_PRIVATE_SET(uint32_t, _queueFamilyIndex);
+// 転送専用のキューファミリ (グラフィックスもコンピュートも持たないもの) 無い端末ではnullopt
+PUBLIC_GET_PRIVATE_SET(std::optional<uint32_t>, _transferQueueFamilyIndex);
 PUBLIC_GET_PRIVATE_SET(vk::UniqueDevice, _device);
 PUBLIC_GET_PRIVATE_SET(vk::Queue, _graphicsQueue);
+PUBLIC_GET_PRIVATE_SET(vk::Queue, _transferQueue);
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::MemoryAllocator>, _memoryAllocator);
 PUBLIC_GET_PRIVATE_SET(vk::UniqueSwapchainKHR, _swapchain);
+PUBLIC_GET_PRIVATE_SET(vk::Extent2D, _swapchainExtent);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::PresentPolicy, _presentPolicy);
+PUBLIC_GET_PRIVATE_SET(vk::PresentModeKHR, _presentMode);
+PUBLIC_GET_PRIVATE_SET(uint32_t, _swapchainMinImageCount);
+PUBLIC_GET_PRIVATE_SET(bool, _swapchainDirty) = false;
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::Image>, _swapchainImages);
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueImageView>, _swapchainImageViews);
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueFramebuffer>, _framebuffer);
-PUBLIC_GET_PRIVATE_SET(vk::UniqueFence, _swapchainImgFence);
 
+// ヘッドレスのときの描画先 (フレームスロットごとに1枚)
+// _swapchainImagesにはこれらのハンドルが入るので、フレームバッファなどはスワップチェーンのときと同じように作れる
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueImage>, _offscreenImages);
+PUBLIC_GET_PRIVATE_SET(std::vector<Vulkan_Test::MemoryAllocation>, _offscreenImageMemories);
+// 描画結果をホストから読むためのバッファ
+PUBLIC_GET_PRIVATE_SET(vk::UniqueBuffer, _readbackBuffer);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::MemoryAllocation, _readbackBufferMemory);
+PUBLIC_GET_PRIVATE_SET(bool, _readbackRequested) = false;
+PUBLIC_GET_PRIVATE_SET(bool, _readbackPending) = false;
+// 読み戻すフレームの番号と、そのフレームを送ったフレームスロット
+// フェンスはスロットが再利用されるとリセットされるので、フレーム番号で終わったかを判断する
+PUBLIC_GET_PRIVATE_SET(uint64_t, _readbackFrameNumber) = 0;
+PUBLIC_GET_PRIVATE_SET(uint32_t, _readbackFrameSlot) = 0;
+
+// 原点を中心にした幅1の三角形 (時計回りが表) 置く位置と大きさはインスタンスのデータで決める
 PUBLIC_GET_PRIVATE_SET(std::vector<Vertex>, _vertices) = {
-    Vertex{Vec3{1.0, 1.0, 1.0}, Vec3{0.0, 0.0, 1.0}},
-    Vertex{Vec3{1.0, 1.0, 1.0}, Vec3{0.0, 1.0, 0.0}},
-    Vertex{Vec3{1.0, 1.0, 1.0}, Vec3{1.0, 1.0, 1.0}},
+    Vertex{Vec3{0.0, -0.5, 0.5}, Vec3{0.0, 0.0, 1.0}},
+    Vertex{Vec3{0.5, 0.5, 0.5}, Vec3{0.0, 1.0, 0.0}},
+    Vertex{Vec3{-0.5, 0.5, 0.5}, Vec3{1.0, 1.0, 1.0}},
 };
 
-PUBLIC_GET_PRIVATE_SET(vk::UniqueBuffer, _stagingVertexBuffer);
-PUBLIC_GET_PRIVATE_SET(vk::UniqueDeviceMemory, _stagingVertexBufferMemory);
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::StagingRing>, _stagingRing);
 PUBLIC_GET_PRIVATE_SET(vk::UniqueBuffer, _vertexBuffer);
-PUBLIC_GET_PRIVATE_SET(vk::UniqueDeviceMemory, _vertexBufferMemory);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::MemoryAllocation, _vertexBufferMemory);
+
+PUBLIC_GET_PRIVATE_SET(std::vector<uint16_t>, _indices) = { 0, 1, 2 };
+PUBLIC_GET_PRIVATE_SET(vk::UniqueBuffer, _indexBuffer);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::MemoryAllocation, _indexBufferMemory);
 
-PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueDescriptorSetLayout>, _discriptorSetLayouts);
+// デスクリプタセットレイアウトはキャッシュが持っている
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::DescriptorLayoutCache>, _descriptorLayoutCache);
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::DescriptorSetLayout>, _discriptorSetLayouts);
+// そのフレームだけで使うデスクリプタセットはここから切り出す フレームスロットのフェンスを待ったときにまとめて解放される
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::FrameDescriptorAllocator>, _frameDescriptorAllocator);
+// デスクリプタセットへの書き込みはここに溜めて、まとめて反映する
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::DescriptorWriter, _descriptorWriter);
+// 毎フレーム書き換えるユニフォームデータ ドローごとの位置はダイナミックオフセットで渡す
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::UniformRing>, _uniformRing);
+PUBLIC_GET_PRIVATE_SET(SceneData, _sceneData) = SceneData::identity();
+// テクスチャを指定しない描画に使う1x1の白いテクスチャ
+PUBLIC_GET_PRIVATE_SET(vk::UniqueImage, _defaultTexture);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::MemoryAllocation, _defaultTextureMemory);
+PUBLIC_GET_PRIVATE_SET(vk::UniqueImageView, _defaultTextureView);
+PUBLIC_GET_PRIVATE_SET(vk::UniqueSampler, _defaultSampler);
 
 
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::VertexInputBindingDescription>, _vertexInputBindingDescriptions);
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::VertexInputAttributeDescription>, _vertexInputAttributeDescriptions);
 
-PUBLIC_GET_PRIVATE_SET(vk::UniquePipeline, _pipeline);
+// ディスクに保存するパイプラインキャッシュ パイプラインは全てこれを通して作る
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::PipelineCache>, _pipelineCache);
+// パイプラインはワーカースレッドでコンパイルする
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::ThreadPool>, _threadPool);
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::PipelineCompiler>, _pipelineCompiler);
+// 同じ状態のパイプラインは1度だけコンパイルして使い回す
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::PipelineObjectCache>, _pipelineObjectCache);
+// シェーダーモジュールはパイプラインをまたいで使い回す
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::ShaderRegistry>, _shaderRegistry);
+// コンパイルが終わるまでは空のパイプラインを返す
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::PipelineHandle, _pipeline);
+// 描画したい状態 拡張動的ステートが使えるときは、パイプラインに焼き込まずにこの値をコマンドで設定する
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::PipelineDesc, _pipelineDesc);
+// 裏面も描くマテリアル用 拡張動的ステートが使えるときは_pipelineと同じパイプラインになる
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::PipelineHandle, _doubleSidedPipeline);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::PipelineDesc, _doubleSidedPipelineDesc);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::ExtendedDynamicState, _extendedDynamicState);
 PUBLIC_GET_PRIVATE_SET(vk::UniquePipelineLayout, _pipelineLayout);
+// ドローごとのデータはプッシュ定数で渡す
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::PushConstantBlock<ObjectData>, _objectPushConstants);
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::SubpassDescription>, _subpassDescriptions);
 
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::AttachmentReference>, _attachmentReference);
@@ -58,13 +169,72 @@ PUBLIC_GET_PRIVATE_SET(vk::UniqueRenderPass, _renderPass);
 PUBLIC_GET_PRIVATE_SET(std::vector<vk::AttachmentDescription>, _attachmentDescriptions);
 
 PUBLIC_GET_PRIVATE_SET(vk::UniqueCommandPool, _commandPool);
-PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueCommandBuffer>, _commandBuffers);
+// 毎フレーム記録するコマンドバッファはフレームスロットごとのプールから取り、プールごとリセットする
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::FrameCommandPools>, _frameCommandPools);
+
+// 転送専用キューに送るコマンドバッファと、転送の完了をグラフィックスキューに伝えるセマフォ (フレームスロットごと)
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::FrameCommandPools>, _transferFrameCommandPools);
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueSemaphore>, _uploadFinishedSemaphores);
+
+// フレームインフライト
+// フレームスロットごとにコマンドバッファ・セマフォ・フェンスを1組ずつ持ち、スロットを順番に回して使う
+PUBLIC_GET_PRIVATE_SET(uint32_t, _maxFramesInFlight);
+PUBLIC_GET_PRIVATE_SET(bool, _serializeFrames);
+PUBLIC_GET_PRIVATE_SET(uint32_t, _currentFrame) = 0;
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueSemaphore>, _imageAcquiredSemaphores);
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueSemaphore>, _renderFinishedSemaphores);
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::UniqueFence>, _inFlightFences);
+PUBLIC_GET_PRIVATE_SET(std::vector<vk::Fence>, _imagesInFlight);
+
+// タイムラインセマフォ (Vulkan 1.2 / VK_KHR_timeline_semaphore)
+// 送信したフレームの番号でシグナルするので、GPUがどのフレームまで終えたかをCPUが待たずに調べられる
+PUBLIC_GET_PRIVATE_SET(bool, _timelineSemaphoreSupported) = false;
+PUBLIC_GET_PRIVATE_SET(vk::UniqueSemaphore, _frameTimelineSemaphore);
+PUBLIC_GET_PRIVATE_SET(uint64_t, _frameNumber) = 0;
+PUBLIC_GET_PRIVATE_SET(uint64_t, _completedFrameNumber) = 0;
+PUBLIC_GET_PRIVATE_SET(std::vector<uint64_t>, _frameSlotNumbers);
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::FrameBenchmark, _frameBenchmark) = Vulkan_Test::FrameBenchmark("render");
+
+// CPUの区間とGPUのタイムスタンプによる計測
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::Profiler>, _profiler);
+PUBLIC_GET_PRIVATE_SET(uint32_t, _profilerReportInterval) = 0;
+
+// このフレームのドロー レンダースレッドで作って並べ替え、記録のときはワーカースレッドからも読む
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::DrawList, _drawList);
+PUBLIC_GET_PRIVATE_SET(uint32_t, _objectCount) = 1;
+PUBLIC_GET_PRIVATE_SET(bool, _sortDraws) = true;
+PUBLIC_GET_PRIVATE_SET(bool, _instancing) = true;
+// 間接描画 コマンドのバッファはフレームスロットごとに持ち、ステージングリングで書き込む
+PUBLIC_GET_PRIVATE_SET(bool, _indirectDraws) = false;
+PUBLIC_GET_PRIVATE_SET(bool, _multiDrawIndirectSupported) = false;
+PUBLIC_GET_PRIVATE_SET(bool, _drawIndirectFirstInstanceSupported) = false;
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::DrawIndirectCount, _drawIndirectCount);
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::IndirectDrawBuffer>, _indirectDrawBuffer);
+// このフレームのインスタンスのデータを書いた、ユニフォームリングの中の位置 (頂点入力のバインディング1に渡す)
+PUBLIC_GET_PRIVATE_SET(vk::DeviceSize, _instanceDataOffset) = 0;
+// 起動してから記録したドローとバインドの数
+PUBLIC_GET_PRIVATE_SET(Vulkan_Test::DrawStats, _drawStats);
+PUBLIC_GET_PRIVATE_SET(bool, _parallelRecording) = false;
+// 並列記録用のスレッドはパイプラインのコンパイルとは分ける (長いコンパイルの後ろで記録が待たされないように)
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::ThreadPool>, _recordThreadPool);
+PUBLIC_GET_PRIVATE_SET(std::unique_ptr<Vulkan_Test::ParallelCommandRecorder>, _parallelCommandRecorder);
 
 
 public:
-    Renderer(android_app* pApp)
+    Renderer(std::unique_ptr<Vulkan_Test::Platform> platform, const RendererConfig& config = RendererConfig())
     {
-        _pApp = pApp;
+        _platform = std::move(platform);
+        _headless = !_platform->hasSurface();
+        _maxFramesInFlight = std::max(config.maxFramesInFlight, 1u);
+        _serializeFrames = config.serializeFrames;
+        _presentPolicy = config.presentPolicy;
+        _profilerReportInterval = config.profilerReportInterval;
+        _objectCount = std::max(config.objectCount, 1u);
+        _parallelRecording = config.parallelRecording;
+        _sortDraws = config.sortDraws;
+        _instancing = config.instancing;
+        _indirectDraws = config.indirectDraws;
+        _frameBenchmark = Vulkan_Test::FrameBenchmark(_serializeFrames ? "serialized" : "frames in flight: " + std::to_string(_maxFramesInFlight));
 
         createInstance();
         createSurface();
@@ -72,44 +242,106 @@ public:
         cacheSurfaceData();
         createDevice();
         createGraphicsQueue();
-        createSwapchain();
-        createFramebuffers();
-        createStagingVertexBuffer();
+        createTransferQueue();
+        createMemoryAllocator();
+        createPipelineCache();
+        createShaderRegistry();
+        createPipelineCompiler();
+        if (_headless)
+        {
+            createOffscreenTargets();
+        }
+        else
+        {
+            createSwapchain();
+        }
+        createStagingRing();
+        createUniformRing();
         createVertexBuffer();
-        sendVertexBuffer();
+        createIndexBuffer();
+        createIndirectDrawBuffer();
+        createDescriptorAllocators();
         createDiscriptorSetLayouts();
         createVertexBindingDescription();
-        createRenderPass();
+        // レンダーパスはサブパスの情報を、フレームバッファはレンダーパスを参照するのでこの順番で作る
         createSubpassDescriptions();
+        createRenderPass();
+        createFramebuffers();
         createPipeline();
         createCommandBuffer();
+        createTransferCommandBuffer();
+        createDefaultTexture();
+        createSyncObjects();
+        createProfiler();
     }
 
     virtual ~Renderer()
     {
+        // GPUがまだ使っているかもしれないオブジェクトを破棄しないよう、全ての処理の完了を待つ
+        if (_device)
+        {
+            _device->waitIdle();
+        }
+        // コンパイル中のパイプラインはシェーダーやレイアウトを参照しているので、それらを破棄する前に終わらせる
+        if (_threadPool)
+        {
+            _threadPool->waitIdle();
+        }
+        savePipelineCache();
     }
 
     void handleInput();
     void render();
+    void requestSwapchainRecreation();
+    void recreateSwapchain();
+    uint64_t getCompletedFrameNumber();
+    void requestReadback();
+    bool readback(std::vector<uint8_t>& pixels);
+    // パイプラインキャッシュをファイルに書く (内容が変わっていなければ何もしない)
+    void savePipelineCache();
+    // コンパイル中のパイプラインが全て使えるようになるまで待つ (ヘッドレスで最初のフレームから描画したいときなど)
+    void waitForPipelines();
 
 private:
     void createInstance();
     void createSurface();
     void selectPhysicalDeviceAndQueueFamilyIndex();
     void createGraphicsQueue();
+    void createTransferQueue();
+    void createMemoryAllocator();
+    void createPipelineCache();
+    void createShaderRegistry();
+    void createPipelineCompiler();
     void cacheSurfaceData();
     static std::optional<uint32_t> getQueueFamilyIndex(vk::PhysicalDevice& physicalDevice, vk::UniqueSurfaceKHR& surface);
+    static std::optional<uint32_t> getTransferQueueFamilyIndex(vk::PhysicalDevice& physicalDevice);
     void createDevice();
     void createSwapchain();
+    void createOffscreenTargets();
+    std::optional<uint32_t> acquireNextImage(vk::Semaphore imageAcquiredSemaphore);
+    void presentImage(uint32_t imgIndex, vk::Semaphore renderFinishedSemaphore);
+    void recordReadback(vk::CommandBuffer commandBuffer, uint32_t imgIndex);
+    void recordUploads(vk::CommandBuffer commandBuffer, vk::Semaphore& uploadFinishedSemaphore, vk::PipelineStageFlags& uploadWaitStages);
     void createFramebuffers();
-    void createStagingVertexBuffer();
+    void createStagingRing();
+    void createUniformRing();
     void createVertexBuffer();
-    void sendVertexBuffer();
+    void createIndexBuffer();
+    void createIndirectDrawBuffer();
+    void createDescriptorAllocators();
     void createDiscriptorSetLayouts();
     void createVertexBindingDescription();
     void createRenderPass();
     void createSubpassDescriptions();
     void createPipeline();
     void createCommandBuffer();
+    void createTransferCommandBuffer();
+    void createDefaultTexture();
+    void buildDrawItems(vk::DescriptorSet frameDescriptorSet);
+    Vulkan_Test::DrawStats recordDrawItems(vk::CommandBuffer commandBuffer, size_t begin, size_t end) const;
+    void recordIndirectDraw(vk::CommandBuffer commandBuffer, const Vulkan_Test::DrawItem& item, Vulkan_Test::DrawStats& stats) const;
+    void createSyncObjects();
+    void createProfiler();
+    void createSwapchainSyncObjects();
 
 };
\ No newline at end of file
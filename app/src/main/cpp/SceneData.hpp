@@ -0,0 +1,22 @@
+#pragma once
+
+// 頂点シェーダーのユニフォームブロック (set 0, binding 0) と同じ並び
+//
+// layout(set = 0, binding = 0) uniform SceneData { mat4 mvpMatrix[2]; } sceneData;
+// 行列はGLSLと同じ列優先で、std140では配列の要素の間に隙間はない
+struct SceneData {
+    float mvpMatrix[2][16];
+
+    static SceneData identity()
+    {
+        SceneData data{};
+        for (int m = 0; m < 2; m++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                data.mvpMatrix[m][i * 4 + i] = 1.0f;
+            }
+        }
+        return data;
+    }
+};
@@ -0,0 +1,549 @@
+#include "ShaderRegistry.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Vulkan_Test
+{
+    namespace
+    {
+        // 解析に使うSPIR-Vの命令・列挙値 (SPIR-V仕様 3章)
+        constexpr uint32_t kSpirvMagic = 0x07230203;
+        constexpr uint32_t kSpirvHeaderWords = 5;
+
+        enum SpirvOp : uint32_t
+        {
+            OpEntryPoint = 15,
+            OpTypeInt = 21,
+            OpTypeFloat = 22,
+            OpTypeVector = 23,
+            OpTypeMatrix = 24,
+            OpTypeImage = 25,
+            OpTypeSampler = 26,
+            OpTypeSampledImage = 27,
+            OpTypeArray = 28,
+            OpTypeRuntimeArray = 29,
+            OpTypeStruct = 30,
+            OpTypePointer = 32,
+            OpConstant = 43,
+            OpVariable = 59,
+            OpDecorate = 71,
+            OpMemberDecorate = 72,
+            OpTypeAccelerationStructureKHR = 5341,
+        };
+
+        enum SpirvDecoration : uint32_t
+        {
+            DecorationBlock = 2,
+            DecorationBufferBlock = 3,
+            DecorationArrayStride = 6,
+            DecorationMatrixStride = 7,
+            DecorationBuiltIn = 11,
+            DecorationLocation = 30,
+            DecorationBinding = 33,
+            DecorationDescriptorSet = 34,
+            DecorationOffset = 35,
+        };
+
+        enum SpirvStorageClass : uint32_t
+        {
+            StorageClassUniformConstant = 0,
+            StorageClassInput = 1,
+            StorageClassUniform = 2,
+            StorageClassPushConstant = 9,
+            StorageClassStorageBuffer = 12,
+        };
+
+        // 解析する命令のオペランドの最小の数 (結果の型とIDも数える) これより短い命令は壊れている
+        // 解析しない命令は0
+        uint32_t getMinOperandCount(uint32_t opcode)
+        {
+            switch (opcode)
+            {
+                case OpEntryPoint: return 3;
+                case OpTypeInt: return 3;
+                case OpTypeFloat: return 2;
+                case OpTypeVector: return 3;
+                case OpTypeMatrix: return 3;
+                case OpTypeImage: return 8;
+                case OpTypeSampler: return 1;
+                case OpTypeSampledImage: return 2;
+                case OpTypeArray: return 3;
+                case OpTypeRuntimeArray: return 2;
+                case OpTypeStruct: return 1;
+                case OpTypePointer: return 3;
+                case OpConstant: return 3;
+                case OpVariable: return 3;
+                case OpDecorate: return 2;
+                case OpMemberDecorate: return 3;
+                case OpTypeAccelerationStructureKHR: return 1;
+                default: return 0;
+            }
+        }
+
+        constexpr uint32_t kDimBuffer = 5;
+        constexpr uint32_t kDimSubpassData = 6;
+
+        std::optional<vk::ShaderStageFlagBits> toShaderStage(uint32_t executionModel)
+        {
+            switch (executionModel)
+            {
+                case 0: return vk::ShaderStageFlagBits::eVertex;
+                case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+                case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+                case 3: return vk::ShaderStageFlagBits::eGeometry;
+                case 4: return vk::ShaderStageFlagBits::eFragment;
+                case 5: return vk::ShaderStageFlagBits::eCompute;
+                default: return std::nullopt;
+            }
+        }
+
+        // 解析中に集める、IDごとの情報
+        struct SpirvId
+        {
+            uint32_t opcode = 0;
+            // 型: 要素の型 (ポインタ・配列・ベクトル・行列) / 変数: ポインタの型
+            uint32_t typeId = 0;
+            uint32_t storageClass = 0;
+            // ベクトルの要素数・行列の列数・配列の長さのID・整数と浮動小数のビット数・定数の値
+            uint32_t value = 0;
+            // OpTypeImageのDimとSampled
+            uint32_t dim = 0;
+            uint32_t sampled = 0;
+            std::vector<uint32_t> memberTypeIds;
+            std::vector<uint32_t> memberOffsets;
+
+            std::optional<uint32_t> set;
+            std::optional<uint32_t> binding;
+            std::optional<uint32_t> location;
+            bool builtIn = false;
+            bool block = false;
+            bool bufferBlock = false;
+            uint32_t arrayStride = 0;
+            uint32_t matrixStride = 0;
+        };
+
+        class SpirvParser
+        {
+        public:
+            explicit SpirvParser(size_t idBound) : _ids(idBound) {}
+
+            bool parse(const uint32_t* pCode, size_t wordCount, ShaderReflection& reflection);
+
+        private:
+            SpirvId* getId(uint32_t id) { return id < _ids.size() ? &_ids[id] : nullptr; }
+            uint32_t getTypeSize(uint32_t typeId, uint32_t matrixStride = 0);
+            uint32_t getComponentCount(uint32_t typeId);
+            std::optional<vk::DescriptorType> getDescriptorType(uint32_t typeId, uint32_t storageClass, uint32_t& count);
+
+            std::vector<SpirvId> _ids;
+            std::vector<uint32_t> _variableIds;
+        };
+
+        bool SpirvParser::parse(const uint32_t* pCode, size_t wordCount, ShaderReflection& reflection)
+        {
+            for (size_t offset = kSpirvHeaderWords; offset < wordCount;)
+            {
+                uint32_t opcode = pCode[offset] & 0xffff;
+                uint32_t length = pCode[offset] >> 16;
+                if (length == 0 || offset + length > wordCount)
+                {
+                    return false;
+                }
+                const uint32_t* pOperands = pCode + offset + 1;
+                uint32_t operandCount = length - 1;
+                // オペランドを読む前に数を確かめる (最後の命令が途中で切れていると、バッファの外を読んでしまう)
+                if (operandCount < getMinOperandCount(opcode))
+                {
+                    return false;
+                }
+
+                switch (opcode)
+                {
+                    case OpEntryPoint:
+                    {
+                        std::optional<vk::ShaderStageFlagBits> stage = toShaderStage(pOperands[0]);
+                        if (stage)
+                        {
+                            // 名前はNULで終わる文字列が語の並びに詰めてある
+                            const char* pName = reinterpret_cast<const char*>(pOperands + 2);
+                            size_t maxLength = (operandCount - 2) * sizeof(uint32_t);
+                            reflection.entryPoints.push_back({ std::string(pName, strnlen(pName, maxLength)), stage.value() });
+                        }
+                        break;
+                    }
+                    case OpTypeInt:
+                    case OpTypeFloat:
+                    case OpTypeVector:
+                    case OpTypeMatrix:
+                    case OpTypeArray:
+                    case OpTypeRuntimeArray:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            pId->opcode = opcode;
+                            if (opcode == OpTypeInt || opcode == OpTypeFloat)
+                            {
+                                pId->value = pOperands[1];
+                            }
+                            else
+                            {
+                                pId->typeId = pOperands[1];
+                                pId->value = operandCount >= 3 ? pOperands[2] : 0;
+                            }
+                        }
+                        break;
+                    case OpTypeImage:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            pId->opcode = opcode;
+                            pId->dim = pOperands[2];
+                            pId->sampled = pOperands[6];
+                        }
+                        break;
+                    case OpTypeSampler:
+                    case OpTypeAccelerationStructureKHR:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            pId->opcode = opcode;
+                        }
+                        break;
+                    case OpTypeSampledImage:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            pId->opcode = opcode;
+                            pId->typeId = pOperands[1];
+                        }
+                        break;
+                    case OpTypeStruct:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            pId->opcode = opcode;
+                            pId->memberTypeIds.assign(pOperands + 1, pOperands + operandCount);
+                            pId->memberOffsets.resize(pId->memberTypeIds.size(), 0);
+                        }
+                        break;
+                    case OpTypePointer:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            pId->opcode = opcode;
+                            pId->storageClass = pOperands[1];
+                            pId->typeId = pOperands[2];
+                        }
+                        break;
+                    case OpConstant:
+                        if (SpirvId* pId = getId(pOperands[1]))
+                        {
+                            pId->opcode = opcode;
+                            pId->value = pOperands[2];
+                        }
+                        break;
+                    case OpVariable:
+                        if (SpirvId* pId = getId(pOperands[1]))
+                        {
+                            pId->opcode = opcode;
+                            pId->typeId = pOperands[0];
+                            pId->storageClass = pOperands[2];
+                            _variableIds.push_back(pOperands[1]);
+                        }
+                        break;
+                    case OpDecorate:
+                        if (SpirvId* pId = getId(pOperands[0]))
+                        {
+                            uint32_t literal = operandCount >= 3 ? pOperands[2] : 0;
+                            switch (pOperands[1])
+                            {
+                                case DecorationBlock: pId->block = true; break;
+                                case DecorationBufferBlock: pId->bufferBlock = true; break;
+                                case DecorationArrayStride: pId->arrayStride = literal; break;
+                                case DecorationBuiltIn: pId->builtIn = true; break;
+                                case DecorationLocation: pId->location = literal; break;
+                                case DecorationBinding: pId->binding = literal; break;
+                                case DecorationDescriptorSet: pId->set = literal; break;
+                                default: break;
+                            }
+                        }
+                        break;
+                    case OpMemberDecorate:
+                        if (SpirvId* pId = getId(pOperands[0]); pId && operandCount >= 4)
+                        {
+                            uint32_t member = pOperands[1];
+                            if (pOperands[2] == DecorationOffset)
+                            {
+                                if (pId->memberOffsets.size() <= member)
+                                {
+                                    pId->memberOffsets.resize(member + 1, 0);
+                                }
+                                pId->memberOffsets[member] = pOperands[3];
+                            }
+                            else if (pOperands[2] == DecorationMatrixStride)
+                            {
+                                pId->matrixStride = std::max(pId->matrixStride, pOperands[3]);
+                            }
+                            else if (pOperands[2] == DecorationBuiltIn)
+                            {
+                                pId->builtIn = true;
+                            }
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                offset += length;
+            }
+
+            for (uint32_t variableId : _variableIds)
+            {
+                const SpirvId& variable = _ids[variableId];
+                SpirvId* pPointer = getId(variable.typeId);
+                if (!pPointer || pPointer->opcode != OpTypePointer)
+                {
+                    continue;
+                }
+                uint32_t typeId = pPointer->typeId;
+
+                if (variable.set && variable.binding)
+                {
+                    uint32_t count = 1;
+                    std::optional<vk::DescriptorType> type = getDescriptorType(typeId, variable.storageClass, count);
+                    if (type)
+                    {
+                        reflection.descriptorBindings.push_back({ variable.set.value(), variable.binding.value(), type.value(), count });
+                    }
+                }
+                else if (variable.storageClass == StorageClassPushConstant)
+                {
+                    reflection.pushConstantSize = std::max(reflection.pushConstantSize, getTypeSize(typeId));
+                }
+                else if (variable.storageClass == StorageClassInput && variable.location && !variable.builtIn)
+                {
+                    SpirvId* pType = getId(typeId);
+                    if (pType && !pType->builtIn)
+                    {
+                        reflection.inputs.push_back({ variable.location.value(), getComponentCount(typeId) });
+                    }
+                }
+            }
+
+            std::sort(reflection.descriptorBindings.begin(), reflection.descriptorBindings.end(),
+                      [](const ShaderReflection::DescriptorBinding& a, const ShaderReflection::DescriptorBinding& b) {
+                          return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+                      });
+            std::sort(reflection.inputs.begin(), reflection.inputs.end(),
+                      [](const ShaderReflection::InputVariable& a, const ShaderReflection::InputVariable& b) {
+                          return a.location < b.location;
+                      });
+            return true;
+        }
+
+        // std430/std140のオフセットとストライドの装飾から、型が占めるバイト数を求める
+        uint32_t SpirvParser::getTypeSize(uint32_t typeId, uint32_t matrixStride)
+        {
+            SpirvId* pType = getId(typeId);
+            if (!pType)
+            {
+                return 0;
+            }
+            switch (pType->opcode)
+            {
+                case OpTypeInt:
+                case OpTypeFloat:
+                    return pType->value / 8;
+                case OpTypeVector:
+                    return pType->value * getTypeSize(pType->typeId);
+                case OpTypeMatrix:
+                    return pType->value * (matrixStride != 0 ? matrixStride : getTypeSize(pType->typeId));
+                case OpTypeArray:
+                {
+                    SpirvId* pLength = getId(pType->value);
+                    uint32_t length = pLength ? pLength->value : 0;
+                    uint32_t stride = pType->arrayStride != 0 ? pType->arrayStride : getTypeSize(pType->typeId, matrixStride);
+                    return length * stride;
+                }
+                case OpTypeStruct:
+                {
+                    uint32_t size = 0;
+                    for (size_t i = 0; i < pType->memberTypeIds.size(); i++)
+                    {
+                        size = std::max(size, pType->memberOffsets[i] + getTypeSize(pType->memberTypeIds[i], pType->matrixStride));
+                    }
+                    return size;
+                }
+                default:
+                    return 0;
+            }
+        }
+
+        uint32_t SpirvParser::getComponentCount(uint32_t typeId)
+        {
+            SpirvId* pType = getId(typeId);
+            if (!pType)
+            {
+                return 0;
+            }
+            switch (pType->opcode)
+            {
+                case OpTypeInt:
+                case OpTypeFloat:
+                    return 1;
+                case OpTypeVector:
+                    return pType->value;
+                case OpTypeMatrix:
+                    return pType->value * getComponentCount(pType->typeId);
+                default:
+                    return 0;
+            }
+        }
+
+        std::optional<vk::DescriptorType> SpirvParser::getDescriptorType(uint32_t typeId, uint32_t storageClass, uint32_t& count)
+        {
+            SpirvId* pType = getId(typeId);
+            if (!pType)
+            {
+                return std::nullopt;
+            }
+
+            // 配列ならその要素の型で決まる
+            if (pType->opcode == OpTypeArray || pType->opcode == OpTypeRuntimeArray)
+            {
+                SpirvId* pLength = pType->opcode == OpTypeArray ? getId(pType->value) : nullptr;
+                count = pLength ? pLength->value : 0;
+                pType = getId(pType->typeId);
+                if (!pType)
+                {
+                    return std::nullopt;
+                }
+            }
+
+            switch (pType->opcode)
+            {
+                case OpTypeStruct:
+                    if (storageClass == StorageClassStorageBuffer || pType->bufferBlock)
+                    {
+                        return vk::DescriptorType::eStorageBuffer;
+                    }
+                    return vk::DescriptorType::eUniformBuffer;
+                case OpTypeSampledImage:
+                    return vk::DescriptorType::eCombinedImageSampler;
+                case OpTypeSampler:
+                    return vk::DescriptorType::eSampler;
+                case OpTypeImage:
+                    if (pType->dim == kDimSubpassData)
+                    {
+                        return vk::DescriptorType::eInputAttachment;
+                    }
+                    if (pType->dim == kDimBuffer)
+                    {
+                        return pType->sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+                    }
+                    return pType->sampled == 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+                case OpTypeAccelerationStructureKHR:
+                    return vk::DescriptorType::eAccelerationStructureKHR;
+                default:
+                    return std::nullopt;
+            }
+        }
+    }
+
+    vk::PipelineShaderStageCreateInfo Shader::getStageCreateInfo() const
+    {
+        vk::PipelineShaderStageCreateInfo stageCreateInfo;
+        stageCreateInfo.stage = reflection.getStage();
+        stageCreateInfo.module = module;
+        // 名前の文字列はShaderが持っているので、Shaderが生きている間は使える
+        stageCreateInfo.pName = reflection.entryPoints.empty() ? "main" : reflection.entryPoints[0].name.c_str();
+        return stageCreateInfo;
+    }
+
+    ShaderRegistry::ShaderRegistry(vk::Device device, Platform& platform)
+        : _device(device), _platform(platform)
+    {
+    }
+
+    std::optional<ShaderReflection> ShaderRegistry::reflect(const uint32_t* pCode, size_t wordCount)
+    {
+        if (wordCount < kSpirvHeaderWords || pCode[0] != kSpirvMagic)
+        {
+            return std::nullopt;
+        }
+
+        // ヘッダの4語目はIDの上限
+        ShaderReflection reflection;
+        SpirvParser parser(pCode[3]);
+        if (!parser.parse(pCode, wordCount, reflection))
+        {
+            return std::nullopt;
+        }
+        return reflection;
+    }
+
+    const Shader* ShaderRegistry::get(const std::string& assetPath)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = _shadersByPath.find(assetPath);
+        if (found != _shadersByPath.end())
+        {
+            return found->second.get();
+        }
+
+        TRACE_SCOPE("load shader");
+        std::unique_ptr<Shader>& shader = _shadersByPath[assetPath];
+
+        std::optional<std::vector<char>> fileData = _platform.readAsset(assetPath);
+        if (!fileData || fileData->empty() || fileData->size() % sizeof(uint32_t) != 0)
+        {
+            LOGERR("ShaderRegistry: failed to read " << assetPath);
+            return nullptr;
+        }
+
+        // SPIR-Vは32bitの語の並びなので、アラインメントを揃えたバッファに移してから読む
+        std::vector<uint32_t> code(fileData->size() / sizeof(uint32_t));
+        std::memcpy(code.data(), fileData->data(), fileData->size());
+
+        std::optional<ShaderReflection> reflection = reflect(code.data(), code.size());
+        if (!reflection)
+        {
+            LOGERR("ShaderRegistry: " << assetPath << " is not valid SPIR-V");
+            return nullptr;
+        }
+
+        uint64_t contentHash = hashFnv1a(code.data(), code.size() * sizeof(uint32_t));
+        vk::UniqueShaderModule& module = _modulesByHash[contentHash];
+        if (!module)
+        {
+            vk::ShaderModuleCreateInfo shaderCreateInfo;
+            shaderCreateInfo.codeSize = code.size() * sizeof(uint32_t);
+            shaderCreateInfo.pCode = code.data();
+            module = _device.createShaderModuleUnique(shaderCreateInfo);
+        }
+
+        shader = std::make_unique<Shader>();
+        shader->assetPath = assetPath;
+        shader->contentHash = contentHash;
+        shader->module = module.get();
+        shader->reflection = std::move(reflection.value());
+        return shader.get();
+    }
+
+    size_t ShaderRegistry::getModuleCount() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _modulesByHash.size();
+    }
+
+    std::vector<const Shader*> ShaderRegistry::getShaders() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<const Shader*> shaders;
+        for (const auto& [path, shader] : _shadersByPath)
+        {
+            if (shader)
+            {
+                shaders.push_back(shader.get());
+            }
+        }
+        return shaders;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "Platform.hpp"
+
+namespace Vulkan_Test
+{
+    // SPIR-Vから読み取ったシェーダーのインターフェース
+    struct ShaderReflection
+    {
+        struct EntryPoint
+        {
+            std::string name;
+            vk::ShaderStageFlagBits stage;
+        };
+
+        struct DescriptorBinding
+        {
+            uint32_t set;
+            uint32_t binding;
+            vk::DescriptorType type;
+            // 配列なら要素数 (実行時に大きさが決まる配列は0)
+            uint32_t count;
+        };
+
+        struct InputVariable
+        {
+            uint32_t location;
+            // floatやintの数 (vec3なら3)
+            uint32_t componentCount;
+        };
+
+        std::vector<EntryPoint> entryPoints;
+        // setとbindingの順に並べてある
+        std::vector<DescriptorBinding> descriptorBindings;
+        // プッシュ定数のブロックの大きさ (使っていなければ0)
+        uint32_t pushConstantSize = 0;
+        // 組み込み変数を除いた入力 (頂点シェーダーなら頂点属性) locationの順に並べてある
+        std::vector<InputVariable> inputs;
+
+        vk::ShaderStageFlagBits getStage() const { return entryPoints.empty() ? vk::ShaderStageFlagBits::eAll : entryPoints[0].stage; }
+    };
+
+    struct Shader
+    {
+        std::string assetPath;
+        // SPIR-Vの内容のハッシュ 同じ内容のファイルは別のパスでも1つのモジュールを共有する
+        uint64_t contentHash;
+        vk::ShaderModule module;
+        ShaderReflection reflection;
+
+        // 最初のエントリポイントを使うステージの情報
+        vk::PipelineShaderStageCreateInfo getStageCreateInfo() const;
+    };
+
+    // シェーダーモジュールをアセットのパスと内容のハッシュで管理し、複数のパイプラインで使い回す
+    //
+    // ・getで初めて使われたときにアセットを読んでモジュールを作る (使わないシェーダーは読まない)
+    // ・同じパスは2回読まない 別のパスでも内容が同じならモジュールは1つだけ作る
+    // ・モジュールはレジストリが破棄されるまで生きているので、パイプラインを作り直すたびに読み直すことはない
+    // ・読むときにSPIR-Vを解析して、エントリポイント・デスクリプタのバインディング・プッシュ定数の大きさ・入力を取り出す
+    //
+    // 複数のスレッドから呼んでよい (返すShaderは破棄されるまで変わらない)
+    class ShaderRegistry
+    {
+    public:
+        ShaderRegistry(vk::Device device, Platform& platform);
+
+        ShaderRegistry(const ShaderRegistry&) = delete;
+        ShaderRegistry& operator=(const ShaderRegistry&) = delete;
+
+        // 読めなかったり、SPIR-Vとして正しくなかったりしたらnullptr
+        const Shader* get(const std::string& assetPath);
+
+        size_t getModuleCount() const;
+        std::vector<const Shader*> getShaders() const;
+
+        static std::optional<ShaderReflection> reflect(const uint32_t* pCode, size_t wordCount);
+
+    private:
+        vk::Device _device;
+        Platform& _platform;
+
+        mutable std::mutex _mutex;
+        // パスごとのシェーダー (読めなかったパスはnullptrを入れ、何度も読みに行かないようにする)
+        std::unordered_map<std::string, std::unique_ptr<Shader>> _shadersByPath;
+        // 内容のハッシュごとのモジュール
+        std::unordered_map<uint64_t, vk::UniqueShaderModule> _modulesByHash;
+    };
+}
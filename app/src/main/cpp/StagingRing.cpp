@@ -0,0 +1,273 @@
+#include "StagingRing.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Vulkan_Test
+{
+    StagingRing::StagingRing(vk::Device device, MemoryAllocator& memoryAllocator, vk::DeviceSize size, uint32_t frameCount)
+        : _device(device), _memoryAllocator(memoryAllocator), _size(size)
+    {
+        vk::BufferCreateInfo bufferCreateInfo;
+        bufferCreateInfo.size = _size;
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+        bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+        _buffer = _device.createBufferUnique(bufferCreateInfo);
+
+        // ホストから書き込むのでeHostVisibleは必須、eHostCoherentならflushが要らなくなるのでできれば欲しい
+        _memory = _memoryAllocator.allocateForBuffer(_buffer.get(),
+                                                     vk::MemoryPropertyFlagBits::eHostVisible,
+                                                     vk::MemoryPropertyFlagBits::eHostCoherent);
+
+        _frameEnds = std::vector<uint64_t>(frameCount, 0);
+    }
+
+    StagingRing::~StagingRing()
+    {
+        _memoryAllocator.free(_memory);
+    }
+
+    void StagingRing::beginFrame(uint32_t frameIndex)
+    {
+        // このスロットを前回使ったフレームのコマンドは実行し終わっているので、そこまでの領域はもう使ってよい
+        _tail = std::max(_tail, _frameEnds[frameIndex]);
+        _currentFrame = frameIndex;
+    }
+
+    StagingRing::Region StagingRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+    {
+        if (size > _size)
+        {
+            return Region();
+        }
+
+        vk::DeviceSize lap = _head / _size * _size;
+        vk::DeviceSize offset = (_head - lap + alignment - 1) / alignment * alignment;
+        uint64_t start = lap + offset;
+        // 末尾に収まらなければ次の周の先頭から使う (末尾の余りは捨てる)
+        if (offset + size > _size)
+        {
+            start = lap + _size;
+        }
+        // まだGPUが使っているかもしれない領域を追い越してしまうなら空きが足りない
+        if (start + size - _tail > _size)
+        {
+            return Region();
+        }
+        _head = start + size;
+
+        Region region;
+        region.buffer = _buffer.get();
+        region.offset = start % _size;
+        region.size = size;
+        region.pMapped = static_cast<char*>(_memory.pMapped) + region.offset;
+        return region;
+    }
+
+    void StagingRing::flush(const Region& region)
+    {
+        _memoryAllocator.flush(_memory, region.offset, region.size);
+    }
+
+    bool StagingRing::uploadBuffer(vk::Buffer dstBuffer, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size,
+                                   vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+    {
+        Region region = allocate(size);
+        if (!region)
+        {
+            LOGERR("StagingRing: not enough space for " << size << " bytes");
+            return false;
+        }
+
+        std::memcpy(region.pMapped, data, size);
+        flush(region);
+
+        PendingCopy pendingCopy;
+        pendingCopy.dstBuffer = dstBuffer;
+        pendingCopy.region.srcOffset = region.offset;
+        pendingCopy.region.dstOffset = dstOffset;
+        pendingCopy.region.size = size;
+        _pendingCopies.push_back(pendingCopy);
+        _pendingDstStages |= dstStage;
+        _pendingDstAccess |= dstAccess;
+        return true;
+    }
+
+    bool StagingRing::isFirstUpload(vk::Buffer dstBuffer) const
+    {
+        return _graphicsOwnedBuffers.count(static_cast<VkBuffer>(dstBuffer)) == 0;
+    }
+
+    bool StagingRing::hasPendingFirstUploads() const
+    {
+        return std::any_of(_pendingCopies.begin(), _pendingCopies.end(),
+                           [this](const PendingCopy& pendingCopy) { return isFirstUpload(pendingCopy.dstBuffer); });
+    }
+
+    std::vector<vk::BufferMemoryBarrier> StagingRing::recordCopies(vk::CommandBuffer commandBuffer, std::vector<PendingCopy>& copies, bool waitForReads)
+    {
+        TRACE_SCOPE("record uploads");
+
+        // 転送先のバッファごとに並べ、1つのcopyBufferに複数の領域を渡す
+        std::stable_sort(copies.begin(), copies.end(),
+                         [](const PendingCopy& a, const PendingCopy& b) {
+                             return static_cast<VkBuffer>(a.dstBuffer) < static_cast<VkBuffer>(b.dstBuffer);
+                         });
+
+        // 転送先のバッファごとに、書き込む範囲全体を覆うバリアを作る (アクセスとキューファミリは後で埋める)
+        std::vector<vk::BufferMemoryBarrier> dstBarriers;
+        for (size_t i = 0; i < copies.size(); i++)
+        {
+            const vk::BufferCopy& region = copies[i].region;
+            if (i == 0 || copies[i - 1].dstBuffer != copies[i].dstBuffer)
+            {
+                vk::BufferMemoryBarrier& barrier = dstBarriers.emplace_back();
+                barrier.buffer = copies[i].dstBuffer;
+                barrier.offset = region.dstOffset;
+                barrier.size = region.size;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                continue;
+            }
+            vk::BufferMemoryBarrier& barrier = dstBarriers.back();
+            vk::DeviceSize rangeBegin = std::min(barrier.offset, region.dstOffset);
+            vk::DeviceSize rangeEnd = std::max(barrier.offset + barrier.size, region.dstOffset + region.size);
+            barrier.offset = rangeBegin;
+            barrier.size = rangeEnd - rangeBegin;
+        }
+
+        // 書き直すバッファは前のフレームのドローがまだ読んでいるかもしれないので、読み終わるまでコピーを待たせる (WAR)
+        // 読む側の書き込みはないので、コピーの書き込みを読み込みの後ろに並べるだけでよい
+        if (waitForReads)
+        {
+            std::vector<vk::BufferMemoryBarrier> preBarriers = dstBarriers;
+            for (vk::BufferMemoryBarrier& barrier : preBarriers)
+            {
+                barrier.srcAccessMask = vk::AccessFlags();
+                barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            }
+            commandBuffer.pipelineBarrier(_pendingDstStages, vk::PipelineStageFlagBits::eTransfer, {}, {}, preBarriers, {});
+        }
+
+        std::vector<vk::BufferCopy> regions;
+        for (size_t i = 0; i < copies.size(); i++)
+        {
+            regions.push_back(copies[i].region);
+            _lastFrameStats.uploadedBytes += copies[i].region.size;
+
+            if (i + 1 == copies.size() || copies[i + 1].dstBuffer != copies[i].dstBuffer)
+            {
+                commandBuffer.copyBuffer(_buffer.get(), copies[i].dstBuffer, regions);
+                _lastFrameStats.dstBufferCount++;
+                regions.clear();
+            }
+        }
+        _lastFrameStats.copyCount += copies.size();
+        return dstBarriers;
+    }
+
+    void StagingRing::clearPendingUploads()
+    {
+        _pendingCopies.clear();
+        _pendingDstStages = vk::PipelineStageFlags();
+        _pendingDstAccess = vk::AccessFlags();
+    }
+
+    void StagingRing::recordGraphicsCopies(vk::CommandBuffer commandBuffer, std::vector<PendingCopy>& copies)
+    {
+        for (const PendingCopy& pendingCopy : copies)
+        {
+            _graphicsOwnedBuffers.insert(static_cast<VkBuffer>(pendingCopy.dstBuffer));
+        }
+
+        recordCopies(commandBuffer, copies, true);
+
+        // 転送の書き込みが終わってから、転送先を使うステージが読むようにする
+        // 転送ごとにバリアを張らず、このフレームの転送全体に対して1つだけ張る
+        vk::MemoryBarrier memoryBarrier;
+        memoryBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        memoryBarrier.dstAccessMask = _pendingDstAccess;
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, _pendingDstStages, {}, { memoryBarrier }, {}, {});
+    }
+
+    void StagingRing::recordUploads(vk::CommandBuffer commandBuffer)
+    {
+        // ここまでに切り出した領域は、このフレームスロットのコマンドバッファが使い終わったときに解放する
+        _frameEnds[_currentFrame] = _head;
+
+        _lastFrameStats = FrameStats();
+        if (_pendingCopies.empty())
+        {
+            return;
+        }
+
+        recordGraphicsCopies(commandBuffer, _pendingCopies);
+        clearPendingUploads();
+    }
+
+    vk::PipelineStageFlags StagingRing::recordUploads(vk::CommandBuffer transferCommandBuffer, vk::CommandBuffer graphicsCommandBuffer,
+                                                      uint32_t transferQueueFamilyIndex, uint32_t graphicsQueueFamilyIndex)
+    {
+        _frameEnds[_currentFrame] = _head;
+
+        _lastFrameStats = FrameStats();
+        if (_pendingCopies.empty())
+        {
+            return vk::PipelineStageFlags();
+        }
+
+        // 転送キューは頂点入力などのステージを扱えず、前のフレームのグラフィックスキューの読み込みを待てない
+        // また一度アクワイアしたバッファの所有権は転送キューに戻さないので、転送キューで扱えるのはまだGPUが使っていないバッファだけ
+        // 書き直しはグラフィックスキューで読み込みを待ってからコピーする
+        std::vector<PendingCopy> firstCopies;
+        std::vector<PendingCopy> rewriteCopies;
+        for (const PendingCopy& pendingCopy : _pendingCopies)
+        {
+            (isFirstUpload(pendingCopy.dstBuffer) ? firstCopies : rewriteCopies).push_back(pendingCopy);
+        }
+        if (!rewriteCopies.empty())
+        {
+            recordGraphicsCopies(graphicsCommandBuffer, rewriteCopies);
+        }
+        if (firstCopies.empty())
+        {
+            clearPendingUploads();
+            return vk::PipelineStageFlags();
+        }
+
+        std::vector<vk::BufferMemoryBarrier> barriers = recordCopies(transferCommandBuffer, firstCopies, false);
+        for (const PendingCopy& pendingCopy : firstCopies)
+        {
+            _graphicsOwnedBuffers.insert(static_cast<VkBuffer>(pendingCopy.dstBuffer));
+        }
+
+        // SharingMode::eExclusiveのバッファは、別のキューファミリで使う前に所有権を移す必要がある
+        // 転送キュー側で「手放す」(リリース)バリア、グラフィックスキュー側で「受け取る」(アクワイア)バリアを、同じ内容で対にして張る
+        //
+        // リリース側: 転送の書き込みを完了させる dstAccessMaskは無視されるので空にする
+        for (vk::BufferMemoryBarrier& barrier : barriers)
+        {
+            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+            barrier.dstAccessMask = vk::AccessFlags();
+            barrier.srcQueueFamilyIndex = transferQueueFamilyIndex;
+            barrier.dstQueueFamilyIndex = graphicsQueueFamilyIndex;
+        }
+        transferCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+                                              {}, {}, barriers, {});
+
+        // アクワイア側: 書き込みの完了はセマフォが保証するので、srcAccessMaskは空でよい
+        // srcStageMaskをセマフォを待つステージと揃えておくことで、セマフォの待ちからこのバリアへ依存がつながる
+        for (vk::BufferMemoryBarrier& barrier : barriers)
+        {
+            barrier.srcAccessMask = vk::AccessFlags();
+            barrier.dstAccessMask = _pendingDstAccess;
+        }
+        graphicsCommandBuffer.pipelineBarrier(_pendingDstStages, _pendingDstStages, {}, {}, barriers, {});
+
+        vk::PipelineStageFlags waitStages = _pendingDstStages;
+        clearPendingUploads();
+        return waitStages;
+    }
+}
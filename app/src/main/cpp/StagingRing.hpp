@@ -0,0 +1,117 @@
+#pragma once
+
+#include <unordered_set>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "MemoryAllocator.hpp"
+
+namespace Vulkan_Test
+{
+    // フレームごとにフェンスで解放される、マップしたままのステージング用リングバッファ
+    //
+    // ホスト可視のバッファを1つ確保してマップしたままにしておき、先頭から順番に切り出して使う
+    // 切り出した領域は、それを転送に使ったフレームスロットのフェンスが次に待たれたとき(=GPUが使い終わったとき)に解放される
+    // 端まで来たら先頭に戻るので、確保・解放・マップの処理が毎回発生しない
+    //
+    // 使い方
+    //   1. フレームスロットのフェンスを待った後に beginFrame(スロット番号)
+    //   2. どのサブシステムからでも uploadBuffer で転送を予約する (書き込みはその場でリングに行われる)
+    //   3. レンダーパスの前に recordUploads(コマンドバッファ) で予約された転送をまとめて積む
+    //      転送専用キューがあるなら、転送用とグラフィックス用のコマンドバッファを両方渡す方を使う
+    //      転送専用キューに送るのは、まだGPUが使っていないバッファへの初回の転送だけ
+    //      一度グラフィックスキューに渡したバッファの書き直しは、前のフレームの読み込みを待つ必要があるのでグラフィックスキューで行う
+    //
+    // 書き込み側はレンダースレッドだけを想定している (スレッドセーフではない)
+    class StagingRing
+    {
+    public:
+        struct Region
+        {
+            vk::Buffer buffer;
+            vk::DeviceSize offset = 0;
+            vk::DeviceSize size = 0;
+            void* pMapped = nullptr;
+
+            explicit operator bool() const { return pMapped != nullptr; }
+        };
+
+        struct FrameStats
+        {
+            uint32_t copyCount = 0;
+            uint32_t dstBufferCount = 0;
+            vk::DeviceSize uploadedBytes = 0;
+        };
+
+        StagingRing(vk::Device device, MemoryAllocator& memoryAllocator, vk::DeviceSize size, uint32_t frameCount);
+        ~StagingRing();
+
+        StagingRing(const StagingRing&) = delete;
+        StagingRing& operator=(const StagingRing&) = delete;
+
+        void beginFrame(uint32_t frameIndex);
+
+        // リングから領域を切り出す 空きが足りなければ空のRegionを返す
+        Region allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+        // allocateで切り出した領域に書き込んだ内容をデバイスに反映する
+        void flush(const Region& region);
+
+        // dataをリングにコピーし、dstBufferのdstOffsetへの転送を予約する
+        // dstStage/dstAccessは転送先のバッファを次に使うパイプラインステージとアクセス
+        bool uploadBuffer(vk::Buffer dstBuffer, vk::DeviceSize dstOffset, const void* data, vk::DeviceSize size,
+                          vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess);
+
+        bool hasPendingUploads() const { return !_pendingCopies.empty(); }
+        // 予約された転送に、まだGPUが使っていないバッファへの初回の転送が含まれるか
+        bool hasPendingFirstUploads() const;
+        // 予約された転送を転送先のバッファごとに1回のcopyBufferにまとめて積み、最後にバリアを1つだけ張る
+        void recordUploads(vk::CommandBuffer commandBuffer);
+        // 転送専用キューを使う場合
+        // 初回の転送のコピーとキューファミリ所有権のリリースをtransferCommandBufferに、アクワイアをgraphicsCommandBufferに積む
+        // 書き直しの転送はgraphicsCommandBufferにそのまま積む
+        // 戻り値はグラフィックスキューのsubmitで転送完了のセマフォを待つべきステージ (初回の転送がなければ空)
+        // graphicsCommandBufferはtransferCommandBufferの完了をセマフォで待って実行しなければならない
+        vk::PipelineStageFlags recordUploads(vk::CommandBuffer transferCommandBuffer, vk::CommandBuffer graphicsCommandBuffer,
+                                             uint32_t transferQueueFamilyIndex, uint32_t graphicsQueueFamilyIndex);
+
+        vk::Buffer getBuffer() const { return _buffer.get(); }
+        vk::DeviceSize getSize() const { return _size; }
+        const FrameStats& getLastFrameStats() const { return _lastFrameStats; }
+
+    private:
+        struct PendingCopy
+        {
+            vk::Buffer dstBuffer;
+            vk::BufferCopy region;
+        };
+
+        // waitForReadsなら、コピーの前に転送先を読むステージ(_pendingDstStages)の完了を待つバリアを張る
+        std::vector<vk::BufferMemoryBarrier> recordCopies(vk::CommandBuffer commandBuffer, std::vector<PendingCopy>& copies, bool waitForReads);
+        // グラフィックスキューでコピーし、転送先を使うステージとの間にバリアを張る
+        void recordGraphicsCopies(vk::CommandBuffer commandBuffer, std::vector<PendingCopy>& copies);
+        bool isFirstUpload(vk::Buffer dstBuffer) const;
+        void clearPendingUploads();
+
+        vk::Device _device;
+        MemoryAllocator& _memoryAllocator;
+
+        vk::UniqueBuffer _buffer;
+        MemoryAllocation _memory;
+        vk::DeviceSize _size;
+
+        // 位置はリングを何周したかも含めた通し番号で持つ (実際のオフセットは _size で割った余り)
+        // こうすると head - tail がそのまま使用中のバイト数になり、満杯と空の区別が簡単になる
+        uint64_t _head = 0;
+        uint64_t _tail = 0;
+        // フレームスロットごとに、そのスロットのコマンドバッファが使ったリングの終端
+        std::vector<uint64_t> _frameEnds;
+        uint32_t _currentFrame = 0;
+
+        std::vector<PendingCopy> _pendingCopies;
+        // 一度でも転送してグラフィックスキューに渡したバッファ
+        // 破棄されたバッファのハンドルが再利用されても、グラフィックスキューで転送されるだけなので問題ない
+        std::unordered_set<VkBuffer> _graphicsOwnedBuffers;
+        vk::PipelineStageFlags _pendingDstStages;
+        vk::AccessFlags _pendingDstAccess;
+        FrameStats _lastFrameStats;
+    };
+}
@@ -0,0 +1,82 @@
+#include "ThreadPool.hpp"
+#include "Utility.hpp"
+#include "TraceRecorder.hpp"
+
+#include <algorithm>
+
+namespace Vulkan_Test
+{
+    ThreadPool::ThreadPool(uint32_t threadCount, std::string name)
+        : _name(std::move(name))
+    {
+        if (threadCount == 0)
+        {
+            uint32_t hardwareThreads = std::thread::hardware_concurrency();
+            threadCount = std::clamp<uint32_t>(hardwareThreads > 1 ? hardwareThreads - 1 : 1, 1, 4);
+        }
+
+        // ログとトレースにつけるスレッドの名前 (どちらもコピーして持つ)
+        _threadNames.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            _threadNames.push_back(_name + " " + std::to_string(i));
+        }
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            _threads.emplace_back(&ThreadPool::workerMain, this, i);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        for (std::thread& thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+    void ThreadPool::waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idleCondition.wait(lock, [this]() { return _jobs.empty() && _runningJobCount == 0; });
+    }
+
+    void ThreadPool::workerMain(uint32_t index)
+    {
+        Logger::get().setThreadName(_threadNames[index].c_str());
+        TraceRecorder::get().setThreadName(_threadNames[index].c_str());
+
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+                // 止めるときもキューに残っている仕事は全て実行する
+                if (_jobs.empty())
+                {
+                    return;
+                }
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+                _runningJobCount++;
+            }
+
+            job();
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _runningJobCount--;
+                if (_jobs.empty() && _runningJobCount == 0)
+                {
+                    _idleCondition.notify_all();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Vulkan_Test
+{
+    // 決まった数のワーカースレッドで、投げられた仕事を順番に実行する
+    //
+    // submitした仕事の結果はstd::futureで受け取る
+    // 破棄するときは、キューに残っている仕事も全て実行し終わってからスレッドを終了させる
+    class ThreadPool
+    {
+    public:
+        // threadCountが0ならハードウェアのスレッド数から決める (レンダースレッドの分を1つ空ける)
+        explicit ThreadPool(uint32_t threadCount = 0, std::string name = "worker");
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        template<class F>
+        std::future<std::invoke_result_t<F>> submit(F&& function)
+        {
+            // std::functionはコピーできる関数しか持てないので、packaged_taskはshared_ptrで包む
+            auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(function));
+            std::future<std::invoke_result_t<F>> future = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _jobs.emplace_back([task]() { (*task)(); });
+            }
+            _condition.notify_one();
+            return future;
+        }
+
+        // キューに残っている仕事と実行中の仕事が全て終わるまで待つ
+        void waitIdle();
+
+        uint32_t getThreadCount() const { return static_cast<uint32_t>(_threads.size()); }
+
+    private:
+        void workerMain(uint32_t index);
+
+        std::string _name;
+        std::vector<std::string> _threadNames;
+        std::vector<std::thread> _threads;
+
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        std::condition_variable _idleCondition;
+        std::deque<std::function<void()>> _jobs;
+        uint32_t _runningJobCount = 0;
+        bool _stopping = false;
+    };
+}
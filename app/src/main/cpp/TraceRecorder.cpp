@@ -0,0 +1,170 @@
+#include "TraceRecorder.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+namespace Vulkan_Test
+{
+    TraceRecorder& TraceRecorder::get()
+    {
+        // どこからでも記録できるようにプロセスに1つだけ持つ 終了まで破棄しない
+        static TraceRecorder* pInstance = new TraceRecorder();
+        return *pInstance;
+    }
+
+    void TraceRecorder::start(size_t eventsPerThread)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _eventsPerThread = std::max<size_t>(eventsPerThread, 1);
+        if (_startNs == 0)
+        {
+            _startNs = now();
+        }
+        if (!_gpuBuffer)
+        {
+            _gpuBuffer = std::make_unique<ThreadBuffer>();
+            _gpuBuffer->trackId = kGpuTrackId;
+            _gpuBuffer->name = "GPU";
+            _gpuBuffer->events.resize(_eventsPerThread);
+        }
+        _enabled.store(true, std::memory_order_relaxed);
+    }
+
+    void TraceRecorder::stop()
+    {
+        _enabled.store(false, std::memory_order_relaxed);
+    }
+
+    TraceRecorder::ThreadBuffer& TraceRecorder::getThreadBuffer()
+    {
+        // 初めて記録するスレッドだけバッファを作って登録する それ以降はthread_localのポインタを使うだけ
+        thread_local ThreadBuffer* pBuffer = nullptr;
+        if (!pBuffer)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+            pBuffer = _threadBuffers.back().get();
+            pBuffer->trackId = _nextTrackId++;
+            pBuffer->events.resize(_eventsPerThread);
+        }
+        return *pBuffer;
+    }
+
+    void TraceRecorder::push(ThreadBuffer& buffer, const Event& event)
+    {
+        // 書き込むスレッドは1つだけなので、書いてから数を進めれば読む側は進んだ数までを読める
+        uint64_t writeCount = buffer.writeCount.load(std::memory_order_relaxed);
+        buffer.events[writeCount % buffer.events.size()] = event;
+        buffer.writeCount.store(writeCount + 1, std::memory_order_release);
+    }
+
+    void TraceRecorder::record(const char* name, const char* category, uint64_t startNs, uint64_t endNs)
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+        ThreadBuffer& buffer = getThreadBuffer();
+        push(buffer, Event{ name, category, startNs, endNs - startNs, buffer.trackId });
+    }
+
+    void TraceRecorder::recordGpu(const char* name, uint64_t startNs, uint64_t endNs)
+    {
+        if (!isEnabled() || !_gpuBuffer)
+        {
+            return;
+        }
+        push(*_gpuBuffer, Event{ name, "gpu", startNs, endNs - startNs, kGpuTrackId });
+    }
+
+    void TraceRecorder::setThreadName(const char* name)
+    {
+        ThreadBuffer& buffer = getThreadBuffer();
+        std::lock_guard<std::mutex> lock(_mutex);
+        buffer.name = name ? name : "";
+    }
+
+    void TraceRecorder::collect(const ThreadBuffer& buffer, std::vector<Event>& events)
+    {
+        uint64_t capacity = buffer.events.size();
+        uint64_t endCount = buffer.writeCount.load(std::memory_order_acquire);
+        uint64_t beginCount = endCount > capacity ? endCount - capacity : 0;
+
+        size_t first = events.size();
+        for (uint64_t i = beginCount; i < endCount; i++)
+        {
+            events.push_back(buffer.events[i % capacity]);
+        }
+
+        // 読んでいる間に書き込みが進んでいたら、上書きされたかもしれない古い方を捨てる
+        uint64_t newEndCount = buffer.writeCount.load(std::memory_order_acquire);
+        uint64_t overwritten = newEndCount > capacity ? newEndCount - capacity : 0;
+        if (overwritten > beginCount)
+        {
+            size_t dropCount = std::min<uint64_t>(overwritten - beginCount, endCount - beginCount);
+            events.erase(events.begin() + first, events.begin() + first + dropCount);
+        }
+    }
+
+    bool TraceRecorder::writeChromeTrace(const std::string& path)
+    {
+        std::vector<Event> events;
+        std::vector<std::pair<uint32_t, std::string>> trackNames;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const std::unique_ptr<ThreadBuffer>& buffer : _threadBuffers)
+            {
+                collect(*buffer, events);
+                trackNames.emplace_back(buffer->trackId, buffer->name);
+            }
+            if (_gpuBuffer)
+            {
+                collect(*_gpuBuffer, events);
+                trackNames.emplace_back(_gpuBuffer->trackId, _gpuBuffer->name);
+            }
+        }
+
+        std::ofstream file(path);
+        if (!file)
+        {
+            LOGERR("TraceRecorder: failed to open " << path);
+            return false;
+        }
+
+        // 時間の単位はマイクロ秒 "X"は開始時刻と長さを持つイベント、"M"はスレッド名などのメタデータ
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const std::pair<uint32_t, std::string>& trackName : trackNames)
+        {
+            if (trackName.second.empty())
+            {
+                continue;
+            }
+            file << (first ? "" : ",\n") <<
+                 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trackName.first <<
+                 ",\"args\":{\"name\":\"" << trackName.second << "\"}}";
+            first = false;
+        }
+        file << std::fixed << std::setprecision(3);
+        for (const Event& event : events)
+        {
+            double startUs = (static_cast<int64_t>(event.startNs) - static_cast<int64_t>(_startNs)) / 1000.0;
+            file << (first ? "" : ",\n") <<
+                 "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category <<
+                 "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.trackId <<
+                 ",\"ts\":" << startUs << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+            first = false;
+        }
+        file << "\n]}\n";
+        file.flush();
+
+        if (!file)
+        {
+            LOGERR("TraceRecorder: failed to write " << path);
+            return false;
+        }
+        LOG("TraceRecorder: wrote " << events.size() << " events to " << path);
+        return true;
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Vulkan_Test
+{
+    // 時間のかかった区間をイベントとして記録し、Chrome Trace Event形式のJSONに書き出す
+    // 書き出したファイルは chrome://tracing や https://ui.perfetto.dev で開ける
+    //
+    // ・スレッドごとに固定長のリングバッファを持ち、記録するスレッドはそこに書くだけ (ロックもメモリ確保もしない)
+    //   バッファが一杯になったら古いイベントから上書きするので、書き出されるのは直近のイベント
+    // ・イベントの名前は文字列リテラルなど、書き出すまで生きているものを渡す (コピーしない スレッドの名前はコピーする)
+    // ・GPUのイベントはProfilerがCPUの時間に合わせてから記録する
+    //
+    // 記録はstart()からstop()まで 止まっている間のrecordはほぼ何もしない
+    class TraceRecorder
+    {
+    public:
+        // GPUのイベントを並べるトラックのスレッドID (実際のスレッドとは重ならない値)
+        static constexpr uint32_t kGpuTrackId = 1000;
+
+        struct Event
+        {
+            const char* name;
+            const char* category;
+            // TraceRecorder::now()と同じsteady_clockの時刻 (ナノ秒)
+            uint64_t startNs;
+            uint64_t durationNs;
+            uint32_t trackId;
+        };
+
+        // 区間の開始から終了(スコープの終わり)までを1つのイベントとして記録する
+        class Scope
+        {
+        public:
+            Scope(const char* name, const char* category = "cpu")
+                : _name(name), _category(category), _startNs(TraceRecorder::get().isEnabled() ? TraceRecorder::now() : 0)
+            {
+            }
+
+            ~Scope()
+            {
+                if (_startNs != 0)
+                {
+                    TraceRecorder::get().record(_name, _category, _startNs, TraceRecorder::now());
+                }
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            const char* _name;
+            const char* _category;
+            uint64_t _startNs;
+        };
+
+        static TraceRecorder& get();
+
+        // steady_clockのナノ秒 (0は「記録していない」の意味に使うので返さない)
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() | 1;
+        }
+
+        // eventsPerThreadはスレッドごとのリングバッファの大きさ 次にバッファを作るスレッドから有効
+        void start(size_t eventsPerThread = 16384);
+        void stop();
+        bool isEnabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+        // 呼び出したスレッドのイベントとして記録する
+        void record(const char* name, const char* category, uint64_t startNs, uint64_t endNs);
+        // GPUのトラックのイベントとして記録する 時間はCPUのsteady_clockに合わせたもの
+        // GPUのトラックに書くのは1つのスレッド(レンダースレッド)だけ
+        void recordGpu(const char* name, uint64_t startNs, uint64_t endNs);
+
+        // 呼び出したスレッドにトレース上での名前をつける
+        // 名前はコピーして持つ (スレッドプールが破棄された後に書き出しても、スレッドの名前が残る)
+        void setThreadName(const char* name);
+
+        // これまでに記録されたイベントを書き出す 記録中でも呼べる
+        bool writeChromeTrace(const std::string& path);
+
+    private:
+        // 1つのスレッドだけが書き、書き出しのときに他のスレッドから読まれる
+        struct ThreadBuffer
+        {
+            uint32_t trackId;
+            // 書き出しのときに他のスレッドから読まれるので、_mutexを取って読み書きする
+            std::string name;
+            std::vector<Event> events;
+            // これまでに書いたイベントの数 (書いた位置は writeCount % events.size())
+            std::atomic<uint64_t> writeCount{ 0 };
+        };
+
+        TraceRecorder() = default;
+
+        ThreadBuffer& getThreadBuffer();
+        static void push(ThreadBuffer& buffer, const Event& event);
+        static void collect(const ThreadBuffer& buffer, std::vector<Event>& events);
+
+        std::atomic<bool> _enabled{ false };
+        size_t _eventsPerThread = 16384;
+        uint64_t _startNs = 0;
+
+        // スレッドのバッファの登録と書き出しのときだけロックする (記録のときは使わない)
+        std::mutex _mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> _threadBuffers;
+        uint32_t _nextTrackId = 1;
+        std::unique_ptr<ThreadBuffer> _gpuBuffer;
+    };
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) Vulkan_Test::TraceRecorder::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
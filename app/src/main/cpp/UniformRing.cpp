@@ -0,0 +1,63 @@
+#include "UniformRing.hpp"
+#include "Utility.hpp"
+
+namespace Vulkan_Test
+{
+    UniformRing::UniformRing(vk::PhysicalDevice physicalDevice, vk::Device device, MemoryAllocator& memoryAllocator,
+                             vk::DeviceSize sizePerFrame, uint32_t frameCount, vk::BufferUsageFlags extraUsage)
+        : _device(device), _memoryAllocator(memoryAllocator)
+    {
+        _alignment = std::max<vk::DeviceSize>(physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment, 1);
+        // 各フレームの区間の先頭もアラインメントに揃える
+        _sizePerFrame = (sizePerFrame + _alignment - 1) / _alignment * _alignment;
+
+        vk::BufferCreateInfo bufferCreateInfo;
+        bufferCreateInfo.size = _sizePerFrame * frameCount;
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer | extraUsage;
+        bufferCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+        _buffer = _device.createBufferUnique(bufferCreateInfo);
+
+        // 毎フレームホストから書き込むのでeHostVisibleは必須
+        // eHostCoherentならflushが要らない eDeviceLocalも付いていれば(UMAの端末など)GPUからの読み込みも速い
+        _memory = _memoryAllocator.allocateForBuffer(_buffer.get(),
+                                                     vk::MemoryPropertyFlagBits::eHostVisible,
+                                                     vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+
+    UniformRing::~UniformRing()
+    {
+        _memoryAllocator.free(_memory);
+    }
+
+    void UniformRing::beginFrame(uint32_t frameIndex)
+    {
+        // このスロットを前回使ったフレームのコマンドは実行し終わっているので、区間の全てを使い直してよい
+        _frameBegin = _sizePerFrame * frameIndex;
+        _head = _frameBegin;
+        _flushed = _frameBegin;
+    }
+
+    UniformRing::Allocation UniformRing::allocate(vk::DeviceSize size)
+    {
+        vk::DeviceSize offset = (_head + _alignment - 1) / _alignment * _alignment;
+        if (offset + size > _frameBegin + _sizePerFrame)
+        {
+            return Allocation();
+        }
+        _head = offset + size;
+
+        Allocation allocation;
+        allocation.offset = static_cast<uint32_t>(offset);
+        allocation.pMapped = static_cast<char*>(_memory.pMapped) + offset;
+        return allocation;
+    }
+
+    void UniformRing::flush()
+    {
+        if (_head > _flushed)
+        {
+            _memoryAllocator.flush(_memory, _flushed, _head - _flushed);
+            _flushed = _head;
+        }
+    }
+}
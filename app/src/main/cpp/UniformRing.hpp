@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "MemoryAllocator.hpp"
+
+namespace Vulkan_Test
+{
+    // フレームごとのユニフォームデータを置く、マップしたままのバッファ
+    //
+    // バッファをフレームスロットの数に区切り、各スロットの区間の先頭から順番に切り出す (バンプポインタ)
+    // フレームスロットのフェンスを待ったあとにbeginFrameを呼ぶと、そのスロットの区間は先頭から使い直せる
+    // 切り出す位置はminUniformBufferOffsetAlignmentに揃えるので、返すオフセットはそのままダイナミックオフセットに使える
+    //
+    // デスクリプタはeUniformBufferDynamicで、バッファの先頭とデータ1つ分の大きさを書いておく
+    // あとはドローごとにpushで書き込んだ位置をbindDescriptorSetsのダイナミックオフセットに渡すだけなので、
+    // オブジェクトがいくつあってもデスクリプタセットはフレームに1つで済む
+    //
+    // extraUsageを渡せば、同じバッファにユニフォーム以外のフレームごとのデータ(インスタンスごとの頂点データなど)も置ける
+    //
+    // レンダースレッドだけで使う (スレッドセーフではない)
+    class UniformRing
+    {
+    public:
+        struct Allocation
+        {
+            // バッファの先頭からのオフセット ダイナミックオフセットにそのまま使える
+            uint32_t offset = 0;
+            void* pMapped = nullptr;
+
+            explicit operator bool() const { return pMapped != nullptr; }
+        };
+
+        UniformRing(vk::PhysicalDevice physicalDevice, vk::Device device, MemoryAllocator& memoryAllocator,
+                    vk::DeviceSize sizePerFrame, uint32_t frameCount, vk::BufferUsageFlags extraUsage = {});
+        ~UniformRing();
+
+        UniformRing(const UniformRing&) = delete;
+        UniformRing& operator=(const UniformRing&) = delete;
+
+        void beginFrame(uint32_t frameIndex);
+
+        // 今のフレームの区間から切り出す 足りなければ空のAllocationを返す
+        Allocation allocate(vk::DeviceSize size);
+
+        // dataを書き込んで、ダイナミックオフセットを返す 足りなければfalse
+        template<class T>
+        bool push(const T& data, uint32_t& dynamicOffset)
+        {
+            Allocation allocation = allocate(sizeof(T));
+            if (!allocation)
+            {
+                return false;
+            }
+            std::memcpy(allocation.pMapped, &data, sizeof(T));
+            dynamicOffset = allocation.offset;
+            return true;
+        }
+
+        // このフレームに書き込んだ範囲をデバイスに反映する コマンドバッファをsubmitする前に呼ぶ
+        void flush();
+
+        vk::Buffer getBuffer() const { return _buffer.get(); }
+        vk::DeviceSize getAlignment() const { return _alignment; }
+        // 今のフレームで使ったバイト数
+        vk::DeviceSize getUsedBytes() const { return _head - _frameBegin; }
+
+    private:
+        vk::Device _device;
+        MemoryAllocator& _memoryAllocator;
+
+        vk::UniqueBuffer _buffer;
+        MemoryAllocation _memory;
+        vk::DeviceSize _sizePerFrame;
+        vk::DeviceSize _alignment;
+
+        vk::DeviceSize _frameBegin = 0;
+        vk::DeviceSize _head = 0;
+        vk::DeviceSize _flushed = 0;
+    };
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <chrono>
@@ -7,46 +8,11 @@
 #include <iomanip>
 #include <iterator>
 
-#if defined(__ANDROID__)
-#include "AndroidOut.h"
-#endif
+#include "Logger.hpp"
 
 namespace Vulkan_Test {
     using namespace std;
 
-    inline void coutMultiThread(std::string str) {
-#if defined(__ANDROID__)
-        aout << str << std::endl;
-#else
-        cout << str;
-#endif
-    }
-
-    inline void cerrMultiThread(std::string str) {
-#if defined(__ANDROID__)
-        aout << str << std::endl;
-#else
-        cerr << str;
-#endif
-    }
-
-    inline string getTimeStamp() {
-        auto now = chrono::system_clock::now();
-        auto nowC = chrono::system_clock::to_time_t(now);
-        auto nowMs = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()) % 1000;
-        stringstream ss;
-        ss << put_time(localtime(&nowC), "%T") << '.' << setfill('0') << setw(3) << nowMs.count();
-        return ss.str();
-    }
-
-    inline std::string getIndexStr(size_t index) {
-        std::stringstream s;
-        for (size_t i = 0; i < index; i++) {
-            s << "    ";
-        }
-        return s.str();
-    }
-
     template<class T, class UniqueT>
     inline std::shared_ptr<std::vector<T>> unwrapHandles(std::vector<UniqueT> &uniques) {
         std::shared_ptr<std::vector<T>> result = std::make_shared<std::vector<T>>();
@@ -61,24 +27,46 @@ namespace Vulkan_Test {
         return result;
     }
 
-    inline int currentLogIndex = 0;
+    // FNV-1a (64bit) キャッシュのキーや壊れたデータの検出に使う 暗号用ではない
+    inline uint64_t hashFnv1a(const void* pData, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+        const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= pBytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
 }
 
 #define PUBLIC_GET_PRIVATE_SET(type, name) \
 public: type& Get##name(){ return name; } \
 private: type name
 
-#define SS2STR(x) \
-([&]() -> std::string { std::stringstream ss; ss << std::boolalpha << x; return ss.str(); })()
+// メッセージはその場で呼び出したスレッドのバッファに書き、文字列への整形と出力はLoggerのスレッドが行う
+// VULKAN_TEST_LOG_LEVELより低い重要度のマクロは何もしない (引数も評価されない)
+#define LOG_AT_LEVEL(level, x) \
+do { Vulkan_Test::Logger::Writer logWriter(level, __FILE__, __LINE__); logWriter.stream() << x; } while (false)
 
-#define FILE_LINE_STR \
-__FILE__ << ":" << std::setw(3) << std::setfill('0') << __LINE__ << std::setfill(' ')
+#if VULKAN_TEST_LOG_LEVEL <= VULKAN_TEST_LOG_LEVEL_DEBUG
+#define LOGDEBUG(x) LOG_AT_LEVEL(Vulkan_Test::LogLevel::Debug, x)
+#else
+#define LOGDEBUG(x) do { } while (false)
+#endif
 
-#define SET_LOG_INDEX(x) \
-do { Vulkan_Test::currentLogIndex = x; } while (false)
+#if VULKAN_TEST_LOG_LEVEL <= VULKAN_TEST_LOG_LEVEL_INFO
+#define LOG(x) LOG_AT_LEVEL(Vulkan_Test::LogLevel::Info, x)
+#else
+#define LOG(x) do { } while (false)
+#endif
+
+#if VULKAN_TEST_LOG_LEVEL <= VULKAN_TEST_LOG_LEVEL_ERROR
+#define LOGERR(x) LOG_AT_LEVEL(Vulkan_Test::LogLevel::Error, x)
+#else
+#define LOGERR(x) do { } while (false)
+#endif
 
-#define LOG(x) \
-do { Vulkan_Test::coutMultiThread(SS2STR(Vulkan_Test::getTimeStamp() << " " << FILE_LINE_STR << " " <<Vulkan_Test:: getIndexStr(Vulkan_Test::currentLogIndex) << x << "\n")); } while (false)
+#define LOG_CONCAT_INNER(a, b) a##b
+#define LOG_CONCAT(a, b) LOG_CONCAT_INNER(a, b)
 
-#define LOGERR(x) \
-do { Vulkan_Test::cerrMultiThread(SS2STR(Vulkan_Test::getTimeStamp() << " " << FILE_LINE_STR << " " << Vulkan_Test::getIndexStr(Vulkan_Test::currentLogIndex) << x << "\n")); } while (false)
+// このブロックの終わりまで、このスレッドのログを1段インデントする
+#define LOG_INDENT() Vulkan_Test::Logger::IndentScope LOG_CONCAT(logIndentScope, __LINE__)
@@ -0,0 +1,306 @@
+#include "Renderer.hpp"
+#include "HeadlessPlatform.hpp"
+#include "CommandPoolBenchmark.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+// ヘッドレス版のエントリポイント
+// サーフェスを作らずオフスクリーンのイメージに描画するので、lavapipeやSwiftShaderなどのソフトウェアICDでも動く
+// 同じ条件でフレーム時間を測ったり、描画結果を画像に書き出して基準の画像と比べたりするのに使う
+//
+// 例: VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json ./vulkan_test_headless --frames 1000 --output frame.ppm
+//
+// --frames N            描画するフレーム数 (既定 600)
+// --frames-in-flight N  同時にGPUへ投げておけるフレームの数 (既定 2)
+// --serialized          毎フレームキューのアイドルを待つ直列パスで描画する
+// --objects N           1フレームに描くオブジェクトの数 (既定 1)
+// --parallel-record     ドローが多いときにワーカースレッドでコマンドを並列に記録する
+// --no-draw-sort        ドローを並べ替えずに積んだ順に記録する (パイプラインのバインド数の比較用)
+// --no-instancing       同じメッシュとマテリアルのドローをインスタンス描画にまとめない (ドロー数の比較用)
+// --indirect            ドローを間接描画のコマンドにしてバッファに書き、drawIndexedIndirect(Count)で描く
+// --bench-command-pools コマンドバッファを1つずつリセットする場合とプールごとリセットする場合を比べて終わる
+// --width W --height H  描画先の大きさ (既定 1280x720)
+// --assets DIR          シェーダーなどを読むディレクトリ (既定 app/src/main/assets)
+// --output FILE         最後のフレームをPPM(P6)で書き出す
+// --golden FILE         最後のフレームをPPMの基準画像と比べ、違えば終了コード1で終わる
+// --tolerance N         基準画像との比較で許す各チャンネルの差 (既定 0)
+// --cache-dir DIR       パイプラインキャッシュをこのディレクトリに保存し、次の実行で使う
+// --log FILE            ログを標準出力に加えてファイルにも書く
+// --trace FILE          CPUとGPUの区間を記録し、Chrome Trace Event形式のJSONで書き出す (chrome://tracing や ui.perfetto.dev で開ける)
+
+#ifndef VULKAN_TEST_ASSET_DIR
+#define VULKAN_TEST_ASSET_DIR "app/src/main/assets"
+#endif
+
+struct HeadlessOptions {
+    uint32_t frames = 600;
+    RendererConfig rendererConfig;
+    vk::Extent2D extent = vk::Extent2D(1280, 720);
+    std::string assetDirectory = VULKAN_TEST_ASSET_DIR;
+    std::string outputPath;
+    std::string goldenPath;
+    uint32_t tolerance = 0;
+    std::string tracePath;
+    std::string logPath;
+    std::string cacheDirectory;
+    bool benchCommandPools = false;
+};
+
+static bool parseOptions(int argc, char** argv, HeadlessOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--serialized")
+        {
+            options.rendererConfig.serializeFrames = true;
+        }
+        else if (arg == "--no-draw-sort")
+        {
+            options.rendererConfig.sortDraws = false;
+        }
+        else if (arg == "--no-instancing")
+        {
+            options.rendererConfig.instancing = false;
+        }
+        else if (arg == "--indirect")
+        {
+            options.rendererConfig.indirectDraws = true;
+        }
+        else if (arg == "--bench-command-pools")
+        {
+            options.benchCommandPools = true;
+        }
+        else if (arg == "--parallel-record")
+        {
+            options.rendererConfig.parallelRecording = true;
+        }
+        else if (arg == "--objects" && hasValue)
+        {
+            options.rendererConfig.objectCount = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--frames" && hasValue)
+        {
+            options.frames = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--frames-in-flight" && hasValue)
+        {
+            options.rendererConfig.maxFramesInFlight = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--width" && hasValue)
+        {
+            options.extent.width = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--height" && hasValue)
+        {
+            options.extent.height = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--assets" && hasValue)
+        {
+            options.assetDirectory = argv[++i];
+        }
+        else if (arg == "--output" && hasValue)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (arg == "--golden" && hasValue)
+        {
+            options.goldenPath = argv[++i];
+        }
+        else if (arg == "--tolerance" && hasValue)
+        {
+            options.tolerance = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--cache-dir" && hasValue)
+        {
+            options.cacheDirectory = argv[++i];
+        }
+        else if (arg == "--log" && hasValue)
+        {
+            options.logPath = argv[++i];
+        }
+        else if (arg == "--trace" && hasValue)
+        {
+            options.tracePath = argv[++i];
+        }
+        else
+        {
+            LOGERR("Unknown option: " << arg);
+            return false;
+        }
+    }
+
+    if (options.extent.width == 0 || options.extent.height == 0)
+    {
+        LOGERR("Invalid extent: " << options.extent.width << "x" << options.extent.height);
+        return false;
+    }
+    return true;
+}
+
+// R8G8B8A8のピクセルをアルファを落としてPPM(P6)で書き出す
+static bool writePpm(const std::string& path, vk::Extent2D extent, const std::vector<uint8_t>& pixels)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+    for (size_t i = 0; i < pixels.size(); i += 4)
+    {
+        file.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+    }
+    return static_cast<bool>(file);
+}
+
+// writePpmで書き出した形式のPPM(P6, 最大値255)を読み、R8G8B8A8のピクセルにして返す
+static bool readPpm(const std::string& path, vk::Extent2D& extent, std::vector<uint8_t>& pixels)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    uint32_t maxValue = 0;
+    file >> magic >> extent.width >> extent.height >> maxValue;
+    file.get();
+    if (!file || magic != "P6" || maxValue != 255)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> rgb(size_t(extent.width) * extent.height * 3);
+    file.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+    if (!file)
+    {
+        return false;
+    }
+
+    pixels.resize(size_t(extent.width) * extent.height * 4);
+    for (size_t i = 0; i < size_t(extent.width) * extent.height; i++)
+    {
+        std::memcpy(&pixels[i * 4], &rgb[i * 3], 3);
+        pixels[i * 4 + 3] = 255;
+    }
+    return true;
+}
+
+// アルファ以外のチャンネルの差がtoleranceを超えるピクセルの数を返す
+static size_t countMismatchedPixels(const std::vector<uint8_t>& pixels, const std::vector<uint8_t>& golden, uint32_t tolerance)
+{
+    size_t mismatched = 0;
+    for (size_t i = 0; i < pixels.size(); i += 4)
+    {
+        for (size_t c = 0; c < 3; c++)
+        {
+            if (uint32_t(std::abs(int(pixels[i + c]) - int(golden[i + c]))) > tolerance)
+            {
+                mismatched++;
+                break;
+            }
+        }
+    }
+    return mismatched;
+}
+
+int main(int argc, char** argv)
+{
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!options.logPath.empty())
+    {
+        Vulkan_Test::Logger::get().setLogFile(options.logPath);
+    }
+
+    // 初期化(パイプラインの作成やメモリの確保)も記録したいのでRendererを作る前に始める
+    if (!options.tracePath.empty())
+    {
+        Vulkan_Test::TraceRecorder::get().start();
+    }
+
+    Renderer renderer(std::make_unique<Vulkan_Test::HeadlessPlatform>(options.assetDirectory, options.extent, options.cacheDirectory), options.rendererConfig);
+    LOG("Headless device: " << renderer.Get_physicalDevice().getProperties().deviceName.data() <<
+        " extent: " << options.extent.width << "x" << options.extent.height);
+
+    if (options.benchCommandPools)
+    {
+        Vulkan_Test::runCommandPoolBenchmark(renderer.Get_device().get(), renderer.Get_queueFamilyIndex(), renderer.Get_graphicsQueue(),
+                                             renderer.Get_maxFramesInFlight(), options.frames);
+        return EXIT_SUCCESS;
+    }
+
+    // パイプラインはワーカーでコンパイルされるので、計測と描画結果が毎回同じになるよう揃うまで待ってから始める
+    renderer.waitForPipelines();
+
+    bool needsReadback = !options.outputPath.empty() || !options.goldenPath.empty();
+    for (uint32_t i = 0; i < options.frames; i++)
+    {
+        if (needsReadback && i + 1 == options.frames)
+        {
+            renderer.requestReadback();
+        }
+        renderer.render();
+    }
+    renderer.Get_frameBenchmark().report();
+    renderer.Get_profiler()->dump();
+    renderer.Get_drawStats().report();
+
+    if (!options.tracePath.empty())
+    {
+        Vulkan_Test::TraceRecorder::get().stop();
+        // 成功も失敗もwriteChromeTraceがログに出す
+        if (!Vulkan_Test::TraceRecorder::get().writeChromeTrace(options.tracePath))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!needsReadback)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<uint8_t> pixels;
+    if (!renderer.readback(pixels))
+    {
+        LOGERR("Failed to read back the last frame");
+        return EXIT_FAILURE;
+    }
+
+    if (!options.outputPath.empty() && !writePpm(options.outputPath, options.extent, pixels))
+    {
+        LOGERR("Failed to write " << options.outputPath);
+        return EXIT_FAILURE;
+    }
+
+    if (!options.goldenPath.empty())
+    {
+        vk::Extent2D goldenExtent;
+        std::vector<uint8_t> golden;
+        if (!readPpm(options.goldenPath, goldenExtent, golden))
+        {
+            LOGERR("Failed to read " << options.goldenPath);
+            return EXIT_FAILURE;
+        }
+        if (goldenExtent != options.extent)
+        {
+            LOGERR("Golden image size mismatch: " << goldenExtent.width << "x" << goldenExtent.height);
+            return EXIT_FAILURE;
+        }
+
+        size_t mismatched = countMismatchedPixels(pixels, golden, options.tolerance);
+        LOG("Golden image: " << mismatched << " mismatched pixels (tolerance " << options.tolerance << ")");
+        if (mismatched != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -9,8 +9,62 @@ extern "C" {
 
 #include "AndroidOut.h"
 #include "Renderer.hpp"
+#include "AndroidPlatform.hpp"
 #include "Debug.hpp"
 
+#include <sys/system_properties.h>
+
+// 同時にGPUへ投げておけるフレームの数
+constexpr uint32_t kMaxFramesInFlight = 2;
+// trueにすると毎フレームキューのアイドルを待つ直列パスになる
+// FrameBenchmarkのログでフレームインフライトとの差を比較するときに使う
+constexpr bool kSerializeFrames = false;
+// このフレーム数ごとにプロファイラの統計(フレーム時間のp50/p95/p99と区間ごとのCPU/GPU時間)をログに出す
+constexpr uint32_t kProfilerReportInterval = 600;
+// プレゼントポリシーを切り替えるシステムプロパティ
+// 例: adb shell setprop debug.vulkan_test.present_policy low_latency
+// (low_latency / throughput / power_saver)
+constexpr const char* kPresentPolicyProperty = "debug.vulkan_test.present_policy";
+// 1にするとCPUとGPUの区間を記録し、アプリがバックグラウンドに回ったときにChrome Trace Event形式のJSONで書き出す
+// 例: adb shell setprop debug.vulkan_test.trace 1
+//     (アプリを起動してバックグラウンドに回した後)
+//     adb shell run-as com.example.vulkanslidetest cat files/trace.json > trace.json
+constexpr const char* kTraceProperty = "debug.vulkan_test.trace";
+
+RendererConfig getRendererConfig() {
+    RendererConfig config;
+    config.maxFramesInFlight = kMaxFramesInFlight;
+    config.serializeFrames = kSerializeFrames;
+    config.profilerReportInterval = kProfilerReportInterval;
+
+    char presentPolicyName[PROP_VALUE_MAX] = {};
+    if (__system_property_get(kPresentPolicyProperty, presentPolicyName) > 0) {
+        std::optional<Vulkan_Test::PresentPolicy> presentPolicy = Vulkan_Test::PresentPolicy::fromName(presentPolicyName);
+        if (presentPolicy) {
+            config.presentPolicy = presentPolicy.value();
+        } else {
+            LOGERR("Unknown present policy: " << presentPolicyName);
+        }
+    }
+    return config;
+}
+
+void startTraceIfRequested() {
+    char traceValue[PROP_VALUE_MAX] = {};
+    if (__system_property_get(kTraceProperty, traceValue) > 0 && std::string_view(traceValue) == "1") {
+        Vulkan_Test::TraceRecorder::get().start();
+    }
+}
+
+void writeTraceIfRecording(android_app *pApp) {
+    Vulkan_Test::TraceRecorder &traceRecorder = Vulkan_Test::TraceRecorder::get();
+    if (!traceRecorder.isEnabled() || !pApp->activity->internalDataPath) {
+        return;
+    }
+    // 成功も失敗もwriteChromeTraceがログに出す
+    traceRecorder.writeChromeTrace(std::string(pApp->activity->internalDataPath) + "/trace.json");
+}
+
 /*!
  * Handles commands sent to this Android application
  * @param pApp the app the commands are coming from
@@ -23,16 +77,37 @@ void handle_cmd(android_app *pApp, int32_t cmd) {
             // "game" class if that suits your needs. Remember to change all instances of userData
             // if you change the class here as a reinterpret_cast is dangerous this in the
             // android_main function and the APP_CMD_TERM_WINDOW handler case.
-            pApp->userData = new Renderer(pApp);
+            startTraceIfRequested();
+            pApp->userData = new Renderer(std::make_unique<Vulkan_Test::AndroidPlatform>(pApp), getRendererConfig());
 
             Vulkan_Test::debugApplicationInfo(reinterpret_cast<Renderer *>(pApp->userData));
             Vulkan_Test::debugInstanceCreateInfo(reinterpret_cast<Renderer *>(pApp->userData));
             Vulkan_Test::debugPhysicalDevices(reinterpret_cast<Renderer *>(pApp->userData));
             Vulkan_Test::debugPhysicalDevice(reinterpret_cast<Renderer *>(pApp->userData));
             Vulkan_Test::debugPhysicalMemory(reinterpret_cast<Renderer *>(pApp->userData));
+            Vulkan_Test::debugMemoryAllocator(reinterpret_cast<Renderer *>(pApp->userData));
+            Vulkan_Test::debugPipelineCache(reinterpret_cast<Renderer *>(pApp->userData));
+            Vulkan_Test::debugShaderRegistry(reinterpret_cast<Renderer *>(pApp->userData));
+            Vulkan_Test::debugDescriptors(reinterpret_cast<Renderer *>(pApp->userData));
             Vulkan_Test::debugQueueFamilyProperties(reinterpret_cast<Renderer *>(pApp->userData));
             Vulkan_Test::debugSwapchainCreateInfo(reinterpret_cast<Renderer *>(pApp->userData));
 
+            break;
+        case APP_CMD_WINDOW_RESIZED:
+        case APP_CMD_CONFIG_CHANGED:
+            // 画面の回転やサイズの変更
+            // Rendererを作り直すのではなく、スワップチェーンとそれに依存するものだけを作り直す
+            if (pApp->userData) {
+                reinterpret_cast<Renderer *>(pApp->userData)->requestSwapchainRecreation();
+            }
+            break;
+        case APP_CMD_PAUSE:
+            // バックグラウンドに回ったら、それまでの記録を書き出す (記録は続ける)
+            writeTraceIfRecording(pApp);
+            // バックグラウンドのまま終了させられることがあるので、パイプラインキャッシュもここで保存しておく
+            if (pApp->userData) {
+                reinterpret_cast<Renderer *>(pApp->userData)->savePipelineCache();
+            }
             break;
         case APP_CMD_TERM_WINDOW:
             // The window is being destroyed. Use this to clean up your userData to avoid leaking